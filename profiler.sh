@@ -13,17 +13,34 @@ usage() {
     echo "  collect           collect profile for the specified period of time"
     echo "                    and then stop (default action)"
     echo "Options:"
-    echo "  -e event          profiling event: cpu|alloc|lock|cache-misses etc."
+    echo "  -e event          profiling event: cpu|alloc|lock|exceptions|cache-misses etc."
     echo "  -d duration       run profiling for <duration> seconds"
     echo "  -f filename       dump output to <filename>"
     echo "  -i interval       sampling interval in nanoseconds"
     echo "  -j jstackdepth    maximum Java stack depth"
     echo "  -b bufsize        frame buffer size"
     echo "  -t                profile different threads separately"
+    echo "  --threads pattern profile only threads with names matching the pattern"
+    echo "  --context         split profile by the context tag set with AsyncProfiler.setContext"
+    echo "  --selfprof        measure sampling cost of the profiler itself"
+    echo "  --hugepages       back profiler buffers with huge pages"
+    echo "  --prefault        touch profiler buffers in advance"
+    echo "  --stackcache      reuse hashes of unchanged stack frames between samples"
+    echo "  --vmwalk          walk Java frames without AsyncGetCallTrace where possible"
+    echo "  --concurrency     measure how many threads run each frame at the same time"
+    echo "  --causal          predict the effect of optimizing methods with causal profiling"
+    echo "  --progress method count calls of the Java method as causal profiling progress points"
+    echo "  --caught          profile only exceptions that are caught"
+    echo "  --jit             report compilations, recompilations and code cache usage"
     echo "  -s                simple class names instead of FQN"
     echo "  -g                print method signatures"
     echo "  -a                annotate Java method names"
-    echo "  -o fmt            output format: summary|traces|flat|collapsed|svg|tree|jfr"
+    echo "  --lines           profile Java methods with line numbers"
+    echo "  --tiers           record and annotate interpreted/C1/C2/inlined Java frames"
+    echo "  --server path     accept further commands on a Unix domain socket"
+    echo "  --trigger spec    profile for a while each time the condition holds: cpu>N%[:sec] or gc>Nms[:sec]"
+    echo "                    every session is dumped to -f filename, e.g. profile-%t.svg"
+    echo "  -o fmt            output format: summary|traces|flat|collapsed|svg|tree|jfr|snapshot"
     echo "  -I include        output only stack traces containing the specified pattern"
     echo "  -X exclude        exclude stack traces with the specified pattern"
     echo "  -v, --version     display version string"
@@ -100,6 +117,7 @@ USE_TMP="true"
 OUTPUT=""
 FORMAT=""
 PARAMS=""
+TRIGGER=""
 PID=""
 
 while [ $# -gt 0 ]; do
@@ -150,6 +168,12 @@ while [ $# -gt 0 ]; do
         -a)
             FORMAT="$FORMAT,ann"
             ;;
+        --lines)
+            FORMAT="$FORMAT,lines"
+            ;;
+        --tiers)
+            FORMAT="$FORMAT,tiers"
+            ;;
         -o)
             OUTPUT="$2"
             shift
@@ -162,6 +186,54 @@ while [ $# -gt 0 ]; do
             FORMAT="$FORMAT,exclude=$2"
             shift
             ;;
+        --selfprof)
+            PARAMS="$PARAMS,selfprof"
+            ;;
+        --context)
+            PARAMS="$PARAMS,context"
+            ;;
+        --hugepages)
+            PARAMS="$PARAMS,hugepages"
+            ;;
+        --prefault)
+            PARAMS="$PARAMS,prefault"
+            ;;
+        --stackcache)
+            PARAMS="$PARAMS,stackcache"
+            ;;
+        --vmwalk)
+            PARAMS="$PARAMS,vmwalk"
+            ;;
+        --concurrency)
+            PARAMS="$PARAMS,concurrency"
+            ;;
+        --causal)
+            PARAMS="$PARAMS,causal"
+            ;;
+        --progress)
+            PARAMS="$PARAMS,progress=$2"
+            shift
+            ;;
+        --caught)
+            PARAMS="$PARAMS,caught"
+            ;;
+        --jit)
+            PARAMS="$PARAMS,jit"
+            ;;
+        --threads)
+            THREADS="$(echo "$2" | sed 's/,/;/g')"
+            PARAMS="$PARAMS,threads=$THREADS"
+            shift
+            ;;
+        --trigger)
+            ACTION="trigger"
+            TRIGGER="$2"
+            shift
+            ;;
+        --server)
+            PARAMS="$PARAMS,server=$2"
+            shift
+            ;;
         --filter)
             FILTER="$(echo "$2" | sed 's/,/;/g')"
             FORMAT="$FORMAT,filter=$FILTER"
@@ -252,6 +324,13 @@ case $ACTION in
     stop)
         jattach "stop,file=$FILE,$OUTPUT$FORMAT"
         ;;
+    trigger)
+        if [ "$USE_TMP" = true ]; then
+            echo "--trigger requires -f filename"
+            exit 1
+        fi
+        jattach "trigger=$TRIGGER,event=$EVENT,file=$FILE,$OUTPUT$FORMAT$PARAMS"
+        ;;
     status)
         jattach "status,file=$FILE"
         ;;
@@ -17,6 +17,9 @@
 package one.profiler;
 
 import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import java.nio.ReadOnlyBufferException;
 
 /**
  * Java API for in-process profiling. Serves as a wrapper around
@@ -92,6 +95,25 @@ public class AsyncProfiler implements AsyncProfilerMXBean {
     @Override
     public native long getSamples();
 
+    /**
+     * Get the time spent collecting samples as a percentage of the process CPU time
+     * while profiling. Requires 'selfprof' option at start
+     *
+     * @return Profiler overhead in percent
+     */
+    @Override
+    public native double getOverhead();
+
+    /**
+     * Dump per-phase latency histograms of sample collection
+     * and counts of stack recovery attempts.
+     * Latencies are collected only with 'selfprof' option
+     *
+     * @return Textual representation of the profiler self-cost
+     */
+    @Override
+    public native String dumpSelfProfile();
+
     /**
      * Get profiler agent version, e.g. "1.0"
      *
@@ -120,6 +142,52 @@ public class AsyncProfiler implements AsyncProfilerMXBean {
         return execute0(command);
     }
 
+    /**
+     * Execute a profiling command and write its output directly
+     * into the given direct ByteBuffer, starting at the buffer's position.
+     * Unlike {@link #execute(String)}, this does not create a String on the Java heap,
+     * and also supports binary formats. The 'file' option is ignored for text formats;
+     * for JFR, it must name the file the recording was started with.
+     * <p>
+     * If the output does not fit in the remaining space, the buffer is filled up
+     * but its position is not changed, so that the caller can retry with a larger buffer.
+     *
+     * @param command Profiling command, e.g. "collapsed,counter=samples"
+     * @param buffer Direct or mapped ByteBuffer
+     * @return The size of the complete output in bytes
+     * @throws IllegalArgumentException If failed to parse the command or the buffer is not direct
+     * @throws IOException If failed to read JFR output file
+     */
+    public long dump(String command, ByteBuffer buffer) throws IllegalArgumentException, IOException {
+        if (!buffer.isDirect()) {
+            throw new IllegalArgumentException("Direct ByteBuffer required");
+        } else if (buffer.isReadOnly()) {
+            throw new ReadOnlyBufferException();
+        }
+
+        int position = buffer.position();
+        int remaining = buffer.remaining();
+        long size = dumpToBuffer0(command, buffer, position, remaining);
+        if (size <= remaining) {
+            buffer.position(position + (int) size);
+        }
+        return size;
+    }
+
+    /**
+     * Execute a profiling command and write its output to the given stream in chunks.
+     * The stream is not closed. It must not call back into the profiler,
+     * since it is invoked while the profiler holds its lock.
+     *
+     * @param command Profiling command, e.g. "collapsed,counter=samples"
+     * @param out The stream to write the output to
+     * @throws IllegalArgumentException If failed to parse the command
+     * @throws IOException If the stream throws or failed to read JFR output file
+     */
+    public void dump(String command, OutputStream out) throws IllegalArgumentException, IOException {
+        dumpToStream0(command, out);
+    }
+
     /**
      * Dump profile in 'collapsed stacktraces' format
      *
@@ -165,6 +233,47 @@ public class AsyncProfiler implements AsyncProfilerMXBean {
         }
     }
 
+    /**
+     * Set the request context of the current thread. Every sample taken in this thread
+     * is recorded with the context until it is changed or cleared:
+     * JFR output stores both values in each event; with the 'context' option,
+     * other outputs add a [tag=N] frame at the bottom of the stack,
+     * so that the profile can be split or filtered by tag, e.g. include=tag=N
+     *
+     * @param spanId Span or request ID, recorded in JFR only
+     * @param tag Arbitrary tag to group samples by; 0 means no tag.
+     *            A [tag=N] frame keeps only the lower 32 bits of it
+     */
+    public native void setContext(long spanId, long tag);
+
+    /**
+     * Clear the request context of the current thread
+     */
+    public void clearContext() {
+        setContext(0, 0);
+    }
+
+    /**
+     * Mark a progress point for causal profiling. Throughput is measured
+     * as the rate of progress points during 'causal' experiments.
+     */
+    public native void progress();
+
+    /**
+     * Start a transaction whose latency is measured by causal profiling
+     *
+     * @return Token to pass to {@link #endTransaction(long)}
+     */
+    public native long beginTransaction();
+
+    /**
+     * Finish a transaction started with {@link #beginTransaction()}.
+     * The transaction may finish in a thread other than the one that started it.
+     *
+     * @param token Value returned by beginTransaction()
+     */
+    public native void endTransaction(long token);
+
     /**
      * Add the given thread to the set of profiled threads.
      * 'filter' option must be enabled to use this method.
@@ -202,5 +311,7 @@ public class AsyncProfiler implements AsyncProfilerMXBean {
     private native void start0(String event, long interval, boolean reset) throws IllegalStateException;
     private native void stop0() throws IllegalStateException;
     private native String execute0(String command) throws IllegalArgumentException, IOException;
+    private native long dumpToBuffer0(String command, ByteBuffer buffer, int offset, int length) throws IllegalArgumentException, IOException;
+    private native void dumpToStream0(String command, OutputStream out) throws IllegalArgumentException, IOException;
     private native void filterThread0(Thread thread, boolean enable);
 }
@@ -33,6 +33,7 @@ public interface AsyncProfilerMXBean {
     void stop() throws IllegalStateException;
 
     long getSamples();
+    double getOverhead();
     String getVersion();
 
     String execute(String command) throws IllegalArgumentException, java.io.IOException;
@@ -40,4 +41,5 @@ public interface AsyncProfilerMXBean {
     String dumpCollapsed(Counter counter);
     String dumpTraces(int maxTraces);
     String dumpFlat(int maxMethods);
+    String dumpSelfProfile();
 }
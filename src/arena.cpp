@@ -0,0 +1,147 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "arena.h"
+
+#ifdef __APPLE__
+typedef char mincore_vec_t;
+#else
+typedef unsigned char mincore_vec_t;
+#endif
+
+
+static void* mapMemory(size_t size, int extra_flags) {
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+const char* Arena::regionName(ArenaRegion region) {
+    switch (region) {
+        case REGION_FRAME_BUFFER:
+            return "Frame buffer";
+        case REGION_CALLTRACE_BUFFERS:
+            return "Call trace buffers";
+        case REGION_JFR_BUFFERS:
+            return "JFR buffers";
+        case REGION_STACK_CACHE:
+            return "Stack cache";
+        case REGION_CONCURRENCY_LOG:
+            return "Concurrency log";
+        default:
+            return "unknown";
+    }
+}
+
+Error Arena::reserve(size_t capacity, bool huge_pages, bool prefault) {
+    release();
+
+    int populate = 0;
+#ifdef MAP_POPULATE
+    if (prefault) populate = MAP_POPULATE;
+#endif
+
+    void* base = NULL;
+    _huge_pages = false;
+
+    if (huge_pages) {
+        size_t huge_capacity = (capacity + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+        // Explicit huge pages need a preconfigured pool (vm.nr_hugepages)
+        base = mapMemory(huge_capacity, MAP_HUGETLB | populate);
+        _huge_pages = base != NULL;
+#endif
+        if (base == NULL) {
+            base = mapMemory(huge_capacity, 0);
+#ifdef MADV_HUGEPAGE
+            // Otherwise ask for transparent huge pages before the memory is touched
+            if (base != NULL) {
+                _huge_pages = madvise(base, huge_capacity, MADV_HUGEPAGE) == 0;
+            }
+#endif
+        }
+        capacity = huge_capacity;
+    } else {
+        base = mapMemory(capacity, populate);
+    }
+
+    if (base == NULL) {
+        return Error("Could not reserve memory for profiler buffers");
+    }
+
+    // MAP_POPULATE is not available everywhere and is not combined with madvise above
+    if (prefault) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        for (size_t offset = 0; offset < capacity; offset += page_size) {
+            ((volatile char*)base)[offset] = 0;
+        }
+    }
+
+    _base = (char*)base;
+    _capacity = capacity;
+    _huge_pages_requested = huge_pages;
+    _prefault = prefault;
+    return Error::OK;
+}
+
+void Arena::release() {
+    if (_base != NULL) {
+        munmap(_base, _capacity);
+        _base = NULL;
+    }
+
+    _capacity = 0;
+    _used = 0;
+    for (int i = 0; i < ARENA_REGIONS; i++) {
+        _region_used[i] = 0;
+    }
+}
+
+size_t Arena::residentSize(const void* addr, size_t size) {
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page_size - 1);
+    size_t pages = ((uintptr_t)addr + size - start + page_size - 1) / page_size;
+
+    // If residency cannot be told, the whole range is counted
+    size_t resident = size;
+    mincore_vec_t* vec = (mincore_vec_t*)malloc(pages);
+    if (vec != NULL && mincore((void*)start, pages * page_size, vec) == 0) {
+        resident = 0;
+        for (size_t i = 0; i < pages; i++) {
+            if (vec[i] & 1) resident += page_size;
+        }
+    }
+    free(vec);
+    return resident;
+}
+
+void* Arena::alloc(ArenaRegion region, size_t size) {
+    size = align(size);
+
+    size_t offset;
+    do {
+        offset = _used;
+        if (size > _capacity - offset) {
+            return NULL;
+        }
+    } while (!__sync_bool_compare_and_swap(&_used, offset, offset + size));
+
+    __sync_fetch_and_add(&_region_used[region], size);
+    return _base + offset;
+}
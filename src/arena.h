@@ -0,0 +1,87 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+#include "arguments.h"
+
+
+// Allocations are aligned to avoid false sharing between per-stripe buffers
+const size_t ARENA_ALIGNMENT = 64;
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+enum ArenaRegion {
+    REGION_FRAME_BUFFER,
+    REGION_CALLTRACE_BUFFERS,
+    REGION_JFR_BUFFERS,
+    REGION_STACK_CACHE,
+    REGION_CONCURRENCY_LOG,
+    ARENA_REGIONS
+};
+
+
+// One contiguous mapping for the buffers touched by signal handlers.
+// Memory is reserved up front, optionally on huge pages and prefaulted,
+// so that sampled threads do not take page faults inside the handler.
+// alloc() is lock-free and async-signal-safe; memory is returned only by release().
+//
+// Tables indexed by thread ID stay outside: PerfEvents::_events spans pid_max entries and
+// ThreadFilter bitmaps span the whole thread ID range, so reserving or prefaulting them here
+// would commit far more than the threads in use. Their entries are written outside signal
+// handlers, when an event is created or a thread is added, and both outlive the arena,
+// which is re-reserved whenever framebuf, jstackdepth or memory options change.
+class Arena {
+  private:
+    char* _base;
+    size_t _capacity;
+    volatile size_t _used;
+    volatile size_t _region_used[ARENA_REGIONS];
+    bool _huge_pages_requested;
+    bool _huge_pages;
+    bool _prefault;
+
+  public:
+    Arena() : _base(NULL), _capacity(0), _used(0), _huge_pages_requested(false), _huge_pages(false), _prefault(false) {
+        for (int i = 0; i < ARENA_REGIONS; i++) {
+            _region_used[i] = 0;
+        }
+    }
+
+    static size_t align(size_t size) {
+        return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    }
+
+    static const char* regionName(ArenaRegion region);
+
+    // Bytes of the given memory range that are backed by physical pages, for the memory usage summary
+    static size_t residentSize(const void* addr, size_t size);
+
+    Error reserve(size_t capacity, bool huge_pages, bool prefault);
+    void release();
+    void* alloc(ArenaRegion region, size_t size);
+
+    bool reserved() { return _base != NULL; }
+    size_t capacity() { return _capacity; }
+    size_t used() { return _used; }
+    size_t regionUsed(ArenaRegion region) { return _region_used[region]; }
+    bool hugePagesRequested() { return _huge_pages_requested; }
+    bool hugePages() { return _huge_pages; }
+    bool prefaulted() { return _prefault; }
+};
+
+#endif // _ARENA_H
@@ -62,6 +62,7 @@ const size_t EXTRA_BUF_SIZE = 512;
 //     tree[=C]        - produce call tree in HTML format
 //                       C is counter type: 'samples' or 'total'
 //     jfr             - dump events in Java Flight Recorder format
+//     snapshot        - dump raw call traces and method names for offline replay
 //     summary         - dump profiling summary (number of collected samples of each type)
 //     traces[=N]      - dump top N call traces
 //     flat[=N]        - dump top N methods (aka flat profile)
@@ -70,8 +71,24 @@ const size_t EXTRA_BUF_SIZE = 512;
 //     framebuf=N      - size of the buffer for stack frames (default: 1'000'000)
 //     safemode=BITS   - disable stack recovery techniques (default: 0, i.e. everything enabled)
 //     file=FILENAME   - output file name for dumping
+//     server=PATH     - accept commands on a Unix domain socket
+//     trigger=SPEC    - profile for a while each time a condition holds, then dump to 'file':
+//                       cpu>N%[:DURATION] - process CPU usage exceeds N% of one core
+//                       gc>PAUSE[:DURATION] - GC pause longer than PAUSE, e.g. 200ms
 //     filter=FILTER   - thread filter
 //     threads         - profile different threads separately
+//     threads=PATTERN - profile only threads with names matching PATTERN (glob, ';'-separated list)
+//     context         - split profile by the context tag set with AsyncProfiler.setContext()
+//     selfprof        - measure the cost of collecting samples, reported in summary
+//     hugepages       - back profiler buffers with huge pages
+//     prefault        - touch profiler buffers at start to avoid page faults while sampling
+//     stackcache      - rehash only the changed top of deep stacks between samples of a thread
+//     vmwalk          - walk compiled and interpreted frames without AsyncGetCallTrace where possible
+//     concurrency     - sample all threads at once on every wall clock tick to measure parallelism
+//     causal[=TIME]   - causal profiling: predict the gain from speeding up methods, TIME is experiment length
+//     progress=METHOD - count calls of the Java method as progress points for causal profiling
+//     caught          - in exception profiling mode, record only exceptions that are caught
+//     jit             - report compilations, recompilations and code cache usage during profiling
 //     cstack=MODE     - how to collect C stack frames in addition to Java stack
 //                       MODE is 'fp' (Frame Pointer), 'lbr' (Last Branch Record) or 'no'
 //     allkernel       - include only kernel-mode events
@@ -80,6 +97,8 @@ const size_t EXTRA_BUF_SIZE = 512;
 //     dot             - dotted class names
 //     sig             - print method signatures
 //     ann             - annotate Java method names
+//     lines           - profile Java methods with line numbers
+//     tiers           - record and annotate interpreted/C1/C2/inlined Java frames
 //     include=PATTERN - include stack traces containing PATTERN
 //     exclude=PATTERN - exclude stack traces containing PATTERN
 //     title=TITLE     - FlameGraph title
@@ -146,6 +165,9 @@ Error Arguments::parse(const char* args) {
             CASE("jfr")
                 _output = OUTPUT_JFR;
 
+            CASE("snapshot")
+                _output = OUTPUT_SNAPSHOT;
+
             CASE("summary")
                 _output = OUTPUT_TEXT;
 
@@ -188,6 +210,21 @@ Error Arguments::parse(const char* args) {
                 }
                 _file = value;
 
+            CASE("server")
+                if (value == NULL || value[0] == 0) {
+                    return Error("server socket path must not be empty");
+                }
+                _server = value;
+
+            CASE("trigger")
+                if (value == NULL || value[0] == 0) {
+                    return Error("trigger must not be empty");
+                }
+                Error error = parseTrigger(value);
+                if (error) {
+                    return error;
+                }
+
             // Filters
             CASE("filter")
                 _filter = value == NULL ? "" : value;
@@ -199,7 +236,51 @@ Error Arguments::parse(const char* args) {
                 if (value != NULL) appendToEmbeddedList(_exclude, value);
 
             CASE("threads")
-                _threads = true;
+                if (value == NULL) {
+                    _threads = true;
+                } else if (value[0] == 0) {
+                    return Error("threads pattern must not be empty");
+                } else {
+                    _thread_pattern = value;
+                }
+
+            CASE("context")
+                _context = true;
+
+            CASE("selfprof")
+                _self_profile = true;
+
+            CASE("hugepages")
+                _huge_pages = true;
+
+            CASE("prefault")
+                _prefault = true;
+
+            CASE("stackcache")
+                _stack_cache = true;
+
+            CASE("vmwalk")
+                _vm_walk = true;
+
+            CASE("concurrency")
+                _concurrency = true;
+
+            CASE("causal")
+                if ((_causal = value == NULL ? DEFAULT_EXPERIMENT_TIME : parseUnits(value)) <= 0) {
+                    return Error("Invalid causal experiment length");
+                }
+
+            CASE("progress")
+                if (value == NULL || strchr(value, '.') == NULL) {
+                    return Error("progress must be ClassName.methodName");
+                }
+                _progress = value;
+
+            CASE("caught")
+                _caught_only = true;
+
+            CASE("jit")
+                _jit = true;
 
             CASE("allkernel")
                 _ring = RING_KERNEL;
@@ -231,6 +312,12 @@ Error Arguments::parse(const char* args) {
             CASE("ann")
                 _style |= STYLE_ANNOTATE;
 
+            CASE("lines")
+                _style |= STYLE_LINES;
+
+            CASE("tiers")
+                _style |= STYLE_TIERS | STYLE_ANNOTATE;
+
             // FlameGraph options
             CASE("title")
                 if (value != NULL) _title = value;
@@ -281,6 +368,48 @@ long long Arguments::hash(const char* arg) {
     return h;
 }
 
+// Parses KIND>THRESHOLD[:DURATION]. Duration without units is in seconds
+Error Arguments::parseTrigger(char* spec) {
+    if (strncmp(spec, "method:", 7) == 0) {
+        return Error("Method latency trigger is not supported");
+    }
+
+    char* duration = strchr(spec, ':');
+    if (duration != NULL) {
+        *duration++ = 0;
+        char* end;
+        long long seconds = strtoll(duration, &end, 10);
+        _trigger_duration = *end == 0 ? seconds * 1000000000LL : parseUnits(duration);
+        if (_trigger_duration <= 0) {
+            return Error("Invalid trigger duration");
+        }
+    }
+
+    char* threshold = strchr(spec, '>');
+    if (threshold == NULL) {
+        return Error("Trigger threshold is not specified");
+    }
+    *threshold++ = 0;
+
+    if (strcmp(spec, "cpu") == 0) {
+        char* end;
+        _trigger = TRIGGER_CPU;
+        _trigger_threshold = strtoll(threshold, &end, 10);
+        if (_trigger_threshold <= 0 || (*end != 0 && strcmp(end, "%") != 0)) {
+            return Error("Invalid CPU trigger threshold");
+        }
+    } else if (strcmp(spec, "gc") == 0) {
+        _trigger = TRIGGER_GC;
+        if ((_trigger_threshold = parseUnits(threshold)) <= 0) {
+            return Error("Invalid GC pause trigger threshold");
+        }
+    } else {
+        return Error("Unknown trigger");
+    }
+
+    return Error::OK;
+}
+
 // Expands %p to the process id
 //         %t to the timestamp
 const char* Arguments::expandFilePattern(char* dest, size_t max_size, const char* pattern) {
@@ -322,6 +451,8 @@ Output Arguments::detectOutputFormat(const char* file) {
             return OUTPUT_TREE;
         } else if (strcmp(ext, ".jfr") == 0) {
             return OUTPUT_JFR;
+        } else if (strcmp(ext, ".snapshot") == 0) {
+            return OUTPUT_SNAPSHOT;
         } else if (strcmp(ext, ".collapsed") == 0 || strcmp(ext, ".folded") == 0) {
             return OUTPUT_COLLAPSED;
         }
@@ -329,21 +460,22 @@ Output Arguments::detectOutputFormat(const char* file) {
     return OUTPUT_TEXT;
 }
 
-long Arguments::parseUnits(const char* str) {
+// Nanoseconds and bytes do not fit in long on 32-bit systems
+long long Arguments::parseUnits(const char* str) {
     char* end;
-    long result = strtol(str, &end, 0);
+    long long result = strtoll(str, &end, 0);
 
     switch (*end) {
         case 0:
             return result;
         case 'K': case 'k':
         case 'U': case 'u': // microseconds
-            return result * 1000;
+            return result * 1000LL;
         case 'M': case 'm': // million, megabytes or milliseconds
-            return result * 1000000;
+            return result * 1000000LL;
         case 'G': case 'g':
         case 'S': case 's': // seconds
-            return result * 1000000000;
+            return result * 1000000000LL;
     }
 
     return -1;
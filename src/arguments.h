@@ -23,12 +23,15 @@
 const long DEFAULT_INTERVAL = 10000000;  // 10 ms
 const int DEFAULT_FRAMEBUF = 1000000;
 const int DEFAULT_JSTACKDEPTH = 2048;
+const unsigned long long DEFAULT_TRIGGER_DURATION = 30000000000ULL;  // 30 s
+const long DEFAULT_EXPERIMENT_TIME = 100000000;  // 100 ms
 
 const char* const EVENT_CPU    = "cpu";
 const char* const EVENT_ALLOC  = "alloc";
 const char* const EVENT_LOCK   = "lock";
 const char* const EVENT_WALL   = "wall";
 const char* const EVENT_ITIMER = "itimer";
+const char* const EVENT_EXCEPTIONS = "exceptions";
 
 enum Action {
     ACTION_NONE,
@@ -58,7 +61,9 @@ enum Style {
     STYLE_SIMPLE     = 1,
     STYLE_DOTTED     = 2,
     STYLE_SIGNATURES = 4,
-    STYLE_ANNOTATE   = 8
+    STYLE_ANNOTATE   = 8,
+    STYLE_LINES      = 16,
+    STYLE_TIERS      = 32
 };
 
 enum CStack {
@@ -68,13 +73,20 @@ enum CStack {
     CSTACK_LBR
 };
 
+enum TriggerType {
+    TRIGGER_NONE,
+    TRIGGER_CPU,
+    TRIGGER_GC
+};
+
 enum Output {
     OUTPUT_NONE,
     OUTPUT_TEXT,
     OUTPUT_COLLAPSED,
     OUTPUT_FLAMEGRAPH,
     OUTPUT_TREE,
-    OUTPUT_JFR
+    OUTPUT_JFR,
+    OUTPUT_SNAPSHOT
 };
 
 
@@ -107,7 +119,9 @@ class Arguments {
     static long long hash(const char* arg);
     static const char* expandFilePattern(char* dest, size_t max_size, const char* pattern);
     static Output detectOutputFormat(const char* file);
-    static long parseUnits(const char* str);
+    static long long parseUnits(const char* str);
+
+    Error parseTrigger(char* spec);
 
   public:
     Action _action;
@@ -120,9 +134,25 @@ class Arguments {
     int _safe_mode;
     const char* _file;
     const char* _filter;
+    const char* _thread_pattern;
+    const char* _server;
+    TriggerType _trigger;
+    long long _trigger_threshold;
+    long long _trigger_duration;
     int _include;
     int _exclude;
     bool _threads;
+    bool _context;
+    bool _self_profile;
+    bool _huge_pages;
+    bool _prefault;
+    bool _stack_cache;
+    bool _vm_walk;
+    bool _concurrency;
+    long long _causal;
+    const char* _progress;
+    bool _caught_only;
+    bool _jit;
     int _style;
     CStack _cstack;
     Output _output;
@@ -147,9 +177,25 @@ class Arguments {
         _safe_mode(0),
         _file(NULL),
         _filter(NULL),
+        _thread_pattern(NULL),
+        _server(NULL),
+        _trigger(TRIGGER_NONE),
+        _trigger_threshold(0),
+        _trigger_duration(DEFAULT_TRIGGER_DURATION),
         _include(0),
         _exclude(0),
         _threads(false),
+        _context(false),
+        _self_profile(false),
+        _huge_pages(false),
+        _prefault(false),
+        _stack_cache(false),
+        _vm_walk(false),
+        _concurrency(false),
+        _causal(0),
+        _progress(NULL),
+        _caught_only(false),
+        _jit(false),
         _style(0),
         _cstack(CSTACK_DEFAULT),
         _output(OUTPUT_NONE),
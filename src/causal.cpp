@@ -0,0 +1,328 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "causal.h"
+#include "frameName.h"
+#include "os.h"
+
+
+struct SpeedupStats {
+    int experiments;
+    u64 progress;
+    u64 time;  // virtual, ns
+    u64 latency;
+    u64 transactions;
+
+    void add(const Experiment& e) {
+        experiments++;
+        progress += e.progress;
+        time += e.duration - e.delay;
+        latency += e.latency;
+        transactions += e.transactions;
+    }
+
+    double throughput() const {
+        return time == 0 ? 0 : progress * 1e9 / time;
+    }
+
+    double averageLatency() const {
+        return transactions == 0 ? 0 : (double)latency / transactions;
+    }
+};
+
+struct MethodImpact {
+    jmethodID method;
+    SpeedupStats levels[SPEEDUP_LEVELS];
+    double impact;
+
+    // By the predicted gain per unit of local speedup
+    static int comparator(const void* s1, const void* s2) {
+        double a = (*(const MethodImpact**)s1)->impact;
+        double b = (*(const MethodImpact**)s2)->impact;
+        return a > b ? -1 : a < b ? 1 : 0;
+    }
+};
+
+
+// Runs in a signal handler, which must not clobber errno of the interrupted code
+static void pause(u64 delay) {
+    int saved_errno = errno;
+
+    struct timespec timeout;
+    timeout.tv_sec = delay / 1000000000;
+    timeout.tv_nsec = delay % 1000000000;
+    while (nanosleep(&timeout, &timeout) != 0 && errno == EINTR) {
+        // Other signals do not shorten the delay
+    }
+
+    errno = saved_errno;
+}
+
+static u64 nextRandom(u64& seed) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static void formatChange(char* buf, size_t size, double value, double baseline, bool known) {
+    if (!known) {
+        snprintf(buf, size, "-");
+    } else {
+        snprintf(buf, size, "%+.2f%%", (value / baseline - 1) * 100);
+    }
+}
+
+
+Error CausalProfiler::start(Arguments& args, long interval) {
+    _interval = interval;
+    _experiment_time = args._causal;
+    _selecting = false;
+    _delay = 0;
+    _running = true;
+
+    if (pthread_create(&_thread, NULL, threadEntry, this) != 0) {
+        _running = false;
+        return Error("Unable to create causal profiler thread");
+    }
+    return Error::OK;
+}
+
+void CausalProfiler::stop() {
+    _lock.lock();
+    _running = false;
+    _lock.notify();
+    _lock.unlock();
+
+    pthread_join(_thread, NULL);
+}
+
+void CausalProfiler::experimentLoop() {
+    MutexLocker ml(_lock);
+    u64 seed = OS::nanotime() | 1;
+
+    while (_running && _experiment_count < MAX_EXPERIMENTS) {
+        // Half of the experiments measure the baseline
+        u64 r = nextRandom(seed);
+        int speedup = (r & 1) ? (int)((r >> 1) % (SPEEDUP_LEVELS - 1) + 1) * SPEEDUP_STEP : 0;
+
+        Experiment* e = &_experiments[_experiment_count];
+        if (!runExperiment(speedup, e)) {
+            break;
+        }
+        _experiment_count++;
+
+        if (e->progress < MIN_EXPERIMENT_PROGRESS && _experiment_time < MAX_EXPERIMENT_TIME * 1000000) {
+            _experiment_time *= 2;
+        }
+
+        u64 deadline = OS::millis() + EXPERIMENT_COOLDOWN;
+        while (_running && OS::millis() < deadline) {
+            _lock.waitUntil(deadline);
+        }
+    }
+}
+
+bool CausalProfiler::runExperiment(int speedup, Experiment* e) {
+    // The next sample that lands in a Java method chooses the method to speed up
+    _selected = NULL;
+    // No delays are inserted between experiments, so _total_delay stays put until one is selected
+    _epoch_delay = _total_delay;
+    _epoch++;
+    _selecting = true;
+    while (_selected == NULL) {
+        _lock.waitUntil(OS::millis() + 1);
+        if (!_running) {
+            _selecting = false;
+            return false;
+        }
+    }
+    _selecting = false;
+
+    u64 start_time = OS::nanotime();
+    u64 start_delay = _total_delay;
+    u64 start_progress = _progress;
+    u64 start_latency = _latency;
+    u64 start_transactions = _transactions;
+    _delay = (u64)_interval * speedup / 100;
+
+    // An experiment interrupted by stop is still a valid, just shorter, measurement
+    u64 deadline = OS::millis() + _experiment_time / 1000000;
+    while (_running && OS::millis() < deadline) {
+        _lock.waitUntil(deadline);
+    }
+
+    _delay = 0;
+    e->method = _selected;
+    e->speedup = speedup;
+    e->duration = OS::nanotime() - start_time;
+    e->delay = _total_delay - start_delay;
+    e->progress = _progress - start_progress;
+    e->latency = _latency - start_latency;
+    e->transactions = _transactions - start_transactions;
+    return true;
+}
+
+CausalThread* CausalProfiler::findThread(int tid) {
+    u32 epoch = _epoch;
+    u32 start = (u32)tid % MAX_CAUSAL_THREADS;
+
+    for (int i = 0; i < MAX_CAUSAL_THREAD_PROBE; i++) {
+        CausalThread* thread = &_threads[(start + i) % MAX_CAUSAL_THREADS];
+        int owner = thread->tid;
+        if (owner == tid) {
+            return thread;
+        }
+
+        // Slots of threads not sampled during the last experiments are taken over by new threads
+        if ((owner == 0 || epoch - thread->epoch > 2) && __sync_bool_compare_and_swap(&thread->tid, owner, tid)) {
+            thread->delay = _total_delay;
+            thread->epoch = epoch;
+            return thread;
+        }
+    }
+
+    return NULL;
+}
+
+void CausalProfiler::sample(int tid, jmethodID method) {
+    CausalThread* thread = findThread(tid);
+    if (thread == NULL) {
+        return;
+    }
+
+    u32 epoch = _epoch;
+    if (thread->epoch != epoch) {
+        // Debt left from earlier experiments belongs to a thread that was not running then, so it is forgiven.
+        // Every delay of the current experiment is still owed: the experiment subtracts all of them from its time
+        thread->epoch = epoch;
+        u64 epoch_delay = _epoch_delay;
+        if (thread->delay < epoch_delay) {
+            thread->delay = epoch_delay;
+        }
+    }
+
+    if (method != NULL) {
+        if (method == _selected) {
+            // The thread running the selected method is the one being sped up, so it does not wait
+            u64 delay = _delay;
+            if (delay != 0) {
+                atomicInc(_total_delay, delay);
+                thread->delay += delay;
+            }
+        } else if (_selecting) {
+            __sync_bool_compare_and_swap(&_selected, (jmethodID)NULL, method);
+        }
+    }
+
+    u64 total_delay = _total_delay;
+    if (total_delay > thread->delay) {
+        pause(total_delay - thread->delay);
+        thread->delay = total_delay;
+    }
+}
+
+u64 CausalProfiler::virtualTime() {
+    return OS::nanotime() - _total_delay;
+}
+
+void CausalProfiler::dump(std::ostream& out, FrameName& fn, int max_methods) {
+    char buf[1024];
+    char throughput[32];
+    char latency[32];
+
+    SpeedupStats baseline = {0};
+    std::map<jmethodID, MethodImpact> methods;
+    for (int i = 0; i < _experiment_count; i++) {
+        const Experiment& e = _experiments[i];
+        if (e.delay >= e.duration) {
+            continue;
+        }
+
+        if (e.speedup == 0) {
+            // No delays are inserted, so the selected method does not matter
+            baseline.add(e);
+        } else {
+            MethodImpact& m = methods[e.method];
+            m.method = e.method;
+            m.levels[e.speedup / SPEEDUP_STEP].add(e);
+        }
+    }
+
+    out << "--- Causal profile ---" << std::endl;
+    snprintf(buf, sizeof(buf), "Experiments         : %d (%d baseline)\n", _experiment_count, baseline.experiments);
+    out << buf;
+
+    if (baseline.progress == 0) {
+        out << "No progress points were reached during baseline experiments" << std::endl << std::endl;
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "Baseline throughput : %.2f/s\n", baseline.throughput());
+    out << buf;
+    if (baseline.transactions > 0) {
+        snprintf(buf, sizeof(buf), "Baseline latency    : %.3f ms\n", baseline.averageLatency() / 1e6);
+        out << buf;
+    }
+
+    // Impact is the slope of the predicted throughput gain over the local speedup
+    std::vector<MethodImpact*> sorted;
+    for (std::map<jmethodID, MethodImpact>::iterator it = methods.begin(); it != methods.end(); ++it) {
+        MethodImpact& m = it->second;
+        double sxy = 0, sxx = 0;
+        for (int level = 1; level < SPEEDUP_LEVELS; level++) {
+            const SpeedupStats& s = m.levels[level];
+            if (s.experiments == 0) continue;
+            double x = level * SPEEDUP_STEP / 100.0;
+            double y = s.throughput() / baseline.throughput() - 1;
+            sxy += s.experiments * x * y;
+            sxx += s.experiments * x * x;
+        }
+        m.impact = sxx == 0 ? 0 : sxy / sxx;
+        sorted.push_back(&m);
+    }
+    if (!sorted.empty()) {
+        qsort(&sorted[0], sorted.size(), sizeof(MethodImpact*), MethodImpact::comparator);
+    }
+
+    size_t count = max_methods < (int)sorted.size() ? max_methods : sorted.size();
+    for (size_t i = 0; i < count; i++) {
+        MethodImpact* m = sorted[i];
+        ASGCT_CallFrame frame = {0, m->method};
+        snprintf(buf, sizeof(buf), "\n%s: impact %.3f\n", fn.name(frame), m->impact);
+        out << buf;
+        snprintf(buf, sizeof(buf), "%10s  %11s  %10s  %10s  %10s\n", "speedup", "experiments", "progress", "throughput", "latency");
+        out << buf;
+
+        for (int level = 1; level < SPEEDUP_LEVELS; level++) {
+            const SpeedupStats& s = m->levels[level];
+            if (s.experiments == 0) continue;
+            formatChange(throughput, sizeof(throughput), s.throughput(), baseline.throughput(), true);
+            formatChange(latency, sizeof(latency), s.averageLatency(), baseline.averageLatency(),
+                         s.transactions > 0 && baseline.transactions > 0);
+            snprintf(buf, sizeof(buf), "%9d%%  %11d  %10lld  %10s  %10s\n",
+                     level * SPEEDUP_STEP, s.experiments, s.progress, throughput, latency);
+            out << buf;
+        }
+    }
+    out << std::endl;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CAUSAL_H
+#define _CAUSAL_H
+
+#include <iostream>
+#include <jvmti.h>
+#include <pthread.h>
+#include "arch.h"
+#include "arguments.h"
+#include "mutex.h"
+
+
+const int MAX_EXPERIMENTS = 8192;
+const int MAX_CAUSAL_THREADS = 16384;
+const int MAX_CAUSAL_THREAD_PROBE = 16;
+
+// Virtual speedups go from 5% to 100% in 5% steps; 0% experiments measure the baseline
+const int SPEEDUP_STEP = 5;
+const int SPEEDUP_LEVELS = 100 / SPEEDUP_STEP + 1;
+
+// Experiments that see fewer progress points are too short to measure anything:
+// the following experiments run twice as long, up to the limit
+const u64 MIN_EXPERIMENT_PROGRESS = 5;
+const u64 MAX_EXPERIMENT_TIME = 10000;  // ms
+// Pause between experiments, so that threads pay delays owed to the previous one
+const u64 EXPERIMENT_COOLDOWN = 10;  // ms
+
+
+struct Experiment {
+    jmethodID method;
+    int speedup;         // percent
+    u64 duration;        // wall time, ns
+    u64 delay;           // time all threads other than the ones running the method were paused, ns
+    u64 progress;
+    u64 latency;         // total virtual time of finished transactions, ns
+    u64 transactions;
+};
+
+// Per-thread part of the delay accounting: how much of the global delay the thread has already paid
+struct CausalThread {
+    volatile int tid;
+    volatile u32 epoch;
+    u64 delay;
+};
+
+
+class FrameName;
+
+// Coz-style causal profiling. Every experiment picks the method on top of the next sampled Java stack
+// and a virtual speedup. Whenever a sample lands in the chosen method, all other threads are delayed
+// by the corresponding fraction of the sampling interval; they pay the delay in their own signal handlers.
+// Throughput of progress points and latency of transactions measured in virtual time (minus inserted delays)
+// then predict the effect of actually making the method faster.
+class CausalProfiler {
+  private:
+    long _interval;
+    u64 _experiment_time;
+    volatile bool _running;
+    pthread_t _thread;
+    WaitableMutex _lock;
+
+    volatile u32 _epoch;
+    volatile bool _selecting;
+    volatile jmethodID _selected;
+    volatile u64 _delay;        // per sample in the selected method, ns
+    volatile u64 _total_delay;  // inserted since the profiler was loaded, ns
+    volatile u64 _epoch_delay;  // _total_delay when the current experiment began, ns
+
+    volatile u64 _progress;
+    volatile u64 _latency;
+    volatile u64 _transactions;
+
+    Experiment _experiments[MAX_EXPERIMENTS];
+    int _experiment_count;
+    CausalThread _threads[MAX_CAUSAL_THREADS];
+
+    static void* threadEntry(void* causal) {
+        ((CausalProfiler*)causal)->experimentLoop();
+        return NULL;
+    }
+
+    void experimentLoop();
+    bool runExperiment(int speedup, Experiment* e);
+    CausalThread* findThread(int tid);
+
+  public:
+    CausalProfiler() : _running(false), _epoch(0), _selecting(false), _selected(NULL), _delay(0), _total_delay(0),
+                       _epoch_delay(0), _progress(0), _latency(0), _transactions(0), _experiment_count(0) {
+    }
+
+    void clear() {
+        _experiment_count = 0;
+    }
+
+    int experiments() {
+        return _experiment_count;
+    }
+
+    Error start(Arguments& args, long interval);
+    void stop();
+
+    // Called from signal handlers with the method on top of the Java stack, if any
+    void sample(int tid, jmethodID method);
+
+    void progress() {
+        atomicInc(_progress);
+    }
+
+    // Virtual time does not advance while threads are paused on behalf of the selected method
+    u64 virtualTime();
+
+    void endTransaction(u64 start_time) {
+        u64 end_time = virtualTime();
+        if (end_time > start_time) {
+            atomicInc(_latency, end_time - start_time);
+            atomicInc(_transactions);
+        }
+    }
+
+    void dump(std::ostream& out, FrameName& fn, int max_methods);
+
+    size_t memoryUsage() {
+        return sizeof(_experiments) + sizeof(_threads);
+    }
+};
+
+#endif // _CAUSAL_H
@@ -36,7 +36,7 @@ void CodeCache::expand() {
     delete[] old_blobs;
 }
 
-void CodeCache::add(const void* start, int length, jmethodID method, bool update_bounds) {
+void CodeCache::add(const void* start, int length, jmethodID method, bool update_bounds, int level) {
     if (_count >= _capacity) {
         expand();
     }
@@ -45,6 +45,7 @@ void CodeCache::add(const void* start, int length, jmethodID method, bool update
     _blobs[_count]._start = start;
     _blobs[_count]._end = end;
     _blobs[_count]._method = method;
+    _blobs[_count]._level = level;
     _count++;
 
     if (update_bounds) {
@@ -53,22 +54,105 @@ void CodeCache::add(const void* start, int length, jmethodID method, bool update
     }
 }
 
-void CodeCache::remove(const void* start, jmethodID method) {
+// Returns the size of the removed blob, or 0 if there was none
+int CodeCache::remove(const void* start, jmethodID method) {
     for (int i = 0; i < _count; i++) {
         if (_blobs[i]._start == start && _blobs[i]._method == method) {
             _blobs[i]._method = NULL;
-            return;
+            return (const char*)_blobs[i]._end - (const char*)_blobs[i]._start;
         }
     }
+    return 0;
 }
 
 jmethodID CodeCache::find(const void* address) {
+    int level;
+    return find(address, &level);
+}
+
+jmethodID CodeCache::find(const void* address, int* level) {
     for (int i = 0; i < _count; i++) {
         CodeBlob* cb = _blobs + i;
         if (address >= cb->_start && address < cb->_end && cb->_method != NULL) {
-            return _blobs[i]._method;
+            *level = cb->_level;
+            return cb->_method;
+        }
+    }
+    return NULL;
+}
+
+u64 CodeCache::usedSize() {
+    u64 size = 0;
+    for (int i = 0; i < _count; i++) {
+        if (_blobs[i]._method != NULL) {
+            size += (const char*)_blobs[i]._end - (const char*)_blobs[i]._start;
+        }
+    }
+    return size;
+}
+
+
+// Index of the first blob that starts at or above the given address
+int JavaCodeCache::lowerBound(const void* address) {
+    int low = 0;
+    int high = _count;
+    while (low < high) {
+        int mid = (unsigned int)(low + high) >> 1;
+        if (_blobs[mid]._start < address) {
+            low = mid + 1;
+        } else {
+            high = mid;
         }
     }
+    return low;
+}
+
+void JavaCodeCache::add(const void* start, int length, jmethodID method, int level) {
+    if (_count >= _capacity) {
+        expand();
+    }
+
+    const void* end = (const char*)start + length;
+    int index = lowerBound(start);
+
+    // Blobs still covering this range belong to methods whose unload event was missed
+    int first = index > 0 && _blobs[index - 1]._end > start ? index - 1 : index;
+    int last = index;
+    while (last < _count && _blobs[last]._start < end) {
+        last++;
+    }
+    if (last - first != 1) {
+        memmove(_blobs + first + 1, _blobs + last, (_count - last) * sizeof(CodeBlob));
+        _count += 1 - (last - first);
+    }
+
+    _blobs[first]._start = start;
+    _blobs[first]._end = end;
+    _blobs[first]._method = method;
+    _blobs[first]._level = level;
+
+    if (start < _min_address) _min_address = start;
+    if (end > _max_address) _max_address = end;
+}
+
+int JavaCodeCache::remove(const void* start, jmethodID method) {
+    int index = lowerBound(start);
+    if (index < _count && _blobs[index]._start == start && _blobs[index]._method == method) {
+        int length = (const char*)_blobs[index]._end - (const char*)_blobs[index]._start;
+        memmove(_blobs + index, _blobs + index + 1, (_count - index - 1) * sizeof(CodeBlob));
+        _count--;
+        return length;
+    }
+    return 0;
+}
+
+jmethodID JavaCodeCache::find(const void* address, int* level) {
+    // The last blob starting at or below the address is the only one that may contain it
+    int index = lowerBound((const char*)address + 1) - 1;
+    if (index >= 0 && address < _blobs[index]._end) {
+        *level = _blobs[index]._level;
+        return _blobs[index]._method;
+    }
     return NULL;
 }
 
@@ -18,6 +18,7 @@
 #define _CODECACHE_H
 
 #include <jvmti.h>
+#include "arch.h"
 
 
 #define NO_MIN_ADDRESS  ((const void*)-1)
@@ -31,6 +32,7 @@ class CodeBlob {
     const void* _start;
     const void* _end;
     jmethodID _method;
+    int _level;
 
     static int comparator(const void* c1, const void* c2) {
         CodeBlob* cb1 = (CodeBlob*)c1;
@@ -75,9 +77,29 @@ class CodeCache {
         return address >= _min_address && address < _max_address;
     }
 
-    void add(const void* start, int length, jmethodID method, bool update_bounds = false);
-    void remove(const void* start, jmethodID method);
+    void add(const void* start, int length, jmethodID method, bool update_bounds = false, int level = 0);
+    int remove(const void* start, jmethodID method);
     jmethodID find(const void* address);
+    jmethodID find(const void* address, int* level);
+    u64 usedSize();
+};
+
+
+// Compiled methods are looked up by PC on every sample, so the blobs are kept sorted by address.
+// Unloaded methods are deleted right away: live nmethods never overlap, which makes binary search exact
+class JavaCodeCache : public CodeCache {
+  private:
+    int lowerBound(const void* address);
+
+  public:
+    void add(const void* start, int length, jmethodID method, int level);
+    int remove(const void* start, jmethodID method);
+    jmethodID find(const void* address, int* level);
+
+    jmethodID find(const void* address) {
+        int level;
+        return find(address, &level);
+    }
 };
 
 
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <jvmticmlr.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiledMethods.h"
+
+
+static const jvmtiCompiledMethodLoadInlineRecord* findInlineRecord(const void* compile_info) {
+    const jvmtiCompiledMethodLoadRecordHeader* header = (const jvmtiCompiledMethodLoadRecordHeader*)compile_info;
+    for (; header != NULL; header = header->next) {
+        if (header->kind == JVMTI_CMLR_INLINE_INFO) {
+            return (const jvmtiCompiledMethodLoadInlineRecord*)header;
+        }
+    }
+    return NULL;
+}
+
+static int comparePcInfo(const void* p1, const void* p2) {
+    const PCStackInfo* info1 = *(const PCStackInfo**)p1;
+    const PCStackInfo* info2 = *(const PCStackInfo**)p2;
+    return info1->pc < info2->pc ? -1 : info1->pc > info2->pc ? 1 : 0;
+}
+
+CompiledMethod* CompiledMethod::create(jmethodID method, const void* start, int length, int level,
+                                       int frame_size, int frame_complete, const void* compile_info) {
+    const jvmtiCompiledMethodLoadInlineRecord* record = findInlineRecord(compile_info);
+    int pc_count = record != NULL ? record->numpcs : 0;
+
+    // Order by PC and drop duplicates and PCs without frames
+    const PCStackInfo** pc_info = (const PCStackInfo**)malloc((pc_count + 1) * sizeof(PCStackInfo*));
+    if (pc_info == NULL) {
+        return NULL;
+    }
+
+    int unique = 0;
+    int scope_count = 0;
+    for (int i = 0; i < pc_count; i++) {
+        if (record->pcinfo[i].numstackframes > 0) {
+            pc_info[unique++] = &record->pcinfo[i];
+        }
+    }
+    qsort(pc_info, unique, sizeof(PCStackInfo*), comparePcInfo);
+
+    pc_count = 0;
+    for (int i = 0; i < unique; i++) {
+        if (pc_count == 0 || pc_info[i]->pc != pc_info[pc_count - 1]->pc) {
+            pc_info[pc_count++] = pc_info[i];
+            scope_count += pc_info[i]->numstackframes;
+        }
+    }
+
+    size_t size = sizeof(CompiledMethod)
+                + pc_count * sizeof(const void*)
+                + (pc_count + 1) * sizeof(int)
+                + scope_count * sizeof(ASGCT_CallFrame);
+
+    CompiledMethod* cm = (CompiledMethod*)malloc(size + sizeof(ASGCT_CallFrame));
+    if (cm == NULL) {
+        free(pc_info);
+        return NULL;
+    }
+
+    cm->_start = start;
+    cm->_end = (const char*)start + length;
+    cm->_method = method;
+    cm->_level = level;
+    cm->_frame_size = frame_size;
+    cm->_frame_complete = frame_complete;
+    cm->_pc_count = pc_count;
+
+    // Frames go first in the block to keep them aligned
+    cm->_scopes = (ASGCT_CallFrame*)(((uintptr_t)(cm + 1) + sizeof(ASGCT_CallFrame) - 1) & ~(sizeof(ASGCT_CallFrame) - 1));
+    cm->_pcs = (const void**)(cm->_scopes + scope_count);
+    cm->_scope_start = (int*)(cm->_pcs + pc_count);
+
+    int scope = 0;
+    for (int i = 0; i < pc_count; i++) {
+        cm->_pcs[i] = pc_info[i]->pc;
+        cm->_scope_start[i] = scope;
+        for (int j = 0; j < pc_info[i]->numstackframes; j++) {
+            cm->_scopes[scope].method_id = pc_info[i]->methods[j];
+            cm->_scopes[scope].bci = pc_info[i]->bcis[j];
+            scope++;
+        }
+    }
+    cm->_scope_start[pc_count] = scope;
+
+    free(pc_info);
+    return cm;
+}
+
+int CompiledMethod::expand(const void* pc, bool exact, ASGCT_CallFrame* frames, int max_depth) {
+    // First recorded PC that is not below pc
+    int low = 0;
+    int high = _pc_count;
+    while (low < high) {
+        int mid = (unsigned int)(low + high) >> 1;
+        if (_pcs[mid] < pc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == _pc_count || (exact && _pcs[low] != pc)) {
+        return -1;
+    }
+
+    int depth = 0;
+    for (int i = _scope_start[low]; i < _scope_start[low + 1] && depth < max_depth; i++) {
+        frames[depth++] = _scopes[i];
+    }
+    return depth;
+}
+
+size_t CompiledMethod::size() {
+    return sizeof(CompiledMethod) + _pc_count * (sizeof(const void*) + sizeof(int)) +
+           _scope_start[_pc_count] * sizeof(ASGCT_CallFrame);
+}
+
+
+void CompiledMethodMap::add(CompiledMethod* cm) {
+    std::map<const void*, CompiledMethod*>::iterator it = _methods.find(cm->_start);
+    if (it != _methods.end()) {
+        _memory -= it->second->size();
+        free(it->second);
+        it->second = cm;
+    } else {
+        _methods[cm->_start] = cm;
+    }
+    _memory += cm->size();
+}
+
+void CompiledMethodMap::remove(const void* start) {
+    std::map<const void*, CompiledMethod*>::iterator it = _methods.find(start);
+    if (it != _methods.end()) {
+        _memory -= it->second->size();
+        free(it->second);
+        _methods.erase(it);
+    }
+}
+
+void CompiledMethodMap::clear() {
+    for (std::map<const void*, CompiledMethod*>::iterator it = _methods.begin(); it != _methods.end(); ++it) {
+        free(it->second);
+    }
+    _methods.clear();
+    _memory = 0;
+}
+
+CompiledMethod* CompiledMethodMap::find(const void* pc) {
+    std::map<const void*, CompiledMethod*>::iterator it = _methods.upper_bound(pc);
+    if (it == _methods.begin()) {
+        return NULL;
+    }
+
+    CompiledMethod* cm = (--it)->second;
+    return pc < cm->_end ? cm : NULL;
+}
+
+
+// Marks a removed entry, so that probing goes on past it
+static const void* const REMOVED_KEY = (const void*)1;
+
+void MethodIdMap::add(jmethodID method) {
+    const void* key = *(const void**)method;
+    if (key == NULL) {
+        return;
+    }
+
+    u32 bucket = hash(key);
+    u32 i = bucket;
+    while (_keys[i] != key) {
+        const void* old_key = _keys[i];
+        if (old_key == NULL || old_key == REMOVED_KEY) {
+            // Until the value is written, readers treat the key as missing; free slots hold no value
+            if (__sync_bool_compare_and_swap(&_keys[i], old_key, key)) {
+                _values[i] = method;
+                return;
+            }
+            continue;
+        }
+
+        i = (i + 1) & (MAX_METHOD_IDS - 1);
+        if (i == bucket) return;  // the map is full
+    }
+}
+
+void MethodIdMap::remove(jmethodID method) {
+    const void* key = *(const void**)method;
+    if (key == NULL) {
+        return;
+    }
+
+    u32 bucket = hash(key);
+    u32 i = bucket;
+    do {
+        const void* k = _keys[i];
+        if (k == key) {
+            _values[i] = NULL;
+            __sync_bool_compare_and_swap(&_keys[i], key, REMOVED_KEY);
+        } else if (k == NULL) {
+            return;
+        }
+        i = (i + 1) & (MAX_METHOD_IDS - 1);
+    } while (i != bucket);
+}
+
+void MethodIdMap::clear() {
+    memset((void*)_keys, 0, sizeof(_keys));
+    memset((void*)_values, 0, sizeof(_values));
+}
+
+jmethodID MethodIdMap::find(const void* vm_method) {
+    if (vm_method == NULL || vm_method == REMOVED_KEY) {
+        return NULL;
+    }
+
+    u32 bucket = hash(vm_method);
+    u32 i = bucket;
+    while (_keys[i] != vm_method) {
+        if (_keys[i] == NULL) {
+            return NULL;
+        }
+
+        i = (i + 1) & (MAX_METHOD_IDS - 1);
+        if (i == bucket) return NULL;
+    }
+
+    // jmethodID slots are never freed, but they are cleared or reassigned when classes are unloaded
+    jmethodID method = _values[i];
+    return method != NULL && *(const void* volatile*)method == vm_method ? method : NULL;
+}
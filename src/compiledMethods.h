@@ -0,0 +1,105 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _COMPILEDMETHODS_H
+#define _COMPILEDMETHODS_H
+
+#include <map>
+#include <stddef.h>
+#include "arch.h"
+#include "vmEntry.h"
+
+
+const int MAX_METHOD_IDS = 1 << 16;
+
+
+// A compiled method as reported by CompiledMethodLoad, with enough information
+// to unwind its frame and to expand inlined methods at recorded PCs:
+// for every PC there is a chain of (method, bci) pairs, innermost first.
+// Allocated as a single block; destroyed with free().
+class CompiledMethod {
+  public:
+    const void* _start;
+    const void* _end;
+    jmethodID _method;
+    int _level;
+    int _frame_size;      // in words, 0 if unknown
+    int _frame_complete;  // offset from _start where the frame is fully set up
+    int _pc_count;
+    const void** _pcs;    // sorted
+    int* _scope_start;    // _pc_count + 1 indices into _scopes
+    ASGCT_CallFrame* _scopes;
+
+    static CompiledMethod* create(jmethodID method, const void* start, int length, int level,
+                                  int frame_size, int frame_complete, const void* compile_info);
+
+    bool frameComplete(const void* pc) {
+        return _frame_complete >= 0 && pc >= (const char*)_start + _frame_complete;
+    }
+
+    // Fills the frames recorded for pc: the exact PC for return addresses,
+    // or the nearest following PC for the top frame. Returns -1 if there is no such PC.
+    int expand(const void* pc, bool exact, ASGCT_CallFrame* frames, int max_depth);
+
+    size_t size();
+};
+
+
+// Compiled methods by code address. Updated under the JIT lock, read under the shared lock.
+class CompiledMethodMap {
+  private:
+    std::map<const void*, CompiledMethod*> _methods;
+    size_t _memory;
+
+  public:
+    CompiledMethodMap() : _methods(), _memory(0) {
+    }
+
+    void add(CompiledMethod* cm);
+    void remove(const void* start);
+    void clear();
+    CompiledMethod* find(const void* pc);
+
+    size_t memoryUsage() {
+        return _memory;
+    }
+};
+
+
+// Reverse mapping from HotSpot Method* to jmethodID, which in HotSpot is a pointer
+// to a Method* slot. Filled from jmethodIDs the profiler already knows,
+// so interpreted frames can be resolved without reading VM metadata. Lock-free.
+// A Method* may be reused after its class is unloaded, so a found jmethodID counts
+// only while its slot still points to the key. Entries of unloaded code are dropped,
+// and the whole map is cleared when the VM stack walker is turned off.
+class MethodIdMap {
+  private:
+    const void* volatile _keys[MAX_METHOD_IDS];
+    volatile jmethodID _values[MAX_METHOD_IDS];
+
+    static u32 hash(const void* key) {
+        u64 h = (u64)(uintptr_t)key * 0xc6a4a7935bd1e995ULL;
+        return (u32)(h ^ h >> 47) & (MAX_METHOD_IDS - 1);
+    }
+
+  public:
+    void add(jmethodID method);
+    void remove(jmethodID method);
+    void clear();
+    jmethodID find(const void* vm_method);
+};
+
+#endif // _COMPILEDMETHODS_H
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "concurrency.h"
+
+
+static int compareSamples(const void* s1, const void* s2) {
+    u64 a = *(const u64*)s1;
+    u64 b = *(const u64*)s2;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+void ConcurrencyLog::clear() {
+    _size = 0;
+    _tick = 0;
+    _overflow = false;
+}
+
+void ConcurrencyLog::sorted(u64* samples) {
+    int count = size();
+    memcpy(samples, _samples, count * sizeof(u64));
+    // Entries come in nearly tick order; a handler may be delayed between reading the tick and logging
+    qsort(samples, count, sizeof(u64), compareSamples);
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CONCURRENCY_H
+#define _CONCURRENCY_H
+
+#include <stddef.h>
+#include "arch.h"
+
+
+const int MAX_CONCURRENCY_SAMPLES = 1 << 20;
+
+// Histogram buckets by the number of threads in a frame: 1, 2, 3-4, 5-8, 9-16, 17+
+const int CONCURRENCY_BUCKETS = 6;
+
+
+// In concurrency mode, the wall clock timer signals all threads at once on every tick.
+// Each running thread logs its call trace together with the tick the signal was sent at,
+// so that the dump can tell how many threads were inside every frame at the same moment.
+class ConcurrencyLog {
+  private:
+    bool _enabled;
+    u64* _samples;
+    volatile int _size;
+    volatile u32 _tick;
+    bool _overflow;
+
+  public:
+    ConcurrencyLog() : _enabled(false), _samples(NULL), _size(0), _tick(0), _overflow(false) {
+    }
+
+    bool enabled() {
+        return _enabled;
+    }
+
+    // The log lives in the profiler arena; logged samples survive until clear()
+    void init(u64* buffer, bool enabled) {
+        _samples = buffer;
+        _enabled = enabled && buffer != NULL;
+    }
+
+    void clear();
+
+    // Called by the timer thread before every burst of signals
+    void nextTick() {
+        _tick++;
+    }
+
+    u32 tick() {
+        return _tick;
+    }
+
+    void record(int call_trace_id, u32 tick) {
+        if (_size >= MAX_CONCURRENCY_SAMPLES) {
+            _overflow = true;
+            return;
+        }
+
+        int index = atomicInc(_size);
+        if (index < MAX_CONCURRENCY_SAMPLES) {
+            _samples[index] = (u64)tick << 32 | (u32)call_trace_id;
+        } else {
+            _overflow = true;
+        }
+    }
+
+    int size() {
+        return _size < MAX_CONCURRENCY_SAMPLES ? _size : MAX_CONCURRENCY_SAMPLES;
+    }
+
+    bool overflow() {
+        return _overflow;
+    }
+
+    // Copies samples ordered by tick
+    void sorted(u64* samples);
+
+    static size_t bufferSize() {
+        return MAX_CONCURRENCY_SAMPLES * sizeof(u64);
+    }
+};
+
+
+class ConcurrencyStats {
+  public:
+    u64 _samples;  // samples of threads having the frame on stack
+    u64 _ticks;    // ticks when at least one thread had the frame on stack
+    int _max;
+    u64 _histogram[CONCURRENCY_BUCKETS];
+
+    void add(int threads) {
+        int bucket = threads <= 1 ? 0 : 32 - __builtin_clz(threads - 1);
+        _histogram[bucket < CONCURRENCY_BUCKETS ? bucket : CONCURRENCY_BUCKETS - 1]++;
+        _samples += threads;
+        _ticks++;
+        if (threads > _max) _max = threads;
+    }
+
+    double average() const {
+        return _ticks == 0 ? 0 : (double)_samples / _ticks;
+    }
+
+    // Ticks spent in the frame, discounted by the number of threads sharing it:
+    // high for frames that take long and run on few threads at a time
+    double serialTime() const {
+        return _samples == 0 ? 0 : (double)_ticks * _ticks / _samples;
+    }
+
+    static int comparator(const void* s1, const void* s2) {
+        u64 a = (*(const ConcurrencyStats**)s1)->_samples;
+        u64 b = (*(const ConcurrencyStats**)s2)->_samples;
+        return a > b ? -1 : a < b ? 1 : 0;
+    }
+
+    static int serialComparator(const void* s1, const void* s2) {
+        double a = (*(const ConcurrencyStats**)s1)->serialTime();
+        double b = (*(const ConcurrencyStats**)s2)->serialTime();
+        return a > b ? -1 : a < b ? 1 : 0;
+    }
+};
+
+#endif // _CONCURRENCY_H
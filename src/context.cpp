@@ -0,0 +1,100 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "context.h"
+
+
+static const size_t PAGE_SIZE_BYTES = CONTEXT_PAGE_CAPACITY * sizeof(ContextSlot);
+
+#define compilerBarrier()  asm volatile("" : : : "memory")
+
+
+ContextStorage::ContextStorage() {
+    memset(_pages, 0, sizeof(_pages));
+}
+
+ContextStorage::~ContextStorage() {
+    for (int i = 0; i < MAX_CONTEXT_PAGES; i++) {
+        if (_pages[i] != NULL) {
+            munmap(_pages[i], PAGE_SIZE_BYTES);
+        }
+    }
+}
+
+size_t ContextStorage::memoryUsage() {
+    size_t usage = 0;
+    for (int i = 0; i < MAX_CONTEXT_PAGES; i++) {
+        if (_pages[i] != NULL) {
+            usage += Arena::residentSize(_pages[i], PAGE_SIZE_BYTES);
+        }
+    }
+    return usage;
+}
+
+ContextSlot* ContextStorage::slot(int thread_id) {
+    ContextSlot* p = page(thread_id);
+    if (p == NULL) {
+        // Memory is committed lazily, only for pages of threads that actually set a context
+        p = (ContextSlot*)mmap(NULL, PAGE_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+        ContextSlot* oldp = __sync_val_compare_and_swap(&_pages[(u32)thread_id / CONTEXT_PAGE_CAPACITY], NULL, p);
+        if (oldp != NULL) {
+            munmap(p, PAGE_SIZE_BYTES);
+            p = oldp;
+        }
+    }
+    return &p[(u32)thread_id % CONTEXT_PAGE_CAPACITY];
+}
+
+void ContextStorage::set(ContextSlot* slot, u64 span_id, u64 tag) {
+    slot->version++;
+    compilerBarrier();
+    slot->span_id = span_id;
+    slot->tag = tag;
+    compilerBarrier();
+    slot->version++;
+}
+
+void ContextStorage::set(int thread_id, u64 span_id, u64 tag) {
+    if (page(thread_id) == NULL && span_id == 0 && tag == 0) {
+        return;
+    }
+
+    ContextSlot* s = slot(thread_id);
+    if (s != NULL) {
+        set(s, span_id, tag);
+    }
+}
+
+bool ContextStorage::get(int thread_id, Context* context) {
+    ContextSlot* p = page(thread_id);
+    if (p == NULL) {
+        return false;
+    }
+
+    ContextSlot* slot = &p[(u32)thread_id % CONTEXT_PAGE_CAPACITY];
+    u64 version = slot->version;
+    compilerBarrier();
+    context->span_id = slot->span_id;
+    context->tag = slot->tag;
+    compilerBarrier();
+    return (version & 1) == 0 && slot->version == version && (context->span_id | context->tag) != 0;
+}
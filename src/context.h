@@ -0,0 +1,68 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CONTEXT_H
+#define _CONTEXT_H
+
+#include <stddef.h>
+#include "arch.h"
+
+
+// Number of context slots in one lazily allocated page
+const u32 CONTEXT_PAGE_CAPACITY = 1 << 18;
+// Total number of pages required to hold the entire range of thread IDs
+const u32 MAX_CONTEXT_PAGES = (1U << 31) / CONTEXT_PAGE_CAPACITY;
+
+
+struct Context {
+    u64 span_id;
+    u64 tag;
+};
+
+struct ContextSlot {
+    volatile u64 version;  // odd while the owner thread updates the slot
+    volatile u64 span_id;
+    volatile u64 tag;
+};
+
+
+// Request context that the application assigns to its threads, indexed by OS thread ID.
+// A slot is written only by its own thread and read by signal handlers on the same thread,
+// so a reader that interrupts an update just treats the context as unknown.
+class ContextStorage {
+  private:
+    ContextSlot* _pages[MAX_CONTEXT_PAGES];
+
+    ContextSlot* page(int thread_id) {
+        return _pages[(u32)thread_id / CONTEXT_PAGE_CAPACITY];
+    }
+
+  public:
+    ContextStorage();
+    ~ContextStorage();
+
+    // Slot of the thread, committing its page if needed; NULL if memory is not available.
+    // The slot stays at the same address while the agent is loaded, so the thread may keep it
+    ContextSlot* slot(int thread_id);
+
+    static void set(ContextSlot* slot, u64 span_id, u64 tag);
+    void set(int thread_id, u64 span_id, u64 tag);
+    bool get(int thread_id, Context* context);
+
+    size_t memoryUsage();
+};
+
+#endif // _CONTEXT_H
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "controlServer.h"
+#include "profiler.h"
+#include "vmEntry.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+int ControlServer::_listen_fd = -1;
+int ControlServer::_wakeup_fd = -1;
+char ControlServer::_socket_path[108] = {0};
+
+
+// Buffered output to the client socket.
+// If the client goes away, the rest of the output is discarded.
+class SocketOutput : public std::streambuf {
+  private:
+    int _fd;
+    bool _failed;
+    char _buf[16384];
+
+    bool flushBuffer() {
+        const char* p = pbase();
+        const char* end = pptr();
+        while (p < end && !_failed) {
+            ssize_t bytes = send(_fd, p, end - p, MSG_NOSIGNAL);
+            if (bytes > 0) {
+                p += bytes;
+            } else if (bytes < 0 && errno == EINTR) {
+                continue;
+            } else {
+                _failed = true;
+            }
+        }
+        setp(_buf, _buf + sizeof(_buf));
+        return !_failed;
+    }
+
+  protected:
+    int_type overflow(int_type c) {
+        if (!flushBuffer()) {
+            return traits_type::eof();
+        }
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() {
+        return flushBuffer() ? 0 : -1;
+    }
+
+  public:
+    SocketOutput(int fd) : _fd(fd), _failed(false) {
+        setp(_buf, _buf + sizeof(_buf));
+    }
+};
+
+
+Error ControlServer::start(const char* address) {
+    if (_listen_fd != -1) {
+        return Error("Control server is already running");
+    }
+
+    // stop() closes the write end of the pipe to wake up the server thread
+    int wakeup_pipe[2];
+    if (pipe(wakeup_pipe) != 0) {
+        return Error("Unable to create control server pipe");
+    }
+
+    int fd = bindUnixSocket(address);
+    if (fd == -1) {
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+        return Error("Failed to bind control server socket");
+    }
+
+    // The server thread owns the socket and the read end of the pipe, and closes them when stopped
+    int* fds = new int[2];
+    fds[0] = fd;
+    fds[1] = wakeup_pipe[0];
+    _listen_fd = fd;
+    _wakeup_fd = wakeup_pipe[1];
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, threadEntry, fds) != 0) {
+        delete[] fds;
+        _listen_fd = -1;
+        _wakeup_fd = -1;
+        close(fd);
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+        unlink(_socket_path);
+        _socket_path[0] = 0;
+        return Error("Unable to create control server thread");
+    }
+    pthread_detach(thread);
+    return Error::OK;
+}
+
+void ControlServer::stop() {
+    if (_listen_fd != -1) {
+        // shutdown() does not wake up a thread waiting for connections on every OS, but poll() on a pipe does
+        close(_wakeup_fd);
+        _wakeup_fd = -1;
+        unlink(_socket_path);
+        _socket_path[0] = 0;
+        _listen_fd = -1;
+    }
+}
+
+int ControlServer::bindUnixSocket(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path) || strlen(path) >= sizeof(_socket_path)) {
+        return -1;
+    }
+
+    // Commands may write files on behalf of the JVM, so the socket is accessible only to the owner.
+    // It is created in a private directory next to the final path, made owner-only there,
+    // and then linked in place. The umask is shared by all JVM threads and is left alone
+    char dir[sizeof(addr.sun_path)];
+    if ((size_t)snprintf(dir, sizeof(dir), "%s.XXXXXX", path) >= sizeof(dir) - 2 || mkdtemp(dir) == NULL) {
+        return -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/s", dir);
+
+    // Remove a socket left by a previous process, but never a regular file
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool bound = fd != -1 && bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+                 chmod(addr.sun_path, 0600) == 0 && link(addr.sun_path, path) == 0;
+    unlink(addr.sun_path);
+    rmdir(dir);
+
+    if (!bound) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    // accept() must not block when a connection goes away after poll() has reported it
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0 || listen(fd, 8) != 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    strcpy(_socket_path, path);
+    return fd;
+}
+
+void* ControlServer::threadEntry(void* fds) {
+    int listen_fd = ((int*)fds)[0];
+    int wakeup_fd = ((int*)fds)[1];
+    delete[] (int*)fds;
+
+    // Profiler commands use JNI and JVM TI, e.g. to get thread names on start
+    if (VM::attachThread("Async-profiler Server") != NULL) {
+        serve(listen_fd, wakeup_fd);
+        VM::detachThread();
+    }
+    close(listen_fd);
+    close(wakeup_fd);
+    return NULL;
+}
+
+// Socket permissions already keep other users out; the peer check also covers
+// a socket path that a privileged process has made accessible by mistake
+bool ControlServer::trustedPeer(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+void ControlServer::serve(int listen_fd, int wakeup_fd) {
+    struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wakeup_fd, POLLIN, 0}};
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;  // stopped
+        }
+
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd >= 0) {
+            // On BSD and macOS, the connection inherits O_NONBLOCK from the listening socket
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            if (trustedPeer(fd)) {
+                handle(fd);
+            }
+            close(fd);
+        } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK) {
+            break;
+        }
+    }
+}
+
+void ControlServer::handle(int fd) {
+    // Do not let a stuck client block the profiler
+    struct timeval timeout = {SERVER_TIMEOUT_SEC, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    // Read the command up to a newline or the end of stream
+    char command[MAX_COMMAND_LENGTH];
+    size_t len = 0;
+    bool complete = false;
+    while (len < sizeof(command) - 1) {
+        ssize_t bytes = recv(fd, command + len, sizeof(command) - 1 - len, 0);
+        if (bytes > 0) {
+            char* eol = (char*)memchr(command + len, '\n', bytes);
+            if (eol != NULL) {
+                len = eol - command;
+                complete = true;
+                break;
+            }
+            len += bytes;
+        } else if (bytes == 0) {
+            complete = true;
+            break;
+        } else if (errno != EINTR) {
+            return;
+        }
+    }
+
+    if (len > 0 && command[len - 1] == '\r') len--;
+    command[len] = 0;
+
+    SocketOutput buf(fd);
+    std::ostream out(&buf);
+
+    Arguments args;
+    Error error = complete ? args.parse(command) : Error("Command is too long");
+    if (!error) {
+        error = Profiler::_instance.runToStream(args, out);
+    }
+    if (!error) {
+        // A session started remotely is dumped at VM shutdown like one started by attach
+        VM::saveArgs(args);
+    }
+    if (error) {
+        out << error.message() << std::endl;
+    }
+    out.flush();
+}
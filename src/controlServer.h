@@ -0,0 +1,51 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CONTROLSERVER_H
+#define _CONTROLSERVER_H
+
+#include "arguments.h"
+
+
+const int MAX_COMMAND_LENGTH = 4096;
+const int SERVER_TIMEOUT_SEC = 10;
+
+// Accepts profiler commands on a local socket, so that an external collector
+// can control the profiler without going through the Dynamic Attach each time.
+// A client sends one command in Arguments::parse syntax terminated by a newline;
+// the server writes the command output, including a binary JFR dump, and closes the connection.
+// ADDRESS is a path of a Unix domain socket. Commands may write files as the JVM user,
+// so the socket is accessible only to its owner, and connections from other users are rejected;
+// there is no TCP transport, which any local user could reach.
+class ControlServer {
+  private:
+    static int _listen_fd;
+    static int _wakeup_fd;
+    static char _socket_path[108];
+
+    static int bindUnixSocket(const char* path);
+    static bool trustedPeer(int fd);
+
+    static void* threadEntry(void* fds);
+    static void serve(int listen_fd, int wakeup_fd);
+    static void handle(int fd);
+
+  public:
+    static Error start(const char* address);
+    static void stop();
+};
+
+#endif // _CONTROLSERVER_H
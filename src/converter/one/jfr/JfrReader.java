@@ -86,7 +86,10 @@ public class JfrReader implements Closeable {
                 int tid = buf.getInt();
                 int stackTraceId = (int) buf.getLong();
                 short threadState = buf.getShort();
-                samples.add(new Sample(time, tid, stackTraceId, threadState));
+                // Samples recorded before request contexts were added have no spanId and tag
+                long spanId = size >= 46 ? buf.getLong() : 0;
+                long tag = size >= 46 ? buf.getLong() : 0;
+                samples.add(new Sample(time, tid, stackTraceId, threadState, spanId, tag));
             } else {
                 buf.position(buf.position() + size - 8);
             }
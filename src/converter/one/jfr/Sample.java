@@ -21,12 +21,16 @@ public class Sample implements Comparable<Sample> {
     public final int tid;
     public final int stackTraceId;
     public final short threadState;
+    public final long spanId;
+    public final long tag;
 
-    public Sample(long time, int tid, int stackTraceId, short threadState) {
+    public Sample(long time, int tid, int stackTraceId, short threadState, long spanId, long tag) {
         this.time = time;
         this.tid = tid;
         this.stackTraceId = stackTraceId;
         this.threadState = threadState;
+        this.spanId = spanId;
+        this.tag = tag;
     }
 
     @Override
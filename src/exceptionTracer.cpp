@@ -0,0 +1,86 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exceptionTracer.h"
+#include "profiler.h"
+#include "vmStructs.h"
+
+
+bool ExceptionTracer::_capable = false;
+u64 ExceptionTracer::_interval;
+bool ExceptionTracer::_caught_only;
+volatile u64 ExceptionTracer::_exceptions;
+
+// Possessing the capability makes the JVM handle exceptions in compiled code more slowly,
+// even with events disabled, so it is not requested unless exception profiling is asked for.
+// HotSpot grants it only while the agent is being loaded at VM startup
+Error ExceptionTracer::addCapability() {
+    if (!_capable) {
+        jvmtiCapabilities capabilities = {0};
+        capabilities.can_generate_exception_events = 1;
+        if (VM::jvmti()->AddCapabilities(&capabilities) != 0) {
+            return Error("Exception events are available only if the agent is loaded at startup with event=exceptions");
+        }
+        _capable = true;
+    }
+    return Error::OK;
+}
+
+Error ExceptionTracer::check(Arguments& args) {
+    return addCapability();
+}
+
+Error ExceptionTracer::start(Arguments& args) {
+    Error error = check(args);
+    if (error) {
+        return error;
+    }
+
+    if (args._interval < 0) {
+        return Error("interval must be positive");
+    }
+
+    _interval = args._interval ? args._interval : 1;
+    _caught_only = args._caught_only;
+    _exceptions = 0;
+
+    VM::jvmti()->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_EXCEPTION, NULL);
+    return Error::OK;
+}
+
+void ExceptionTracer::stop() {
+    VM::jvmti()->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_EXCEPTION, NULL);
+}
+
+// Posted every time an exception is thrown, including rethrows from catch and finally blocks
+void JNICALL ExceptionTracer::ExceptionThrown(jvmtiEnv* jvmti, JNIEnv* env, jthread thread,
+                                              jmethodID method, jlocation location, jobject exception,
+                                              jmethodID catch_method, jlocation catch_location) {
+    if (_caught_only && catch_method == NULL) {
+        return;
+    }
+
+    if (_interval > 1 && ((atomicInc(_exceptions) + 1) % _interval) != 0) {
+        return;
+    }
+
+    if (VMStructs::hasClassNames()) {
+        VMSymbol* exception_name = VMKlass::fromJavaClass(env, env->GetObjectClass(exception))->name();
+        Profiler::_instance.recordSample(NULL, _interval, BCI_SYMBOL, (jmethodID)exception_name);
+    } else {
+        Profiler::_instance.recordSample(NULL, _interval, BCI_SYMBOL, NULL);
+    }
+}
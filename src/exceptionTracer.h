@@ -0,0 +1,56 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _EXCEPTIONTRACER_H
+#define _EXCEPTIONTRACER_H
+
+#include <jvmti.h>
+#include "arch.h"
+#include "engine.h"
+
+
+class ExceptionTracer : public Engine {
+  private:
+    static bool _capable;
+    static u64 _interval;
+    static bool _caught_only;
+    static volatile u64 _exceptions;
+
+  public:
+    const char* name() {
+        return "exceptions";
+    }
+
+    const char* units() {
+        return "exceptions";
+    }
+
+    CStack cstack() {
+        return CSTACK_NO;
+    }
+
+    Error check(Arguments& args);
+    Error start(Arguments& args);
+    void stop();
+
+    static Error addCapability();
+
+    static void JNICALL ExceptionThrown(jvmtiEnv* jvmti, JNIEnv* env, jthread thread,
+                                        jmethodID method, jlocation location, jobject exception,
+                                        jmethodID catch_method, jlocation catch_location);
+};
+
+#endif // _EXCEPTIONTRACER_H
@@ -421,6 +421,12 @@ static const char TREE_HEADER[] =
     ".green {\n"
     "    color: #32c832;\n"
     "}\n"
+    ".lgreen {\n"
+    "    color: #82b482;\n"
+    "}\n"
+    ".lime {\n"
+    "    color: #8cbe32;\n"
+    "}\n"
     ".aqua {\n"
     "    color: #32a5a5;\n"
     "}\n"
@@ -740,6 +746,8 @@ bool FlameGraph::printTreeFrame(std::ostream& out, const Trie& f, int depth) {
 const Palette& FlameGraph::selectFramePalette(std::string& name) {
     static const Palette
         green ("green",  0x50e150, 30, 30, 30),
+        lgreen("lgreen", 0xb2e1b2, 20, 20, 20),
+        lime  ("lime",   0xa5d750, 30, 30, 30),
         aqua  ("aqua",   0x50bebe, 30, 30, 30),
         brown ("brown",  0xe17d00, 30, 30,  0),
         yellow("yellow", 0xc8c83c, 30, 30, 10),
@@ -749,6 +757,14 @@ const Palette& FlameGraph::selectFramePalette(std::string& name) {
         // Java compiled frame
         name = name.substr(0, name.length() - 4);
         return green;
+    } else if (StringUtils::endsWith(name, "_[0]", 4)) {
+        // Java interpreted frame
+        name = name.substr(0, name.length() - 4);
+        return lgreen;
+    } else if (StringUtils::endsWith(name, "_[1]", 4)) {
+        // Java C1 compiled frame
+        name = name.substr(0, name.length() - 4);
+        return lime;
     } else if (StringUtils::endsWith(name, "_[i]", 4)) {
         // Java inlined frame
         name = name.substr(0, name.length() - 4);
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include "flightRecorder.h"
 #include "profiler.h"
+#include "snapshot.h"
 #include "threadFilter.h"
 #include "vmStructs.h"
 
@@ -34,6 +35,8 @@
 
 const int RECORDING_BUFFER_SIZE = 65536;
 const int RECORDING_LIMIT = RECORDING_BUFFER_SIZE - 4096;
+// Compilation and unload events have their own buffer after the per-stripe ones
+const int JIT_BUFFER = CONCURRENCY_LEVEL;
 
 
 enum DataType {
@@ -61,6 +64,8 @@ enum EventTypeId {
     EVENT_RECORDING          = 10,
     EVENT_RECORDING_SETTINGS = 11,
     EVENT_EXECUTION_SAMPLE   = 20,
+    EVENT_COMPILATION        = 21,
+    EVENT_CODE_UNLOAD        = 22,
 };
 
 enum ContentTypeId {
@@ -197,10 +202,25 @@ const DataStructure
         {"sampledThread", "Thread", T_U4, CONTENT_THREAD},
         {"stackTrace", "Stack Trace", T_U8, CONTENT_STACKTRACE},
         {"state", "Thread State", T_U2, CONTENT_STATE},
+        {"spanId", "Span ID", T_LONG},
+        {"contextTag", "Context Tag", T_LONG},
+    },
+    ds_compilation[] = {
+        {"method", "Java Method", T_U8, CONTENT_METHOD},
+        {"codeSize", "Compiled Code Size", T_INTEGER, CONTENT_MEMORY},
+        {"compileLevel", "Compilation Level", T_SHORT},
+        {"codeCacheUsed", "Code Cache Used", T_LONG, CONTENT_MEMORY},
+    },
+    ds_code_unload[] = {
+        {"method", "Java Method", T_U8, CONTENT_METHOD},
+        {"codeSize", "Compiled Code Size", T_INTEGER, CONTENT_MEMORY},
+        {"codeCacheUsed", "Code Cache Used", T_LONG, CONTENT_MEMORY},
     };
 
 const EventType et_profile[] = {
     {EVENT_EXECUTION_SAMPLE, "Method Profiling Sample", "Snapshot of a threads state", "vm/prof/execution_sample", false, false, false, true, /* ds_method_sample */ 10},
+    {EVENT_COMPILATION, "Compilation", "Method compiled by JIT", "vm/compiler/compilation", false, false, false, true, /* ds_compilation */ 11},
+    {EVENT_CODE_UNLOAD, "Code Unload", "Compiled method removed from code cache", "vm/code_cache/unload", false, false, false, true, /* ds_code_unload */ 12},
 };
 
 const ContentType ct_profile[] = {
@@ -303,7 +323,8 @@ class Buffer {
 
 class Recording {
   private:
-    Buffer _buf[CONCURRENCY_LEVEL];
+    Buffer* _buf;
+    bool _own_buf;
     int _fd;
     ThreadFilter _thread_set;
     std::map<std::string, int> _symbol_map;
@@ -315,7 +336,14 @@ class Recording {
     u64 _stop_nanos;
 
   public:
-    Recording(int fd) : _fd(fd), _thread_set(), _symbol_map(), _class_map(), _method_map() {
+    Recording(int fd, void* buffers) : _fd(fd), _thread_set(), _symbol_map(), _class_map(), _method_map() {
+        // Buffers normally come preallocated from the profiler arena
+        _own_buf = buffers == NULL;
+        _buf = _own_buf ? new Buffer[JIT_BUFFER + 1] : (Buffer*)buffers;
+        for (int i = 0; i <= JIT_BUFFER; i++) {
+            _buf[i].reset();
+        }
+
         _start_time = OS::millis();
         _start_nanos = OS::nanotime();
 
@@ -327,7 +355,7 @@ class Recording {
         _stop_nanos = OS::nanotime();
         _stop_time = OS::millis();
 
-        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+        for (int i = 0; i <= JIT_BUFFER; i++) {
             flush(&_buf[i]);
         }
 
@@ -353,6 +381,10 @@ class Recording {
         (void)result;
 
         close(_fd);
+
+        if (_own_buf) {
+            delete[] _buf;
+        }
     }
 
     int lookup(std::map<std::string, int>& map, std::string key) {
@@ -389,7 +421,7 @@ class Recording {
         return FRAME_NATIVE;
     }
 
-    MethodInfo* resolveMethod(ASGCT_CallFrame& frame) {
+    MethodInfo* resolveMethod(const ASGCT_CallFrame& frame) {
         jmethodID method = frame.method_id;
         MethodInfo* mi = &_method_map[method];
 
@@ -413,6 +445,21 @@ class Recording {
                 mi->_modifiers = 0x100;
                 mi->_type = FRAME_NATIVE;
 
+            } else if (Snapshot::loaded()) {
+                SnapshotMethod* m = Snapshot::findMethod(method);
+                if (m != NULL && m->_error == 0) {
+                    mi->_class = lookup(_class_map, m->_class.substr(1, m->_class.length() - 2));
+                    mi->_name = lookup(_symbol_map, m->_name);
+                    mi->_sig = lookup(_symbol_map, m->_sig);
+                    mi->_modifiers = (short)m->_modifiers;
+                } else {
+                    mi->_class = lookup(_class_map, "");
+                    mi->_name = lookup(_symbol_map, "jvmtiError");
+                    mi->_sig = lookup(_symbol_map, "()L;");
+                    mi->_modifiers = 0;
+                }
+                mi->_type = FRAME_INTERPRETED;
+
             } else {
                 jvmtiEnv* jvmti = VM::jvmti();
                 jclass method_class;
@@ -446,6 +493,20 @@ class Recording {
         return mi;
     }
 
+    FrameTypeId frameType(const ASGCT_CallFrame& frame, MethodInfo* mi) {
+        switch (decodeFrameType(frame.bci)) {
+            case FRAME_TYPE_INTERPRETED:
+                return FRAME_INTERPRETED;
+            case FRAME_TYPE_JIT_COMPILED:
+            case FRAME_TYPE_C1_COMPILED:
+                return FRAME_JIT_COMPILED;
+            case FRAME_TYPE_INLINED:
+                return FRAME_INLINED;
+            default:
+                return mi->_type;
+        }
+    }
+
     void flush(Buffer* buf) {
         ssize_t result = write(_fd, buf->data(), buf->offset());
         (void)result;
@@ -513,7 +574,7 @@ class Recording {
 
     void writeStackTraces(Buffer* buf) {
         CallTraceSample* traces = Profiler::_instance._traces;
-        ASGCT_CallFrame* frame_buffer = Profiler::_instance._frame_buffer;
+        bool add_line_numbers = Profiler::_instance._add_line_numbers;
 
         int count = 0;
         for (int i = 0; i < MAX_CALLTRACES; i++) {
@@ -529,10 +590,11 @@ class Recording {
                 buf->put8(0);   // truncated
                 buf->put32(trace._num_frames);
                 for (int j = 0; j < trace._num_frames; j++) {
-                    MethodInfo* mi = resolveMethod(frame_buffer[trace._start_frame + j]);
+                    ASGCT_CallFrame frame = Profiler::_instance.frameAt(trace._start_frame + j);
+                    MethodInfo* mi = resolveMethod(frame);
                     buf->put64(mi->_key);  // method key
-                    buf->put32(0);         // bci
-                    buf->put8(mi->_type);  // frame type
+                    buf->put32(add_line_numbers && frame.bci > 0 ? decodeBci(frame.bci) : 0);
+                    buf->put8(frameType(frame, mi));
                     flushIfNeeded(buf);
                 }
                 flushIfNeeded(buf);
@@ -582,17 +644,16 @@ class Recording {
         int* threads = new int[thread_count];
         _thread_set.collect(threads, thread_count);
 
-        MutexLocker ml(Profiler::_instance._thread_names_lock);
-        std::map<int, std::string>& thread_names = Profiler::_instance._thread_names;
+        ThreadRegistry& thread_registry = Profiler::_instance._thread_registry;
+        ThreadRecord record;
         char name_buf[32];
 
         buf->put32(CONTENT_THREAD);
         buf->put32(thread_count);
         for (int i = 0; i < thread_count; i++) {
             const char* thread_name;
-            std::map<int, std::string>::const_iterator it = thread_names.find(threads[i]);
-            if (it != thread_names.end()) {
-                thread_name = it->second.c_str();
+            if (thread_registry.get(threads[i], &record) && record._name[0] != 0) {
+                thread_name = record._name;
             } else {
                 sprintf(name_buf, "[tid=%d]", threads[i]);
                 thread_name = name_buf;
@@ -607,8 +668,15 @@ class Recording {
     }
 
     void writeJavaThreads(Buffer* buf) {
-        MutexLocker ml(Profiler::_instance._thread_names_lock);
-        std::map<jlong, int>& thread_ids = Profiler::_instance._thread_ids;
+        ThreadRegistry& thread_registry = Profiler::_instance._thread_registry;
+        ThreadRecord record;
+        std::map<jlong, int> thread_ids;
+
+        for (int i = 0; i < thread_registry.capacity(); i++) {
+            if (thread_registry.getAt(i, &record) && record._java_thread_id != 0) {
+                thread_ids[record._java_thread_id] = record._tid;
+            }
+        }
 
         buf->put32(CONTENT_JAVA_THREAD);
         buf->put32(thread_ids.size());
@@ -711,7 +779,7 @@ class Recording {
         buf->put32(0);
 
         // Data structures
-        buf->put32(11);
+        buf->put32(13);
         writeDataStructure(buf, ARRAY_SIZE(ds_utf8), ds_utf8);
         writeDataStructure(buf, ARRAY_SIZE(ds_thread), ds_thread);
         writeDataStructure(buf, ARRAY_SIZE(ds_java_thread), ds_java_thread);
@@ -723,6 +791,8 @@ class Recording {
         writeDataStructure(buf, ARRAY_SIZE(ds_frame), ds_frame);
         writeDataStructure(buf, ARRAY_SIZE(ds_stacktrace), ds_stacktrace);
         writeDataStructure(buf, ARRAY_SIZE(ds_method_sample), ds_method_sample);
+        writeDataStructure(buf, ARRAY_SIZE(ds_compilation), ds_compilation);
+        writeDataStructure(buf, ARRAY_SIZE(ds_code_unload), ds_code_unload);
 
         // Event types and content types
         writeEventTypes(buf, ARRAY_SIZE(et_profile), et_profile);
@@ -748,14 +818,50 @@ class Recording {
         buf->put32(metadata_start, buf->offset() - metadata_start);
     }
 
-    void recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state) {
+    void recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state, Context& context) {
         Buffer* buf = &_buf[lock_index];
-        buf->put32(30);
+        buf->put32(46);
         buf->put32(EVENT_EXECUTION_SAMPLE);
         buf->put64(OS::nanotime());
         buf->put32(tid);
         buf->put64(call_trace_id);
         buf->put16(thread_state);
+        buf->put64(context.span_id);
+        buf->put64(context.tag);
+        flushIfNeeded(buf);
+    }
+
+    // Called under FlightRecorder::_jit_lock, which also guards _method_map until the recording stops.
+    // Compiler threads never take a stripe lock here, so resolving methods does not block samples
+    void recordCompilation(jmethodID method, int code_size, int level, u64 code_used) {
+        ASGCT_CallFrame frame = {0, method};
+        MethodInfo* mi = resolveMethod(frame);
+
+        Buffer* buf = &_buf[JIT_BUFFER];
+        buf->put32(38);
+        buf->put32(EVENT_COMPILATION);
+        buf->put64(OS::nanotime());
+        buf->put64(mi->_key);
+        buf->put32(code_size);
+        buf->put16(level);
+        buf->put64(code_used);
+        flushIfNeeded(buf);
+    }
+
+    void recordCodeUnload(jmethodID method, int code_size, u64 code_used) {
+        // The method may belong to an unloaded class, so it is referenced only if it has been resolved before
+        std::map<jmethodID, MethodInfo>::const_iterator it = _method_map.find(method);
+        if (it == _method_map.end()) {
+            return;
+        }
+
+        Buffer* buf = &_buf[JIT_BUFFER];
+        buf->put32(36);
+        buf->put32(EVENT_CODE_UNLOAD);
+        buf->put64(OS::nanotime());
+        buf->put64(it->second._key);
+        buf->put32(code_size);
+        buf->put64(code_used);
         flushIfNeeded(buf);
     }
 
@@ -765,7 +871,11 @@ class Recording {
 };
 
 
-Error FlightRecorder::start(const char* file) {
+size_t FlightRecorder::bufferSize() {
+    return (JIT_BUFFER + 1) * sizeof(Buffer);
+}
+
+Error FlightRecorder::start(const char* file, void* buffers) {
     if (file == NULL || file[0] == 0) {
         return Error("Flight Recorder output file is not specified");
     }
@@ -775,20 +885,36 @@ Error FlightRecorder::start(const char* file) {
         return Error("Cannot open Flight Recorder output file");
     }
 
-    _rec = new Recording(fd);
+    _rec = new Recording(fd, buffers);
     return Error::OK;
 }
 
 void FlightRecorder::stop() {
-    if (_rec != NULL) {
-        delete _rec;
-        _rec = NULL;
-    }
+    _jit_lock.lock();
+    Recording* rec = _rec;
+    _rec = NULL;
+    _jit_lock.unlock();
+
+    delete rec;
 }
 
-void FlightRecorder::recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state) {
+void FlightRecorder::recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state, Context& context) {
     if (_rec != NULL && call_trace_id != 0) {
-        _rec->recordExecutionSample(lock_index, tid, call_trace_id, thread_state);
+        _rec->recordExecutionSample(lock_index, tid, call_trace_id, thread_state, context);
         _rec->addThread(tid);
     }
 }
+
+void FlightRecorder::recordCompilation(jmethodID method, int code_size, int level, u64 code_used) {
+    MutexLocker ml(_jit_lock);
+    if (_rec != NULL) {
+        _rec->recordCompilation(method, code_size, level, code_used);
+    }
+}
+
+void FlightRecorder::recordCodeUnload(jmethodID method, int code_size, u64 code_used) {
+    MutexLocker ml(_jit_lock);
+    if (_rec != NULL) {
+        _rec->recordCodeUnload(method, code_size, code_used);
+    }
+}
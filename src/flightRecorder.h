@@ -17,7 +17,10 @@
 #ifndef _FLIGHTRECORDER_H
 #define _FLIGHTRECORDER_H
 
+#include <jvmti.h>
 #include "arguments.h"
+#include "context.h"
+#include "mutex.h"
 #include "os.h"
 
 
@@ -26,15 +29,26 @@ class Recording;
 class FlightRecorder {
   private:
     Recording* _rec;
+    Mutex _jit_lock;
 
   public:
     FlightRecorder() : _rec(NULL) {
     }
 
-    Error start(const char* file);
+    // Per-stripe and JIT buffers take bufferSize() bytes; NULL allocates them on the heap
+    static size_t bufferSize();
+
+    Error start(const char* file, void* buffers);
     void stop();
 
-    void recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state);
+    bool active() {
+        return _rec != NULL;
+    }
+
+    void recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state, Context& context);
+    // Called from compiler threads; events go to a dedicated buffer flushed like the stripe buffers
+    void recordCompilation(jmethodID method, int code_size, int level, u64 code_used);
+    void recordCodeUnload(jmethodID method, int code_size, u64 code_used);
 };
 
 #endif // _FLIGHTRECORDER_H
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEDICTIONARY_H
+#define _FRAMEDICTIONARY_H
+
+#include <stdint.h>
+#include <string.h>
+#include "arch.h"
+#include "vmEntry.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+const int MAX_FRAME_DICTIONARY = 1 << 18;
+
+
+// Stored frames refer to their method_id (jmethodID, symbol or string) by a 32-bit index
+// in this dictionary, so that a frame fits in a single 64-bit word: bci with frame type bits
+// in the upper half, dictionary index in the lower half. A negative bci goes to the frame type
+// bits, so that it still tells special frames apart when bci is masked off. Thread IDs and
+// context tags are 32-bit values themselves and are kept inline, since there can be any number.
+// Lookups are lock-free and async-signal-safe. Index 0 always denotes NULL.
+class FrameDictionary {
+  private:
+    jmethodID volatile _keys[MAX_FRAME_DICTIONARY];
+    volatile int _size;
+
+    static bool isInline(jint bci) {
+        return bci == BCI_THREAD_ID || bci == BCI_CONTEXT_TAG;
+    }
+
+    static u32 hash(jmethodID key) {
+        u64 h = (u64)(uintptr_t)key * 0xc6a4a7935bd1e995ULL;
+        return (u32)((h ^ h >> 47) % (MAX_FRAME_DICTIONARY - 1)) + 1;
+    }
+
+  public:
+    void clear() {
+        memset((void*)_keys, 0, sizeof(_keys));
+        _size = 0;
+    }
+
+    int size() {
+        return _size;
+    }
+
+    jmethodID get(u32 index) {
+        return _keys[index];
+    }
+
+    // Returns the index of the key, adding it if needed, or -1 if the dictionary is full
+    int lookup(jmethodID key) {
+        if (key == NULL) {
+            return 0;
+        }
+
+        u32 bucket = hash(key);
+        u32 i = bucket;
+
+        while (_keys[i] != key) {
+            if (_keys[i] == NULL) {
+                if (__sync_bool_compare_and_swap(&_keys[i], (jmethodID)NULL, key)) {
+                    atomicInc(_size);
+                    break;
+                }
+                continue;
+            }
+
+            if (++i == MAX_FRAME_DICTIONARY) i = 1;
+            if (i == bucket) return -1;
+        }
+
+        return (int)i;
+    }
+
+    // Returns false if the frame needs a new dictionary entry, but the dictionary is full
+    bool encode(const ASGCT_CallFrame& frame, u64* word) {
+        u32 value;
+        if (isInline(frame.bci)) {
+            value = (u32)(uintptr_t)frame.method_id;
+        } else {
+            int index = lookup(frame.method_id);
+            if (index < 0) {
+                return false;
+            }
+            value = (u32)index;
+        }
+        u32 bci = frame.bci >= 0 ? (u32)frame.bci : (u32)frame.bci << FRAME_TYPE_SHIFT;
+        *word = (u64)bci << 32 | value;
+        return true;
+    }
+
+    // Tells if two arrays of frame words are equal in the bits selected by mask.
+    // Equal hashes almost always mean equal traces, so differences are accumulated
+    // over the whole array rather than checked after every vector.
+    static bool equal(const u64* a, const u64* b, int count, u64 mask) {
+        int i = 0;
+#if defined(__AVX2__)
+        __m256i m = _mm256_set1_epi64x((long long)mask);
+        __m256i diff = _mm256_setzero_si256();
+        for (; i + 4 <= count; i += 4) {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+            diff = _mm256_or_si256(diff, _mm256_and_si256(x, m));
+        }
+        if (!_mm256_testz_si256(diff, diff)) {
+            return false;
+        }
+#elif defined(__SSE2__)
+        __m128i m = _mm_set1_epi64x((long long)mask);
+        __m128i diff = _mm_setzero_si128();
+        for (; i + 2 <= count; i += 2) {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+            diff = _mm_or_si128(diff, _mm_and_si128(x, m));
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff) {
+            return false;
+        }
+#elif defined(__ARM_NEON)
+        uint64x2_t m = vdupq_n_u64(mask);
+        uint64x2_t diff = vdupq_n_u64(0);
+        for (; i + 2 <= count; i += 2) {
+            uint64x2_t x = veorq_u64(vld1q_u64((const uint64_t*)(a + i)), vld1q_u64((const uint64_t*)(b + i)));
+            diff = vorrq_u64(diff, vandq_u64(x, m));
+        }
+        if ((vgetq_lane_u64(diff, 0) | vgetq_lane_u64(diff, 1)) != 0) {
+            return false;
+        }
+#endif
+        for (; i < count; i++) {
+            if (((a[i] ^ b[i]) & mask) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ASGCT_CallFrame decode(u64 word) {
+        ASGCT_CallFrame frame;
+        jint bci = (jint)(word >> 32);
+        frame.bci = bci >= 0 ? bci : bci >> FRAME_TYPE_SHIFT;
+        frame.method_id = isInline(frame.bci) ? (jmethodID)(uintptr_t)(u32)word : _keys[(u32)word];
+        return frame;
+    }
+};
+
+#endif // _FRAMEDICTIONARY_H
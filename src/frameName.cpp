@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "frameName.h"
+#include "snapshot.h"
 #include "vmStructs.h"
 
 
@@ -74,13 +75,13 @@ bool Matcher::matches(const char* s) {
 }
 
 
-FrameName::FrameName(Arguments& args, int style, Mutex& thread_names_lock, ThreadMap& thread_names) :
+FrameName::FrameName(Arguments& args, int style, ThreadRegistry& threads) :
     _cache(),
+    _line_numbers(),
     _include(),
     _exclude(),
     _style(style),
-    _thread_names_lock(thread_names_lock),
-    _thread_names(thread_names)
+    _threads(threads)
 {
     // Require printf to use standard C format regardless of system locale
     _saved_locale = uselocale(newlocale(LC_NUMERIC_MASK, "C", (locale_t)0));
@@ -121,7 +122,28 @@ const char* FrameName::cppDemangle(const char* name) {
     return name;
 }
 
+char* FrameName::snapshotMethodName(jmethodID method) {
+    SnapshotMethod* m = Snapshot::findMethod(method);
+    if (m == NULL || m->_error != 0) {
+        snprintf(_buf, sizeof(_buf) - 1, "[jvmtiError %d]", m != NULL ? m->_error : JVMTI_ERROR_INVALID_METHODID);
+        return _buf;
+    }
+
+    char* method_sig = strdup(m->_sig.c_str());
+    char* result = javaClassName(m->_class.c_str() + 1, m->_class.length() - 2, _style);
+    strcat(result, ".");
+    strcat(result, m->_name.c_str());
+    if (_style & STYLE_SIGNATURES) strcat(result, truncate(method_sig, 255));
+    free(method_sig);
+
+    return result;
+}
+
 char* FrameName::javaMethodName(jmethodID method) {
+    if (Snapshot::loaded()) {
+        return snapshotMethodName(method);
+    }
+
     jclass method_class;
     char* class_name = NULL;
     char* method_name = NULL;
@@ -139,7 +161,6 @@ char* FrameName::javaMethodName(jmethodID method) {
         strcat(result, ".");
         strcat(result, method_name);
         if (_style & STYLE_SIGNATURES) strcat(result, truncate(method_sig, 255));
-        if (_style & STYLE_ANNOTATE) strcat(result, "_[j]");
     } else {
         snprintf(_buf, sizeof(_buf) - 1, "[jvmtiError %d]", err);
         result = _buf;
@@ -200,7 +221,38 @@ char* FrameName::javaClassName(const char* symbol, int length, int style) {
     return result;
 }
 
-const char* FrameName::name(ASGCT_CallFrame& frame, bool for_matching) {
+// Line number table is requested from JVM TI once per method and then cached
+int FrameName::lineNumber(jmethodID method, jint bci) {
+    LineNumberCache::iterator it = _line_numbers.lower_bound(method);
+    if (it == _line_numbers.end() || it->first != method) {
+        it = _line_numbers.insert(it, LineNumberCache::value_type(method, std::vector<jvmtiLineNumberEntry>()));
+
+        jvmtiEnv* jvmti = VM::jvmti();
+        jint entry_count;
+        jvmtiLineNumberEntry* table;
+        if (Snapshot::loaded()) {
+            SnapshotMethod* m = Snapshot::findMethod(method);
+            if (m != NULL) it->second = m->_lines;
+        } else if (jvmti->GetLineNumberTable(method, &entry_count, &table) == 0) {
+            it->second.assign(table, table + entry_count);
+            jvmti->Deallocate((unsigned char*)table);
+        }
+    }
+
+    // Find the entry with the largest start_location not exceeding bci
+    int line = 0;
+    jlocation best = -1;
+    const std::vector<jvmtiLineNumberEntry>& table = it->second;
+    for (size_t i = 0; i < table.size(); i++) {
+        if (table[i].start_location <= bci && table[i].start_location > best) {
+            best = table[i].start_location;
+            line = table[i].line_number;
+        }
+    }
+    return line;
+}
+
+const char* FrameName::name(const ASGCT_CallFrame& frame, bool for_matching) {
     if (frame.method_id == NULL) {
         return "[unknown]";
     }
@@ -223,32 +275,63 @@ const char* FrameName::name(ASGCT_CallFrame& frame, bool for_matching) {
 
         case BCI_THREAD_ID: {
             int tid = (int)(uintptr_t)frame.method_id;
-            MutexLocker ml(_thread_names_lock);
-            ThreadMap::iterator it = _thread_names.find(tid);
+            ThreadRecord record;
+            bool found = _threads.get(tid, &record) && record._name[0] != 0;
             if (for_matching) {
-                return it != _thread_names.end() ? it->second.c_str() : "";
-            } else if (it != _thread_names.end()) {
-                snprintf(_buf, sizeof(_buf) - 1, "[%s tid=%d]", it->second.c_str(), tid);
+                strcpy(_buf, found ? record._name : "");
+            } else if (found) {
+                snprintf(_buf, sizeof(_buf) - 1, "[%s tid=%d]", record._name, tid);
             } else {
                 snprintf(_buf, sizeof(_buf) - 1, "[tid=%d]", tid);
             }
             return _buf;
         }
 
+        case BCI_CONTEXT_TAG: {
+            u64 tag = (u64)(uintptr_t)frame.method_id;
+            snprintf(_buf, sizeof(_buf) - 1, for_matching ? "tag=%llu" : "[tag=%llu]", tag);
+            return _buf;
+        }
+
         case BCI_ERROR: {
             snprintf(_buf, sizeof(_buf) - 1, "[%s]", (const char*)frame.method_id);
             return _buf;
         }
 
         default: {
+            const char* method_name;
             JMethodCache::iterator it = _cache.lower_bound(frame.method_id);
             if (it != _cache.end() && it->first == frame.method_id) {
-                return it->second.c_str();
+                method_name = it->second.c_str();
+            } else {
+                method_name = javaMethodName(frame.method_id);
+                it = _cache.insert(it, JMethodCache::value_type(frame.method_id, method_name));
+                method_name = it->second.c_str();
             }
 
-            const char* newName = javaMethodName(frame.method_id);
-            _cache.insert(it, JMethodCache::value_type(frame.method_id, newName));
-            return newName;
+            const char* suffix = "";
+            if ((_style & STYLE_ANNOTATE) && !for_matching) {
+                switch (decodeFrameType(frame.bci)) {
+                    case FRAME_TYPE_INTERPRETED:  suffix = "_[0]"; break;
+                    case FRAME_TYPE_C1_COMPILED:  suffix = "_[1]"; break;
+                    case FRAME_TYPE_JIT_COMPILED: suffix = "_[j]"; break;
+                    case FRAME_TYPE_INLINED:      suffix = "_[i]"; break;
+                    // Without tiers, every Java frame is marked _[j] as FlameGraph expects;
+                    // with tiers, untyped frames keep the plain Java color
+                    default:                      suffix = _style & STYLE_TIERS ? "" : "_[j]"; break;
+                }
+            }
+
+            // Line number goes before the annotation suffix, so that FlameGraph still recognizes it
+            int line;
+            if ((_style & STYLE_LINES) && frame.bci >= 0 && (line = lineNumber(frame.method_id, decodeBci(frame.bci))) > 0) {
+                snprintf(_buf, sizeof(_buf) - 1, "%s:%d%s", method_name, line, suffix);
+                return _buf;
+            } else if (*suffix) {
+                snprintf(_buf, sizeof(_buf) - 1, "%s%s", method_name, suffix);
+                return _buf;
+            }
+            return method_name;
         }
     }
 }
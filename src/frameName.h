@@ -23,7 +23,7 @@
 #include <vector>
 #include <string>
 #include "arguments.h"
-#include "mutex.h"
+#include "threadRegistry.h"
 #include "vmEntry.h"
 
 #ifdef __APPLE__
@@ -32,7 +32,7 @@
 
 
 typedef std::map<jmethodID, std::string> JMethodCache;
-typedef std::map<int, std::string> ThreadMap;
+typedef std::map<jmethodID, std::vector<jvmtiLineNumberEntry> > LineNumberCache;
 
 
 enum MatchType {
@@ -63,25 +63,27 @@ class Matcher {
 class FrameName {
   private:
     JMethodCache _cache;
+    LineNumberCache _line_numbers;
     std::vector<Matcher> _include;
     std::vector<Matcher> _exclude;
     char _buf[800];  // must be large enough for class name + method name + method signature
     int _style;
-    Mutex& _thread_names_lock;
-    ThreadMap& _thread_names;
+    ThreadRegistry& _threads;
     locale_t _saved_locale;
 
     void buildFilter(std::vector<Matcher>& vector, const char* base, int offset);
     char* truncate(char* name, int max_length);
     const char* cppDemangle(const char* name);
+    char* snapshotMethodName(jmethodID method);
     char* javaMethodName(jmethodID method);
     char* javaClassName(const char* symbol, int length, int style);
+    int lineNumber(jmethodID method, jint bci);
 
   public:
-    FrameName(Arguments& args, int style, Mutex& thread_names_lock, ThreadMap& thread_names);
+    FrameName(Arguments& args, int style, ThreadRegistry& threads);
     ~FrameName();
 
-    const char* name(ASGCT_CallFrame& frame, bool for_matching = false);
+    const char* name(const ASGCT_CallFrame& frame, bool for_matching = false);
 
     bool hasIncludeList() { return !_include.empty(); }
     bool hasExcludeList() { return !_exclude.empty(); }
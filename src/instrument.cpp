@@ -481,6 +481,7 @@ bool Instrument::_instrument_class_loaded = false;
 u64 Instrument::_interval;
 volatile u64 Instrument::_calls;
 volatile bool Instrument::_enabled;
+bool Instrument::_progress = false;
 
 Error Instrument::check(Arguments& args) {
     if (!_instrument_class_loaded) {
@@ -509,16 +510,33 @@ Error Instrument::start(Arguments& args) {
         return Error("interval must be positive");
     }
 
-    setupTargetClassAndMethod(args._event);
     _interval = args._interval ? args._interval : 1;
     _calls = 0;
+    _progress = false;
+    enable(args._event);
+
+    return Error::OK;
+}
+
+Error Instrument::startProgress(Arguments& args) {
+    Error error = check(args);
+    if (error) {
+        return error;
+    }
+
+    _progress = true;
+    enable(args._progress);
+
+    return Error::OK;
+}
+
+void Instrument::enable(const char* target) {
+    setupTargetClassAndMethod(target);
     _enabled = true;
 
     jvmtiEnv* jvmti = VM::jvmti();
     jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_FILE_LOAD_HOOK, NULL);
     retransformMatchedClasses(jvmti);
-
-    return Error::OK;
 }
 
 void Instrument::stop() {
@@ -586,7 +604,9 @@ void JNICALL Instrument::ClassFileLoadHook(jvmtiEnv* jvmti, JNIEnv* jni,
 }
 
 void JNICALL Instrument::recordSample(JNIEnv* jni, jobject unused) {
-    if (_interval <= 1 || ((atomicInc(_calls) + 1) % _interval) == 0) {
+    if (_progress) {
+        Profiler::_instance.causal()->progress();
+    } else if (_interval <= 1 || ((atomicInc(_calls) + 1) % _interval) == 0) {
         Profiler::_instance.recordSample(NULL, _interval, BCI_INSTRUMENT, NULL);
     }
 }
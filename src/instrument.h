@@ -28,6 +28,9 @@ class Instrument : public Engine {
     static u64 _interval;
     static volatile u64 _calls;
     static volatile bool _enabled;
+    static bool _progress;
+
+    void enable(const char* target);
 
   public:
     const char* name() {
@@ -46,6 +49,9 @@ class Instrument : public Engine {
     Error start(Arguments& args);
     void stop();
 
+    // Calls of the 'progress' method mark progress points of causal profiling instead of taking samples
+    Error startProgress(Arguments& args);
+
     void setupTargetClassAndMethod(const char* event);
 
     void retransformMatchedClasses(jvmtiEnv* jvmti);
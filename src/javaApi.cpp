@@ -76,11 +76,202 @@ Java_one_profiler_AsyncProfiler_execute0(JNIEnv* env, jobject unused, jstring co
     }
 }
 
+// Writes profiler output directly into the memory of a direct ByteBuffer.
+// Bytes that do not fit are dropped but still counted.
+class BufferOutput : public std::streambuf {
+  private:
+    jlong _dropped;
+
+  protected:
+    int_type overflow(int_type c) {
+        if (c != traits_type::eof()) {
+            _dropped++;
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) {
+        std::streamsize available = epptr() - pptr();
+        std::streamsize copied = n <= available ? n : available;
+        memcpy(pptr(), s, copied);
+        pbump((int)copied);
+        _dropped += n - copied;
+        return n;
+    }
+
+  public:
+    BufferOutput(char* start, jint length) : _dropped(0) {
+        setp(start, start + length);
+    }
+
+    jlong size() {
+        return (pptr() - pbase()) + _dropped;
+    }
+};
+
+// Passes profiler output to java.io.OutputStream in chunks of a reusable byte[].
+// Once the stream throws, the rest of the output is discarded,
+// and the exception is left pending for the caller.
+class StreamOutput : public std::streambuf {
+  private:
+    static const int CHUNK_SIZE = 65536;
+
+    JNIEnv* _env;
+    jobject _stream;
+    jmethodID _write;
+    jbyteArray _chunk;
+    bool _failed;
+    char _buf[CHUNK_SIZE];
+
+    bool flushChunk() {
+        int length = pptr() - pbase();
+        if (length > 0 && !_failed) {
+            _env->SetByteArrayRegion(_chunk, 0, length, (const jbyte*)pbase());
+            _env->CallVoidMethod(_stream, _write, _chunk, 0, length);
+            _failed = _env->ExceptionCheck();
+        }
+        setp(_buf, _buf + CHUNK_SIZE);
+        return !_failed;
+    }
+
+  protected:
+    int_type overflow(int_type c) {
+        if (!flushChunk()) {
+            return traits_type::eof();
+        }
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() {
+        return flushChunk() ? 0 : -1;
+    }
+
+  public:
+    StreamOutput(JNIEnv* env, jobject stream) : _env(env), _stream(stream), _failed(false) {
+        jclass cls = env->GetObjectClass(stream);
+        _write = env->GetMethodID(cls, "write", "([BII)V");
+        _chunk = _write != NULL ? env->NewByteArray(CHUNK_SIZE) : NULL;
+        _failed = _chunk == NULL;
+        env->DeleteLocalRef(cls);
+        setp(_buf, _buf + CHUNK_SIZE);
+    }
+
+    ~StreamOutput() {
+        if (_chunk != NULL) {
+            _env->DeleteLocalRef(_chunk);
+        }
+    }
+
+    bool failed() {
+        return _failed;
+    }
+};
+
+// Runs the command like execute0, but the output goes to the given stream
+static bool dumpTo(JNIEnv* env, jstring command, std::ostream& out) {
+    Arguments args;
+    const char* command_str = env->GetStringUTFChars(command, NULL);
+    Error error = args.parse(command_str);
+    env->ReleaseStringUTFChars(command, command_str);
+
+    if (error) {
+        JavaAPI::throwNew(env, "java/lang/IllegalArgumentException", error.message());
+        return false;
+    }
+
+    error = Profiler::_instance.runToStream(args, out);
+    if (error) {
+        if (!env->ExceptionCheck()) {
+            JavaAPI::throwNew(env, "java/io/IOException", error.message());
+        }
+        return false;
+    }
+    return !env->ExceptionCheck();
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_one_profiler_AsyncProfiler_dumpToBuffer0(JNIEnv* env, jobject unused, jstring command,
+                                              jobject buffer, jint offset, jint length) {
+    char* address = (char*)env->GetDirectBufferAddress(buffer);
+    if (address == NULL) {
+        JavaAPI::throwNew(env, "java/lang/IllegalArgumentException", "Direct ByteBuffer required");
+        return 0;
+    }
+
+    BufferOutput buf(address + offset, length);
+    std::ostream out(&buf);
+    return dumpTo(env, command, out) ? buf.size() : 0;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_one_profiler_AsyncProfiler_dumpToStream0(JNIEnv* env, jobject unused, jstring command, jobject stream) {
+    StreamOutput buf(env, stream);
+    if (buf.failed()) {
+        // GetMethodID or NewByteArray has thrown
+        return;
+    }
+
+    std::ostream out(&buf);
+    dumpTo(env, command, out);
+}
+
 extern "C" JNIEXPORT jlong JNICALL
 Java_one_profiler_AsyncProfiler_getSamples(JNIEnv* env, jobject unused) {
     return (jlong)Profiler::_instance.total_samples();
 }
 
+extern "C" JNIEXPORT jdouble JNICALL
+Java_one_profiler_AsyncProfiler_getOverhead(JNIEnv* env, jobject unused) {
+    return Profiler::_instance.selfProfile()->overhead();
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_one_profiler_AsyncProfiler_dumpSelfProfile(JNIEnv* env, jobject unused) {
+    std::ostringstream out;
+    Profiler::_instance.selfProfile()->dump(out);
+    return env->NewStringUTF(out.str().c_str());
+}
+
+// Context slot of the current thread, resolved on the first update to save a gettid call on the next ones
+static __thread ContextSlot* _context_slot = NULL;
+
+extern "C" JNIEXPORT void JNICALL
+Java_one_profiler_AsyncProfiler_setContext(JNIEnv* env, jobject unused, jlong span_id, jlong tag) {
+    ContextSlot* slot = _context_slot;
+    if (slot == NULL) {
+        int tid = OS::threadId();
+        if (span_id == 0 && tag == 0) {
+            // Clearing does not commit a page for the thread
+            Profiler::_instance.contexts()->set(tid, 0, 0);
+            return;
+        }
+        slot = _context_slot = Profiler::_instance.contexts()->slot(tid);
+        if (slot == NULL) {
+            return;
+        }
+    }
+    ContextStorage::set(slot, (u64)span_id, (u64)tag);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_one_profiler_AsyncProfiler_progress(JNIEnv* env, jobject unused) {
+    Profiler::_instance.causal()->progress();
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_one_profiler_AsyncProfiler_beginTransaction(JNIEnv* env, jobject unused) {
+    return (jlong)Profiler::_instance.causal()->virtualTime();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_one_profiler_AsyncProfiler_endTransaction(JNIEnv* env, jobject unused, jlong token) {
+    Profiler::_instance.causal()->endTransaction((u64)token);
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_one_profiler_AsyncProfiler_filterThread0(JNIEnv* env, jobject unused, jthread thread, jboolean enable) {
     int thread_id;
@@ -111,7 +302,15 @@ static const JNINativeMethod profiler_natives[] = {
     F(start0,            "(Ljava/lang/String;JZ)V"),
     F(stop0,             "()V"),
     F(execute0,          "(Ljava/lang/String;)Ljava/lang/String;"),
+    F(dumpToBuffer0,     "(Ljava/lang/String;Ljava/nio/ByteBuffer;II)J"),
+    F(dumpToStream0,     "(Ljava/lang/String;Ljava/io/OutputStream;)V"),
     F(getSamples,        "()J"),
+    F(getOverhead,       "()D"),
+    F(dumpSelfProfile,   "()Ljava/lang/String;"),
+    F(setContext,        "(JJ)V"),
+    F(progress,          "()V"),
+    F(beginTransaction,  "()J"),
+    F(endTransaction,    "(J)V"),
     F(filterThread0,     "(Ljava/lang/Thread;Z)V"),
 };
 
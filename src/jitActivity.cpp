@@ -0,0 +1,180 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "jitActivity.h"
+#include "frameName.h"
+#include "os.h"
+
+
+void JitActivity::clear() {
+    MutexLocker ml(_lock);
+    _start_time = 0;
+    _methods.clear();
+}
+
+void JitActivity::start(u64 code_used) {
+    MutexLocker ml(_lock);
+    if (_start_time == 0) {
+        _start_time = OS::millis();
+        _code_peak = 0;
+        _compilations = 0;
+        _unloads = 0;
+        _stubs = 0;
+        _stubs_size = 0;
+        _intervals = 0;
+        memset(_timeline, 0, sizeof(_timeline));
+    }
+
+    // Code compiled or flushed while the profiler was stopped has not been seen
+    _code_used = code_used;
+    if (code_used > _code_peak) _code_peak = code_used;
+    _enabled = true;
+}
+
+void JitActivity::stop() {
+    _enabled = false;
+}
+
+JitInterval* JitActivity::currentInterval() {
+    u64 index = (OS::millis() - _start_time) / 1000;
+    if (index >= MAX_JIT_TIMELINE) {
+        index = MAX_JIT_TIMELINE - 1;
+    }
+    if ((int)index >= _intervals) {
+        _intervals = (int)index + 1;
+    }
+    return &_timeline[index];
+}
+
+u64 JitActivity::compiled(jmethodID method, int code_size, int level) {
+    MutexLocker ml(_lock);
+
+    JitMethodStats& m = _methods[method];
+    m._method = method;
+    m._compilations++;
+    m._level = level;
+    m._code_size = code_size;
+    m._total_code_size += code_size;
+
+    _compilations++;
+    _code_used += code_size;
+    if (_code_used > _code_peak) _code_peak = _code_used;
+
+    JitInterval* interval = currentInterval();
+    interval->compilations++;
+    interval->code_size += code_size;
+    interval->code_used = _code_used;
+    return _code_used;
+}
+
+u64 JitActivity::unloaded(jmethodID method, int code_size) {
+    MutexLocker ml(_lock);
+
+    // The method might have been compiled before the profiler started
+    std::map<jmethodID, JitMethodStats>::iterator it = _methods.find(method);
+    if (it != _methods.end()) {
+        it->second._unloads++;
+    }
+
+    _unloads++;
+    _code_used = _code_used > (u64)code_size ? _code_used - code_size : 0;
+
+    JitInterval* interval = currentInterval();
+    interval->unloads++;
+    interval->code_used = _code_used;
+    return _code_used;
+}
+
+void JitActivity::stubGenerated(int code_size) {
+    MutexLocker ml(_lock);
+
+    _stubs++;
+    _stubs_size += code_size;
+    _code_used += code_size;
+    if (_code_used > _code_peak) _code_peak = _code_used;
+
+    currentInterval()->code_used = _code_used;
+}
+
+void JitActivity::dump(std::ostream& out, FrameName& fn, int max_methods) {
+    MutexLocker ml(_lock);
+    char buf[1024];
+
+    int recompiled = 0;
+    int looping = 0;
+    std::vector<JitMethodStats*> sorted;
+    sorted.reserve(_methods.size());
+    for (std::map<jmethodID, JitMethodStats>::iterator it = _methods.begin(); it != _methods.end(); ++it) {
+        JitMethodStats& m = it->second;
+        if (m._compilations > 1) recompiled++;
+        if (m._compilations > NORMAL_COMPILATIONS) looping++;
+        sorted.push_back(&m);
+    }
+    if (!sorted.empty()) {
+        qsort(&sorted[0], sorted.size(), sizeof(JitMethodStats*), JitMethodStats::comparator);
+    }
+
+    out << "--- JIT activity ---" << std::endl;
+    snprintf(buf, sizeof(buf),
+             "Compilations        : %lld (%d methods, %d recompiled, %d compiled more than %d times)\n"
+             "Unloaded methods    : %lld\n"
+             "Generated stubs     : %lld (%lld bytes)\n"
+             "Code cache used     : %lld KB (peak %lld KB)\n",
+             _compilations, (int)_methods.size(), recompiled, looping, NORMAL_COMPILATIONS,
+             _unloads, _stubs, _stubs_size, _code_used / 1024, _code_peak / 1024);
+    out << buf;
+
+    // Aggregate one-second intervals into at most JIT_TIMELINE_ROWS rows
+    int step = (_intervals + JIT_TIMELINE_ROWS - 1) / JIT_TIMELINE_ROWS;
+    if (step > 0) {
+        snprintf(buf, sizeof(buf), "\n%10s  %12s  %8s  %10s  %10s\n", "time, s", "compilations", "unloads", "code, KB", "used, KB");
+        out << buf;
+
+        u64 code_used = 0;
+        for (int start = 0; start < _intervals; start += step) {
+            JitInterval row = {0};
+            for (int i = start; i < start + step && i < _intervals; i++) {
+                row.compilations += _timeline[i].compilations;
+                row.unloads += _timeline[i].unloads;
+                row.code_size += _timeline[i].code_size;
+                if (_timeline[i].code_used != 0) code_used = _timeline[i].code_used;
+            }
+            snprintf(buf, sizeof(buf), "%10d  %12d  %8d  %10lld  %10lld\n",
+                     start, row.compilations, row.unloads, row.code_size / 1024, code_used / 1024);
+            out << buf;
+        }
+    }
+
+    size_t count = max_methods < (int)sorted.size() ? max_methods : sorted.size();
+    if (count > 0) {
+        snprintf(buf, sizeof(buf), "\n%12s  %7s  %5s  %10s  %10s  %s\n", "compilations", "unloads", "level", "size", "total size", "method");
+        out << buf;
+
+        for (size_t i = 0; i < count; i++) {
+            JitMethodStats* m = sorted[i];
+            ASGCT_CallFrame frame = {0, m->_method};
+            snprintf(buf, sizeof(buf), "%12d  %7d  %5d  %10d  %10lld  %s%s\n",
+                     m->_compilations, m->_unloads, m->_level, m->_code_size, m->_total_code_size,
+                     fn.name(frame), m->_compilations > NORMAL_COMPILATIONS ? "  <- deoptimization loop?" : "");
+            out << buf;
+        }
+    }
+    out << std::endl;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _JITACTIVITY_H
+#define _JITACTIVITY_H
+
+#include <iostream>
+#include <map>
+#include <jvmti.h>
+#include "arch.h"
+#include "mutex.h"
+
+
+// One-second intervals of the compilation timeline; later events go to the last one
+const int MAX_JIT_TIMELINE = 3600;
+const int JIT_TIMELINE_ROWS = 20;
+const int DEFAULT_JIT_METHODS = 30;
+
+// Tiered compilation normally compiles a method up to this many times (tiers 3, 4, and sometimes 2 or 1).
+// Methods compiled more often are likely caught in a deoptimization loop
+const int NORMAL_COMPILATIONS = 4;
+
+
+class JitMethodStats {
+  public:
+    jmethodID _method;
+    int _compilations;
+    int _unloads;
+    int _level;      // tier of the latest compilation
+    int _code_size;  // of the latest compilation
+    u64 _total_code_size;
+
+    // By the number of compilations, then by the amount of generated code
+    static int comparator(const void* s1, const void* s2) {
+        const JitMethodStats* a = *(const JitMethodStats**)s1;
+        const JitMethodStats* b = *(const JitMethodStats**)s2;
+        if (a->_compilations != b->_compilations) {
+            return a->_compilations > b->_compilations ? -1 : 1;
+        }
+        return a->_total_code_size > b->_total_code_size ? -1 : a->_total_code_size < b->_total_code_size ? 1 : 0;
+    }
+};
+
+struct JitInterval {
+    int compilations;
+    int unloads;
+    u64 code_size;
+    u64 code_used;   // at the last event in the interval, 0 if there were none
+};
+
+
+class FrameName;
+
+// Compilation and code cache activity seen through CompiledMethodLoad, CompiledMethodUnload
+// and DynamicCodeGenerated. Events come from compiler and service threads, never from signal handlers.
+class JitActivity {
+  private:
+    Mutex _lock;
+    volatile bool _enabled;
+    u64 _start_time;
+    u64 _code_used;
+    u64 _code_peak;
+    u64 _compilations;
+    u64 _unloads;
+    u64 _stubs;
+    u64 _stubs_size;
+    int _intervals;
+    JitInterval _timeline[MAX_JIT_TIMELINE];
+    std::map<jmethodID, JitMethodStats> _methods;
+
+    JitInterval* currentInterval();
+
+  public:
+    JitActivity() : _enabled(false), _start_time(0) {
+    }
+
+    bool enabled() {
+        return _enabled;
+    }
+
+    bool hasData() {
+        return _start_time != 0;
+    }
+
+    void clear();
+
+    // The code cache already holds code_used bytes of compiled methods and stubs
+    void start(u64 code_used);
+    void stop();
+
+    // Return code cache occupancy after the event
+    u64 compiled(jmethodID method, int code_size, int level);
+    u64 unloaded(jmethodID method, int code_size);
+    void stubGenerated(int code_size);
+
+    void dump(std::ostream& out, FrameName& fn, int max_methods);
+
+    size_t memoryUsage() {
+        return sizeof(_timeline) + _methods.size() * (sizeof(jmethodID) + sizeof(JitMethodStats));
+    }
+};
+
+#endif // _JITACTIVITY_H
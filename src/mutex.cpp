@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <time.h>
 #include "mutex.h"
 
 
@@ -31,3 +32,16 @@ void Mutex::lock() {
 void Mutex::unlock() {
     pthread_mutex_unlock(&_mutex);
 }
+
+WaitableMutex::WaitableMutex() : Mutex() {
+    pthread_cond_init(&_cond, NULL);
+}
+
+bool WaitableMutex::waitUntil(u64 wall_time_millis) {
+    struct timespec ts = {(time_t)(wall_time_millis / 1000), (long)(wall_time_millis % 1000) * 1000000};
+    return pthread_cond_timedwait(&_cond, &_mutex, &ts) == 0;
+}
+
+void WaitableMutex::notify() {
+    pthread_cond_broadcast(&_cond);
+}
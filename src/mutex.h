@@ -18,10 +18,11 @@
 #define _MUTEX_H
 
 #include <pthread.h>
+#include "arch.h"
 
 
 class Mutex {
-  private:
+  protected:
     pthread_mutex_t _mutex;
 
   public:
@@ -32,6 +33,20 @@ class Mutex {
 };
 
 
+// Must be locked exactly once by the calling thread when waiting
+class WaitableMutex : public Mutex {
+  private:
+    pthread_cond_t _cond;
+
+  public:
+    WaitableMutex();
+
+    // Returns false on timeout
+    bool waitUntil(u64 wall_time_millis);
+    void notify();
+};
+
+
 class MutexLocker {
   private:
     Mutex* _mutex;
@@ -54,12 +54,16 @@ class OS {
     static int threadId();
     static bool threadName(int thread_id, char* name_buf, size_t name_len);
     static ThreadState threadState(int thread_id);
+    static u64 threadCpuTime(int thread_id);
+    static u64 processCpuTime();
     static ThreadList* listThreads();
 
     static bool isJavaLibraryVisible();
 
     static void installSignalHandler(int signo, SigAction action, SigHandler handler = NULL);
     static bool sendSignalToThread(int thread_id, int signo);
+    // Delivers the value in si_value where the platform allows, with si_code set to SI_QUEUE
+    static bool queueSignalToThread(int thread_id, int signo, int value);
 };
 
 #endif // _OS_H
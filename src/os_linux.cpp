@@ -169,6 +169,22 @@ ThreadState OS::threadState(int thread_id) {
     return state;
 }
 
+u64 OS::threadCpuTime(int thread_id) {
+    // Per-thread CPU clock of an arbitrary thread, see MAKE_THREAD_CPUCLOCK in linux/posix-timers.h
+    clockid_t thread_cpu_clock = ((clockid_t)~thread_id << 3) | 6;
+    struct timespec tp;
+    if (clock_gettime(thread_cpu_clock, &tp) != 0) {
+        return 0;
+    }
+    return (u64)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+u64 OS::processCpuTime() {
+    struct timespec tp;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tp);
+    return (u64)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
 ThreadList* OS::listThreads() {
     return new LinuxThreadList();
 }
@@ -198,4 +214,17 @@ bool OS::sendSignalToThread(int thread_id, int signo) {
     return syscall(__NR_tgkill, self_pid, thread_id, signo) == 0;
 }
 
+bool OS::queueSignalToThread(int thread_id, int signo, int value) {
+    static const int self_pid = getpid();
+
+    siginfo_t si;
+    memset(&si, 0, sizeof(si));
+    si.si_signo = signo;
+    si.si_code = SI_QUEUE;
+    si.si_pid = self_pid;
+    si.si_uid = getuid();
+    si.si_value.sival_int = value;
+    return syscall(__NR_rt_tgsigqueueinfo, self_pid, thread_id, signo, &si) == 0;
+}
+
 #endif // __linux__
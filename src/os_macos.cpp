@@ -20,6 +20,7 @@
 #include <mach/mach.h>
 #include <mach/mach_time.h>
 #include <pthread.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 #include "os.h"
 
@@ -123,6 +124,23 @@ ThreadState OS::threadState(int thread_id) {
     return info.run_state == TH_STATE_RUNNING ? THREAD_RUNNING : THREAD_SLEEPING;
 }
 
+u64 OS::threadCpuTime(int thread_id) {
+    struct thread_basic_info info;
+    mach_msg_type_number_t size = sizeof(info);
+    if (thread_info((thread_act_t)thread_id, THREAD_BASIC_INFO, (thread_info_t)&info, &size) != 0) {
+        return 0;
+    }
+    return (u64)(info.user_time.seconds + info.system_time.seconds) * 1000000000 +
+           (u64)(info.user_time.microseconds + info.system_time.microseconds) * 1000;
+}
+
+u64 OS::processCpuTime() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (u64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000 +
+           (u64)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
 ThreadList* OS::listThreads() {
     return new MacThreadList();
 }
@@ -155,4 +173,9 @@ bool OS::sendSignalToThread(int thread_id, int signo) {
    return result == 0;
 }
 
+bool OS::queueSignalToThread(int thread_id, int signo, int value) {
+    // There is no way to queue a signal to another thread; the handler finds no value
+    return sendSignalToThread(thread_id, signo);
+}
+
 #endif // __APPLE__
@@ -34,8 +34,10 @@ class PerfEvents : public Engine {
     static CStack _cstack;
     static bool _print_extended_warning;
 
+    static bool selected(int tid);
     static bool createForThread(int tid);
     static void destroyForThread(int tid);
+    template <int COUNTER_ARG>
     static void signalHandler(int signo, siginfo_t* siginfo, void* ucontext);
 
   public:
@@ -50,7 +52,9 @@ class PerfEvents : public Engine {
     void stop();
 
     void onThreadStart(int tid) {
-        createForThread(tid);
+        if (selected(tid)) {
+            createForThread(tid);
+        }
     }
 
     void onThreadEnd(int tid) {
@@ -62,6 +66,7 @@ class PerfEvents : public Engine {
 
     static bool supported();
     static const char* getEventName(int event_id);
+    static size_t memoryUsage();
 };
 
 #endif // _PERFEVENTS_H
@@ -329,6 +329,13 @@ Ring PerfEvents::_ring;
 CStack PerfEvents::_cstack;
 bool PerfEvents::_print_extended_warning;
 
+// When threads are selected only by name, other threads would never pass the filter,
+// so they get no perf_event; a thread that matches after a rename gets one then
+bool PerfEvents::selected(int tid) {
+    ThreadFilter* thread_filter = Profiler::_instance.threadFilter();
+    return !thread_filter->selectsOnlyByName() || thread_filter->accept(tid);
+}
+
 bool PerfEvents::createForThread(int tid) {
     if (tid >= _max_events) {
         fprintf(stderr, "WARNING: tid[%d] > pid_max[%d]. Restart profiler after changing pid_max\n", tid, _max_events);
@@ -439,6 +446,8 @@ void PerfEvents::destroyForThread(int tid) {
     }
 }
 
+// Instantiated for every counter_arg, so that the handler does not look up the event type each time
+template <int COUNTER_ARG>
 void PerfEvents::signalHandler(int signo, siginfo_t* siginfo, void* ucontext) {
     if (siginfo->si_code <= 0) {
         // Looks like an external signal; don't treat as a profiling event
@@ -446,7 +455,7 @@ void PerfEvents::signalHandler(int signo, siginfo_t* siginfo, void* ucontext) {
     }
 
     u64 counter;
-    switch (_event_type->counter_arg) {
+    switch (COUNTER_ARG) {
         case 1: counter = StackFrame(ucontext).arg0(); break;
         case 2: counter = StackFrame(ucontext).arg1(); break;
         case 3: counter = StackFrame(ucontext).arg2(); break;
@@ -550,20 +559,30 @@ Error PerfEvents::start(Arguments& args) {
         _max_events = max_events;
     }
 
-    OS::installSignalHandler(SIGPROF, signalHandler);
+    switch (_event_type->counter_arg) {
+        case 1: OS::installSignalHandler(SIGPROF, signalHandler<1>); break;
+        case 2: OS::installSignalHandler(SIGPROF, signalHandler<2>); break;
+        case 3: OS::installSignalHandler(SIGPROF, signalHandler<3>); break;
+        case 4: OS::installSignalHandler(SIGPROF, signalHandler<4>); break;
+        default: OS::installSignalHandler(SIGPROF, signalHandler<0>);
+    }
 
     // Enable thread events before traversing currently running threads
     Profiler::_instance.switchThreadEvents(JVMTI_ENABLE);
 
-    // Create perf_events for all existing threads
+    // Create perf_events for all existing threads. If none is selected yet, threads may match later
     bool created = false;
+    int selected_threads = 0;
     ThreadList* thread_list = OS::listThreads();
     for (int tid; (tid = thread_list->next()) != -1; ) {
-        created |= createForThread(tid);
+        if (selected(tid)) {
+            selected_threads++;
+            created |= createForThread(tid);
+        }
     }
     delete thread_list;
 
-    if (!created) {
+    if (!created && selected_threads > 0) {
         Profiler::_instance.switchThreadEvents(JVMTI_DISABLE);
         return Error("Perf events unavailable. See stderr of the target process.");
     }
@@ -656,6 +675,10 @@ bool PerfEvents::supported() {
     return stat("/proc/sys/kernel/perf_event_paranoid", &statbuf) == 0;
 }
 
+size_t PerfEvents::memoryUsage() {
+    return _events != NULL ? Arena::residentSize(_events, (size_t)_max_events * sizeof(PerfEvent)) : 0;
+}
+
 const char* PerfEvents::getEventName(int event_id) {
     if (event_id >= 0 && (size_t)event_id < sizeof(PerfEventType::AVAILABLE_EVENTS) / sizeof(PerfEventType)) {
         return PerfEventType::AVAILABLE_EVENTS[event_id].name;
@@ -27,6 +27,7 @@ Ring PerfEvents::_ring;
 bool PerfEvents::_print_extended_warning;
 
 
+bool PerfEvents::selected(int tid) { return false; }
 bool PerfEvents::createForThread(int tid) { return false; }
 void PerfEvents::destroyForThread(int tid) {}
 void PerfEvents::signalHandler(int signo, siginfo_t* siginfo, void* ucontext) {}
@@ -59,4 +60,8 @@ const char* PerfEvents::getEventName(int event_id) {
     return NULL;
 }
 
+size_t PerfEvents::memoryUsage() {
+    return 0;
+}
+
 #endif // __APPLE__
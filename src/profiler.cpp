@@ -14,8 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <fstream>
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -28,11 +32,13 @@
 #include "lockTracer.h"
 #include "wallClock.h"
 #include "instrument.h"
+#include "exceptionTracer.h"
 #include "itimer.h"
 #include "flameGraph.h"
 #include "flightRecorder.h"
 #include "frameName.h"
 #include "os.h"
+#include "snapshot.h"
 #include "stackFrame.h"
 #include "symbols.h"
 #include "vmStructs.h"
@@ -46,6 +52,7 @@ static LockTracer lock_tracer;
 static WallClock wall_clock;
 static ITimer itimer;
 static Instrument instrument;
+static ExceptionTracer exception_tracer;
 
 
 // Stack recovery techniques used to workaround AsyncGetCallTrace flaws.
@@ -62,136 +69,232 @@ enum StackRecovery {
 };
 
 
-u64 Profiler::hashCallTrace(int num_frames, ASGCT_CallFrame* frames) {
-    const u64 M = 0xc6a4a7935bd1e995ULL;
-    const int R = 47;
+static inline FrameType compiledFrameType(int level) {
+    // Tiers 1-3 are C1, tier 4 is C2; a method of unknown tier stays untyped
+    return level >= 1 && level <= 3 ? FRAME_TYPE_C1_COMPILED : level == 4 ? FRAME_TYPE_JIT_COMPILED : FRAME_TYPE_UNKNOWN;
+}
 
-    u64 h = num_frames * M;
+u32 Profiler::bciMask() {
+    // Frame type bits are a part of the trace identity: they keep special frames apart, and tell Java
+    // frames of different tiers when those are recorded. Bci counts only when profiling with line numbers
+    return _add_line_numbers ? 0xffffffff : ~(u32)FRAME_BCI_MASK;
+}
 
-    for (int i = 0; i < num_frames; i++) {
-        u64 k = (u64)frames[i].method_id;
-        k *= M;
-        k ^= k >> R;
-        k *= M;
-        h ^= k;
-        h *= M;
+u64 Profiler::hashCallTrace(int num_frames, ASGCT_CallFrame* frames) {
+    return StackCache::hashTrace(num_frames, frames, bciMask());
+}
+
+// Frames are encoded before the lookup, so that traces with equal hashes are told apart by their
+// frame words. A trace that cannot be stored in full is counted in one of the reserved slots,
+// which have no frames: one for a full frame dictionary, the other for a full buffer or table
+int Profiler::storeCallTrace(int num_frames, ASGCT_CallFrame* frames, u64* words, u64 counter, u64 hash) {
+    // 0 marks an empty slot, and -1 a reserved one
+    if (hash == 0 || hash == (u64)-1) {
+        hash = 1;
     }
 
-    h ^= h >> R;
-    h *= M;
-    h ^= h >> R;
+    int i = FRAME_BUFFER_OVERFLOW_TRACE;
+    if (num_frames > 0) {
+        i = encodeFrames(num_frames, frames, words) ? findCallTrace(num_frames, words, hash) : FRAME_DICTIONARY_OVERFLOW_TRACE;
+    }
 
-    return h;
+    // CallTrace hash found => atomically increment counter
+    atomicInc(_traces[i]._samples);
+    atomicInc(_traces[i]._counter, counter);
+    return i;
 }
 
-int Profiler::storeCallTrace(int num_frames, ASGCT_CallFrame* frames, u64 counter) {
-    u64 hash = hashCallTrace(num_frames, frames);
+int Profiler::findCallTrace(int num_frames, const u64* words, u64 hash) {
+    // Frame type is kept in the bci half of a word, the dictionary index in the other half
+    u64 word_mask = (u64)bciMask() << 32 | 0xffffffffULL;
     int bucket = (int)(hash % MAX_CALLTRACES);
     int i = bucket;
-
-    while (_hashes[i] != hash) {
-        if (_hashes[i] == 0) {
+    int start_frame = -1;
+    bool collided = false;
+
+    while (true) {
+        u64 slot_hash = _hashes[i];
+        if (slot_hash == hash) {
+            if (matchCallTrace(&_traces[i], num_frames, words, word_mask)) {
+                releaseFrames(start_frame, num_frames);
+                return i;
+            }
+            collided |= *(volatile int*)&_traces[i]._num_frames != 0;
+        } else if (slot_hash == 0) {
+            // Frames are reserved before the slot is taken, so that a taken slot always gets them.
+            // If another thread takes the slot first, the reservation is kept for the next empty one,
+            // or given back if the trace turns up in a later slot
+            if (start_frame < 0 && (start_frame = reserveFrames(num_frames)) < 0) {
+                return FRAME_BUFFER_OVERFLOW_TRACE;
+            }
             if (__sync_bool_compare_and_swap(&_hashes[i], 0, hash)) {
-                copyToFrameBuffer(num_frames, frames, &_traces[i]);
-                break;
+                copyToFrameBuffer(num_frames, words, start_frame, &_traces[i]);
+                // A collision is counted once, when the colliding trace gets its own slot
+                if (collided) {
+                    atomicInc(_hash_collisions);
+                }
+                return i;
             }
             continue;
         }
 
         if (++i == MAX_CALLTRACES) i = 0;  // move to next slot
-        if (i == bucket) return 0;         // the table is full
+        if (i == bucket) {
+            // The table is full
+            releaseFrames(start_frame, num_frames);
+            return FRAME_BUFFER_OVERFLOW_TRACE;
+        }
     }
-    
-    // CallTrace hash found => atomically increment counter
-    atomicInc(_traces[i]._samples);
-    atomicInc(_traces[i]._counter, counter);
-    return i;
 }
 
-void Profiler::copyToFrameBuffer(int num_frames, ASGCT_CallFrame* frames, CallTraceSample* trace) {
-    // Atomically reserve space in frame buffer
+// Atomically reserves space in frame buffer; returns -1 if there is not enough space
+int Profiler::reserveFrames(int num_frames) {
     int start_frame;
     do {
         start_frame = _frame_buffer_index;
         if (start_frame + num_frames > _frame_buffer_size) {
             _frame_buffer_overflow = true;  // not enough space to store full trace
-            return;
+            return -1;
         }
     } while (!__sync_bool_compare_and_swap(&_frame_buffer_index, start_frame, start_frame + num_frames));
+    return start_frame;
+}
 
-    trace->_start_frame = start_frame;
-    trace->_num_frames = num_frames;
+// Gives back an unused reservation. That succeeds only if no other frames have been reserved
+// after it; otherwise the frames stay unused until the buffer is reset, and are counted
+void Profiler::releaseFrames(int start_frame, int num_frames) {
+    if (start_frame >= 0 && !__sync_bool_compare_and_swap(&_frame_buffer_index, start_frame + num_frames, start_frame)) {
+        atomicInc(_leaked_frames, num_frames);
+    }
+}
 
+void Profiler::copyToFrameBuffer(int num_frames, const u64* words, int start_frame, CallTraceSample* trace) {
     for (int i = 0; i < num_frames; i++) {
-        _frame_buffer[start_frame++] = frames[i];
+        _frame_buffer[start_frame + i] = words[i];
     }
-}
 
-u64 Profiler::hashMethod(jmethodID method) {
-    const u64 M = 0xc6a4a7935bd1e995ULL;
-    const int R = 17;
+    // Frames must be visible before other threads start comparing against them
+    trace->_start_frame = start_frame;
+    __sync_synchronize();
+    trace->_num_frames = num_frames;
+}
 
-    u64 h = (u64)method;
+// Equal hashes do not guarantee equal traces, so frame words are compared as well, with the
+// same bci mask the hash uses. A slot gets its frames shortly after it is taken; until then
+// it is waited for, and if that takes too long, it is passed by as if it held another trace
+bool Profiler::matchCallTrace(CallTraceSample* trace, int num_frames, const u64* words, u64 word_mask) {
+    int stored_frames;
+    for (int spins = 0; (stored_frames = *(volatile int*)&trace->_num_frames) == 0; spins++) {
+        if (spins == MAX_PUBLISH_SPINS) {
+            return false;
+        }
+        spinPause();
+    }
 
-    h ^= h >> R;
-    h *= M;
-    h ^= h >> R;
+    if (stored_frames != num_frames) {
+        return false;
+    }
 
-    return h;
+    // Pairs with the barrier in copyToFrameBuffer: _start_frame is valid once _num_frames is set
+    __sync_synchronize();
+    return FrameDictionary::equal(_frame_buffer + trace->_start_frame, words, num_frames, word_mask);
 }
 
-void Profiler::storeMethod(jmethodID method, jint bci, u64 counter) {
-    u64 hash = hashMethod(method);
-    int bucket = (int)(hash % MAX_CALLTRACES);
-    int i = bucket;
-
-    while (_methods[i]._method.method_id != method) {
-        if (_methods[i]._method.method_id == NULL) {
-            if (__sync_bool_compare_and_swap(&_methods[i]._method.method_id, NULL, method)) {
-                _methods[i]._method.bci = bci;
-                break;
-            }
-            continue;
+bool Profiler::encodeFrames(int num_frames, ASGCT_CallFrame* frames, u64* words) {
+    for (int i = 0; i < num_frames; i++) {
+        if (!encodeFrame(frames[i], &words[i])) {
+            return false;
         }
-        
-        if (++i == MAX_CALLTRACES) i = 0;  // move to next slot
-        if (i == bucket) return;           // the table is full
     }
+    return true;
+}
 
-    // Method found => atomically increment counter
-    atomicInc(_methods[i]._samples);
-    atomicInc(_methods[i]._counter, counter);
+bool Profiler::encodeFrame(const ASGCT_CallFrame& frame, u64* word) {
+    if (!_frame_dictionary.encode(frame, word)) {
+        _frame_dictionary_overflow = true;
+        return false;
+    }
+    return true;
 }
 
-void Profiler::addJavaMethod(const void* address, int length, jmethodID method) {
+void Profiler::addJavaMethod(const void* address, int length, jmethodID method, const void* compile_info) {
+    // Remember compilation tier to tell C1 frames from C2 ones without touching nmethod in a signal handler
+    NMethod* nmethod = NMethod::findBlob(address);
+    int level = nmethod != NULL ? nmethod->level() : 0;
+
+    // Frame layout and inlining tree for the VM stack walker, built only while it is in use
+    CompiledMethod* cm = NULL;
+    if (_vm_walk) {
+        if (nmethod != NULL) {
+            cm = CompiledMethod::create(method, address, length, level,
+                                        nmethod->frameSize(), nmethod->frameCompleteOffset(), compile_info);
+        }
+        _method_ids.add(method);
+    }
+
     _jit_lock.lock();
-    _java_methods.add(address, length, method, true);
+    _java_methods.add(address, length, method, level);
+    if (cm != NULL) {
+        _compiled_methods.add(cm);
+    }
     _jit_lock.unlock();
+
+    if (_jit_activity.enabled()) {
+        u64 code_used = _jit_activity.compiled(method, length, level);
+        if (_jfr.active()) {
+            _jfr.recordCompilation(method, length, level, code_used);
+        }
+    }
 }
 
 void Profiler::removeJavaMethod(const void* address, jmethodID method) {
     _jit_lock.lock();
-    _java_methods.remove(address, method);
+    int length = _java_methods.remove(address, method);
+    _compiled_methods.remove(address);
+    if (_vm_walk) {
+        // The method may go away with its class, and its Method* may then be reused
+        _method_ids.remove(method);
+    }
     _jit_lock.unlock();
+
+    if (_jit_activity.enabled()) {
+        u64 code_used = _jit_activity.unloaded(method, length);
+        if (_jfr.active()) {
+            _jfr.recordCodeUnload(method, length, code_used);
+        }
+    }
 }
 
 void Profiler::addRuntimeStub(const void* address, int length, const char* name) {
     _stubs_lock.lock();
     _runtime_stubs.add(address, length, name, true);
     _stubs_lock.unlock();
+
+    if (_jit_activity.enabled()) {
+        _jit_activity.stubGenerated(length);
+    }
+
+    if (strcmp(name, "Interpreter") == 0) {
+        _interpreter_start = address;
+        _interpreter_end = (const char*)address + length;
+    }
 }
 
 void Profiler::onThreadStart(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread) {
     int tid = OS::threadId();
-    _thread_filter.remove(tid);
+    _thread_filter.forget(tid);
+    _contexts.set(tid, 0, 0);
+    _thread_registry.threadStart(tid, OS::nanotime(), OS::threadCpuTime(tid));
     updateThreadName(jvmti, jni, thread);
     _engine->onThreadStart(tid);
 }
 
 void Profiler::onThreadEnd(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread) {
     int tid = OS::threadId();
-    _thread_filter.remove(tid);
+    _thread_filter.forget(tid);
     updateThreadName(jvmti, jni, thread);
+    _thread_registry.threadEnd(tid, OS::nanotime(), OS::threadCpuTime(tid));
+    _contexts.set(tid, 0, 0);
     _engine->onThreadEnd(tid);
 }
 
@@ -296,6 +399,13 @@ int Profiler::getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max
     ASGCT_CallTrace trace = {jni, 0, frames};
     VM::_asyncGetCallTrace(&trace, max_depth, ucontext);
 
+    if (trace.num_frames > 0) {
+        if (_add_frame_types && ucontext != NULL) {
+            fillFrameTypes((const void*)StackFrame(ucontext).pc(), frames, trace.num_frames);
+        }
+        return trace.num_frames;
+    }
+
     if ((trace.num_frames == ticks_unknown_Java || trace.num_frames == ticks_not_walkable_Java) && _safe_mode < MAX_RECOVERY) {
         // If current Java stack is not walkable (e.g. the top frame is not fully constructed),
         // try to manually pop the top frame off, hoping that the previous frame is walkable.
@@ -306,18 +416,45 @@ int Profiler::getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max
                   sp = top_frame.sp(),
                   fp = top_frame.fp();
 
+        // The same few stub and prologue PCs account for most failures:
+        // go straight to the technique that worked for this PC before, or give up early
+        u32 cached = _recovery_cache.lookup(pc);
+        _self_profile.countRecoveryCache(cached != 0);
+        if (cached != 0 && RecoveryCache::technique(cached) == RECOVERY_NONE) {
+            // Failures are remembered only for a number of samples: the stack at this PC may be recoverable later
+            int retry_after = RecoveryCache::slot(cached);
+            if (retry_after > 0) {
+                _recovery_cache.store(pc, RecoveryCache::outcome(RECOVERY_NONE, retry_after - 1));
+            } else {
+                cached = 0;
+            }
+        }
+        int cached_technique = RecoveryCache::technique(cached);
+        int cached_slot = RecoveryCache::slot(cached);
+        // Techniques that have been attempted for this sample
+        int tried = 0;
+
         // Stack might not be walkable if some temporary values are pushed onto the stack
         // above the expected frame SP
-        if (!(_safe_mode & MOVE_SP)) {
-            for (int extra_stack_slots = 1; extra_stack_slots <= 2; extra_stack_slots++) {
+        if (!(_safe_mode & MOVE_SP) && (cached == 0 || cached_technique == MOVE_SP)) {
+            int min_slots = cached != 0 ? cached_slot : 1;
+            int max_slots = cached != 0 ? cached_slot : 2;
+            tried |= MOVE_SP;
+            for (int extra_stack_slots = min_slots; extra_stack_slots <= max_slots; extra_stack_slots++) {
                 top_frame.sp() = sp + extra_stack_slots * sizeof(uintptr_t);
                 VM::_asyncGetCallTrace(&trace, max_depth, ucontext);
                 top_frame.sp() = sp;
 
                 if (trace.num_frames > 0) {
+                    if (_add_frame_types) {
+                        fillFrameTypes((const void*)pc, frames, trace.num_frames);
+                    }
+                    _self_profile.countRecovery(MOVE_SP, true);
+                    _recovery_cache.store(pc, RecoveryCache::outcome(MOVE_SP, extra_stack_slots));
                     return trace.num_frames;
                 }
             }
+            _self_profile.countRecovery(MOVE_SP, false);
         }
 
         // Guess top method by PC and insert it manually into the call trace
@@ -336,21 +473,27 @@ int Profiler::getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max
         if (top_frame.validSP()) {
             // Retry with the fixed context, but only if PC looks reasonable,
             // otherwise AsyncGetCallTrace may crash
-            if (!(_safe_mode & POP_FRAME) && top_frame.pop(is_entry_frame)) {
+            if (!(_safe_mode & POP_FRAME) && (cached == 0 || cached_technique == POP_FRAME) && top_frame.pop(is_entry_frame)) {
+                tried |= POP_FRAME;
                 if (getAddressType((instruction_t*)top_frame.pc()) != ADDR_UNKNOWN) {
                     VM::_asyncGetCallTrace(&trace, max_depth, ucontext);
                 }
                 top_frame.restore(pc, sp, fp);
 
+                _self_profile.countRecovery(POP_FRAME, trace.num_frames > 0);
                 if (trace.num_frames > 0) {
+                    _recovery_cache.store(pc, RecoveryCache::outcome(POP_FRAME, 0));
                     return trace.num_frames + (trace.frames - frames);
                 }
             }
 
             // Try to find the previous frame by looking a few top stack slots
             // for something that resembles a return address
-            if (!(_safe_mode & SCAN_STACK)) {
-                for (int slot = 0; slot < StackFrame::callerLookupSlots(); slot++) {
+            if (!(_safe_mode & SCAN_STACK) && (cached == 0 || cached_technique == SCAN_STACK)) {
+                tried |= SCAN_STACK;
+                int first_slot = cached != 0 ? cached_slot : 0;
+                int last_slot = cached != 0 ? cached_slot + 1 : StackFrame::callerLookupSlots();
+                for (int slot = first_slot; slot < last_slot; slot++) {
                     if (getAddressType((instruction_t*)top_frame.stackAt(slot)) != ADDR_UNKNOWN) {
                         top_frame.pc() = top_frame.stackAt(slot);
                         top_frame.sp() = sp + (slot + 1) * sizeof(uintptr_t);
@@ -358,12 +501,27 @@ int Profiler::getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max
                         top_frame.restore(pc, sp, fp);
 
                         if (trace.num_frames > 0) {
+                            _self_profile.countRecovery(SCAN_STACK, true);
+                            _recovery_cache.store(pc, RecoveryCache::outcome(SCAN_STACK, slot));
                             return trace.num_frames + (trace.frames - frames);
                         }
                     }
                 }
+                _self_profile.countRecovery(SCAN_STACK, false);
             }
         }
+
+        // Give up on the PC only if every enabled technique has failed, not just the ones
+        // that could not be attempted this time, e.g. because SP was off the thread stack
+        const int enabled = (MOVE_SP | POP_FRAME | SCAN_STACK) & ~_safe_mode;
+        if (cached == 0) {
+            if (tried == enabled) {
+                _recovery_cache.store(pc, RecoveryCache::outcome(RECOVERY_NONE, RECOVERY_RETRY_SAMPLES));
+            }
+        } else if (cached_technique != RECOVERY_NONE) {
+            // The remembered technique no longer helps; probe all of them next time
+            _recovery_cache.remove(pc);
+        }
     } else if (trace.num_frames == ticks_unknown_not_Java && !(_safe_mode & LAST_JAVA_PC)) {
         VMThread* thread = VMThread::fromEnv(jni);
         if (thread != NULL) {
@@ -391,11 +549,14 @@ int Profiler::getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max
 
                 sp = saved_sp;
                 pc = 0;
+                _self_profile.countRecovery(LAST_JAVA_PC, trace.num_frames > 0);
             }
         }
     } else if (trace.num_frames == ticks_GC_active && VMStructs::_get_stack_trace != NULL && !(_safe_mode & GC_TRACES)) {
         // While GC is running Java threads are known to be at safepoint
-        return getJavaTraceJvmti((jvmtiFrameInfo*)frames, frames, max_depth);
+        int num_frames = getJavaTraceJvmti((jvmtiFrameInfo*)frames, frames, max_depth);
+        _self_profile.countRecovery(GC_TRACES, num_frames > 0);
+        return num_frames;
     }
 
     if (trace.num_frames > 0) {
@@ -428,8 +589,10 @@ int Profiler::getJavaTraceJvmti(jvmtiFrameInfo* jvmti_frames, ASGCT_CallFrame* f
     if (VMStructs::_get_stack_trace(NULL, vm_thread, 0, max_depth, jvmti_frames, &num_frames) == 0 && num_frames > 0) {
         // Profiler expects stack trace in AsyncGetCallTrace format; convert it now
         for (int i = 0; i < num_frames; i++) {
-            frames[i].method_id = jvmti_frames[i].method;
-            frames[i].bci = 0;
+            jmethodID method = jvmti_frames[i].method;
+            jint bci = (jint)jvmti_frames[i].location;
+            frames[i].method_id = method;
+            frames[i].bci = bci;
         }
         return num_frames;
     }
@@ -437,6 +600,133 @@ int Profiler::getJavaTraceJvmti(jvmtiFrameInfo* jvmti_frames, ASGCT_CallFrame* f
     return 0;
 }
 
+// Walks compiled and interpreted frames using the frame layout recorded at CompiledMethodLoad
+// and the well-known layout of HotSpot interpreter frames. As soon as a frame cannot be
+// recognized, the rest of the stack is delegated to AsyncGetCallTrace starting from that frame.
+int Profiler::getJavaTraceVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth) {
+    const int method_slot = StackFrame::interpreterMethodSlot();
+    if (ucontext == NULL || method_slot == 0 || !_jit_lock.tryLockShared()) {
+        return getJavaTraceAsync(ucontext, frames, max_depth);
+    }
+
+    JNIEnv* jni = VM::jni();
+    if (jni == NULL) {
+        _jit_lock.unlockShared();
+        return 0;
+    }
+
+    // No Java frame is that large; a bigger step means the walk went astray
+    const uintptr_t max_frame_size = 0x100000;
+
+    StackFrame frame(ucontext);
+    uintptr_t pc = frame.pc(),
+              sp = frame.sp(),
+              fp = frame.fp();
+
+    // Every stack read stays between the current SP and the stack base, and SP only grows,
+    // so a shallow stack or a garbage FP cannot make the walker fault
+    uintptr_t stack_base = VMThread::hasStackBase() ? VMThread::fromEnv(jni)->stackBase() : 0;
+    if (sp >= stack_base) {
+        _jit_lock.unlockShared();
+        return getJavaTraceAsync(ucontext, frames, max_depth);
+    }
+
+    // Interpreter frame slots read below: the method at method_slot, and sender SP, FP and PC at -1, 0 and 1
+    const int min_fp_slot = method_slot < -1 ? method_slot : -1;
+    const int max_fp_slot = method_slot > 1 ? method_slot : 1;
+
+    int depth = 0;
+    while (depth < max_depth) {
+        CompiledMethod* cm = _compiled_methods.find((const void*)pc);
+        if (cm != NULL) {
+            // In the prologue and the epilogue, SP is not where the frame size expects it
+            if (cm->_frame_size <= 0 || (depth == 0 && (!cm->frameComplete((const void*)pc) ||
+                    StackFrame::isCompiledEpilogue((instruction_t*)pc, (instruction_t*)cm->_start)))) {
+                break;
+            }
+
+            // Return addresses must match a recorded PC exactly
+            int n = cm->expand((const void*)pc, depth > 0, frames + depth, max_depth - depth);
+            if (n < 0) {
+                break;
+            }
+            if (_add_frame_types && depth == 0) {
+                for (int i = 0; i < n && frames[i].bci >= 0; i++) {
+                    frames[i].bci = encodeFrameType(i == n - 1 ? compiledFrameType(cm->_level) : FRAME_TYPE_INLINED, frames[i].bci);
+                }
+            }
+
+            uintptr_t sender_sp = sp + cm->_frame_size * sizeof(uintptr_t);
+            if (sender_sp < sp + 2 * sizeof(uintptr_t) || sender_sp - sp >= max_frame_size || sender_sp > stack_base) {
+                break;
+            }
+            depth += n;
+            pc = ((uintptr_t*)sender_sp)[-1];
+            fp = ((uintptr_t*)sender_sp)[-2];
+            sp = sender_sp;
+        } else if (pc >= (uintptr_t)_interpreter_start && pc < (uintptr_t)_interpreter_end && depth > 0 && !_add_line_numbers) {
+            // The top interpreted frame may be half-built, and bci is not known without
+            // decoding the interpreter state, so only callers with line numbers off are handled
+            if (fp <= sp || fp - sp >= max_frame_size ||
+                fp + min_fp_slot * (intptr_t)sizeof(uintptr_t) < sp ||
+                fp + (max_fp_slot + 1) * sizeof(uintptr_t) > stack_base) {
+                break;
+            }
+            jmethodID method = _method_ids.find(((const void**)fp)[method_slot]);
+            uintptr_t sender_sp = ((uintptr_t*)fp)[-1];
+            if (method == NULL || sender_sp <= sp || sender_sp >= stack_base) {
+                break;
+            }
+            frames[depth].method_id = method;
+            frames[depth].bci = 0;
+            depth++;
+            sp = sender_sp;
+            pc = ((uintptr_t*)fp)[1];
+            fp = ((uintptr_t*)fp)[0];
+        } else {
+            break;
+        }
+    }
+
+    _jit_lock.unlockShared();
+
+    if (depth == 0) {
+        int num_frames = getJavaTraceAsync(ucontext, frames, max_depth);
+        addMethodIds(frames, num_frames);
+        return num_frames;
+    } else if (depth == max_depth) {
+        return depth;
+    }
+
+    uintptr_t saved_pc = frame.pc(),
+              saved_sp = frame.sp(),
+              saved_fp = frame.fp();
+
+    ASGCT_CallTrace trace = {jni, 0, frames + depth};
+    frame.restore(pc, sp, fp);
+    VM::_asyncGetCallTrace(&trace, max_depth - depth, ucontext);
+    frame.restore(saved_pc, saved_sp, saved_fp);
+
+    if (trace.num_frames > 0) {
+        addMethodIds(trace.frames, trace.num_frames);
+        return depth + trace.num_frames;
+    }
+
+    // Frames walked so far cannot be trusted
+    int num_frames = getJavaTraceAsync(ucontext, frames, max_depth);
+    addMethodIds(frames, num_frames);
+    return num_frames;
+}
+
+// Teaches the VM stack walker the methods found by AsyncGetCallTrace
+void Profiler::addMethodIds(ASGCT_CallFrame* frames, int num_frames) {
+    for (int i = 0; i < num_frames; i++) {
+        if (frames[i].bci > BCI_NATIVE_FRAME) {
+            _method_ids.add(frames[i].method_id);
+        }
+    }
+}
+
 int Profiler::makeEventFrame(ASGCT_CallFrame* frames, jint event_type, jmethodID event) {
     frames[0].bci = event_type;
     frames[0].method_id = event;
@@ -447,9 +737,10 @@ bool Profiler::fillTopFrame(const void* pc, ASGCT_CallFrame* frame) {
     jmethodID method = NULL;
 
     // Check if PC belongs to a JIT compiled method
+    int level;
     _jit_lock.lockShared();
-    if (_java_methods.contains(pc) && (method = _java_methods.find(pc)) != NULL) {
-        frame->bci = 0;
+    if (_java_methods.contains(pc) && (method = _java_methods.find(pc, &level)) != NULL) {
+        frame->bci = _add_frame_types ? encodeFrameType(compiledFrameType(level), 0) : 0;
         frame->method_id = method;
     }
     _jit_lock.unlockShared();
@@ -469,6 +760,40 @@ bool Profiler::fillTopFrame(const void* pc, ASGCT_CallFrame* frame) {
     return method != NULL;
 }
 
+// Only the top frames can be classified by PC: the interpreted top frame,
+// or the compiled method containing PC together with the frames inlined into it
+void Profiler::fillFrameTypes(const void* pc, ASGCT_CallFrame* frames, int num_frames) {
+    if (pc >= _interpreter_start && pc < _interpreter_end) {
+        if (frames[0].bci >= 0) {
+            frames[0].bci = encodeFrameType(FRAME_TYPE_INTERPRETED, frames[0].bci);
+        }
+        return;
+    }
+
+    if (!_java_methods.contains(pc)) {
+        return;
+    }
+
+    int level;
+    _jit_lock.lockShared();
+    jmethodID method = _java_methods.find(pc, &level);
+    _jit_lock.unlockShared();
+
+    if (method == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < num_frames && frames[i].bci >= 0; i++) {
+        if (frames[i].method_id == method) {
+            frames[i].bci = encodeFrameType(compiledFrameType(level), frames[i].bci);
+            for (int j = 0; j < i; j++) {
+                frames[j].bci = encodeFrameType(FRAME_TYPE_INLINED, frames[j].bci);
+            }
+            return;
+        }
+    }
+}
+
 AddressType Profiler::getAddressType(instruction_t* pc) {
     bool in_generated_code = false;
 
@@ -508,9 +833,30 @@ AddressType Profiler::getAddressType(instruction_t* pc) {
     return ADDR_UNKNOWN;
 }
 
-void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state) {
+// The sampling path is instantiated for the combinations of SAMPLE_SPECIALIZED flags that a session
+// can use, so that the configuration of a profiling session costs no branches in signal handlers.
+// Analysis modes and JVM event engines take the generic variant, which checks the flags at run time
+template <int FLAGS>
+void Profiler::recordSampleImpl(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state, u32 tick) {
+    if (FLAGS != SAMPLE_GENERIC) {
+        // Specialized variants serve only engines that sample by signal: there is no event of their own
+        event_type = 0;
+        event = NULL;
+    }
+
+    PhaseTimer<FLAGS == SAMPLE_GENERIC> timer(&_self_profile);
     int tid = OS::threadId();
 
+    if (sampleFlag<FLAGS>(SAMPLE_THREAD_FILTER) && !_thread_filter.accept(tid)) {
+        // Engines that cannot target specific threads (itimer, perf_events) get here for every thread
+        if (event_type == 0) {
+            _engine->getNativeTrace(ucontext, tid, NULL, 0, &_java_methods, &_runtime_stubs);
+        }
+        return;
+    }
+
+    _thread_registry.countSample(tid);
+
     u64 lock_index = atomicInc(_total_samples) % CONCURRENCY_LEVEL;
     if (!_locks[lock_index].tryLock()) {
         // Too many concurrent signals already
@@ -524,6 +870,7 @@ void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmetho
     }
 
     atomicInc(_total_counter, counter);
+    timer.lap(lock_index, PHASE_LOCK);
 
     ASGCT_CallFrame* frames = _calltrace_buffer[lock_index]->_asgct_frames;
 
@@ -531,8 +878,9 @@ void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmetho
     if (event != NULL) {
         num_frames = makeEventFrame(frames, event_type, event);
     }
-    if (_cstack != CSTACK_NO) {
+    if (sampleFlag<FLAGS>(SAMPLE_CSTACK)) {
         num_frames += getNativeTrace(ucontext, frames + num_frames, tid);
+        timer.lap(lock_index, PHASE_NATIVE_TRACE);
     }
 
     if (event_type != 0 && VMStructs::_get_stack_trace != NULL) {
@@ -540,8 +888,10 @@ void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmetho
         jvmtiFrameInfo* jvmti_frames = _calltrace_buffer[lock_index]->_jvmti_frames;
         num_frames += getJavaTraceJvmti(jvmti_frames + num_frames, frames + num_frames, _max_stack_depth);
     } else if (VMStructs::hasJNIEnv()) {
-        num_frames += getJavaTraceAsync(ucontext, frames + num_frames, _max_stack_depth);
+        num_frames += sampleFlag<FLAGS>(SAMPLE_VM_WALK) ? getJavaTraceVM(ucontext, frames + num_frames, _max_stack_depth)
+                                               : getJavaTraceAsync(ucontext, frames + num_frames, _max_stack_depth);
     }
+    timer.lap(lock_index, PHASE_JAVA_TRACE);
 
     if (num_frames == 0 || (num_frames == 1 && event != NULL)) {
         num_frames += makeEventFrame(frames + num_frames, BCI_ERROR, (jmethodID)"no_Java_frame");
@@ -551,15 +901,111 @@ void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmetho
         num_frames--;
     }
 
-    if (_add_thread_frame) {
+    // Causal profiling experiments are about the Java method being executed
+    jmethodID top_method = NULL;
+    if (sampleFlag<FLAGS>(SAMPLE_CAUSAL) && event_type == 0) {
+        for (int i = 0; i < num_frames; i++) {
+            if (frames[i].bci >= 0) {
+                top_method = frames[i].method_id;
+                break;
+            }
+        }
+    }
+
+    if (sampleFlag<FLAGS>(SAMPLE_THREAD_FRAME)) {
         num_frames += makeEventFrame(frames + num_frames, BCI_THREAD_ID, (jmethodID)(uintptr_t)tid);
     }
 
-    storeMethod(frames[0].method_id, frames[0].bci, counter);
-    int call_trace_id = storeCallTrace(num_frames, frames, counter);
-    _jfr.recordExecutionSample(lock_index, tid, call_trace_id, thread_state);
+    Context context;
+    if (sampleFlag<FLAGS>(SAMPLE_CONTEXT_FRAME | SAMPLE_JFR) && !_contexts.get(tid, &context)) {
+        context.span_id = context.tag = 0;
+    }
+    // The frame keeps the lower 32 bits of the tag, so that it fits in a frame word inline
+    if (sampleFlag<FLAGS>(SAMPLE_CONTEXT_FRAME) && (u32)context.tag != 0) {
+        num_frames += makeEventFrame(frames + num_frames, BCI_CONTEXT_TAG, (jmethodID)(uintptr_t)(u32)context.tag);
+    }
+
+    u64 hash = sampleFlag<FLAGS>(SAMPLE_STACK_CACHE) ? _stack_cache.hash(tid, num_frames, frames) : hashCallTrace(num_frames, frames);
+    int call_trace_id = storeCallTrace(num_frames, frames, _frame_words[lock_index], counter, hash);
+    timer.lap(lock_index, PHASE_STORE);
+
+    if (sampleFlag<FLAGS>(SAMPLE_JFR)) {
+        _jfr.recordExecutionSample(lock_index, tid, call_trace_id, thread_state, context);
+        timer.lap(lock_index, PHASE_JFR);
+    }
+
+    // Threads blocked or sleeping in a frame do not run it in parallel
+    if (sampleFlag<FLAGS>(SAMPLE_CONCURRENCY) && thread_state == THREAD_RUNNING && call_trace_id != 0) {
+        _concurrency.record(call_trace_id, tick);
+    }
+    timer.finish(lock_index);
 
     _locks[lock_index].unlock();
+
+    // Delays are paid outside the lock, so that paused threads do not block others
+    if (sampleFlag<FLAGS>(SAMPLE_CAUSAL) && event_type == 0) {
+        _causal.sample(tid, top_method);
+    }
+}
+
+template <int FLAGS>
+void Profiler::recordSampleEntry(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state, u32 tick) {
+    _instance.recordSampleImpl<FLAGS>(ucontext, counter, event_type, event, thread_state, tick);
+}
+
+// Samples that arrive before the first profiling session have nowhere to go
+void Profiler::dropSample(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state, u32 tick) {
+}
+
+// Walks SAMPLE_SPECIALIZED flags one bit at a time, so that the selection takes a few branches
+template <int FLAGS, int BIT>
+struct RecordSampleVariant {
+    static Profiler::RecordSampleFunc select(int flags) {
+        return flags & BIT ? RecordSampleVariant<FLAGS | BIT, BIT * 2>::select(flags)
+                           : RecordSampleVariant<FLAGS, BIT * 2>::select(flags);
+    }
+};
+
+// JFR keeps the thread and the context in its events and never adds their frames
+template <int FLAGS>
+struct RecordSampleVariant<FLAGS, SAMPLE_SPECIALIZED + 1> {
+    static Profiler::RecordSampleFunc select(int flags) {
+        return RecordSampleLeaf<FLAGS, !((FLAGS & SAMPLE_JFR) && (FLAGS & (SAMPLE_THREAD_FRAME | SAMPLE_CONTEXT_FRAME)))>::get();
+    }
+};
+
+template <int FLAGS>
+struct RecordSampleLeaf<FLAGS, true> {
+    static Profiler::RecordSampleFunc get() {
+        return Profiler::recordSampleEntry<FLAGS>;
+    }
+};
+
+template <int FLAGS>
+struct RecordSampleLeaf<FLAGS, false> {
+    static Profiler::RecordSampleFunc get() {
+        return Profiler::recordSampleEntry<SAMPLE_GENERIC>;
+    }
+};
+
+Profiler::RecordSampleFunc Profiler::selectRecordSample(Arguments& args) {
+    bool signal_engine = _engine == &perf_events || _engine == &itimer || _engine == &wall_clock;
+    _sample_flags = (_cstack != CSTACK_NO ? SAMPLE_CSTACK : 0)
+                  | (_vm_walk ? SAMPLE_VM_WALK : 0)
+                  | (_thread_filter.enabled() ? SAMPLE_THREAD_FILTER : 0)
+                  | (_stack_cache.enabled() ? SAMPLE_STACK_CACHE : 0)
+                  | (_add_thread_frame ? SAMPLE_THREAD_FRAME : 0)
+                  | (_add_context_frame ? SAMPLE_CONTEXT_FRAME : 0)
+                  | (_jfr.active() ? SAMPLE_JFR : 0)
+                  | (args._self_profile ? SAMPLE_SELF_PROFILE : 0)
+                  | (_concurrency.enabled() ? SAMPLE_CONCURRENCY : 0)
+                  | (_causal_active ? SAMPLE_CAUSAL : 0)
+                  | (signal_engine ? 0 : SAMPLE_JVM_EVENTS);
+
+    if (_sample_flags & ~SAMPLE_SPECIALIZED) {
+        return recordSampleEntry<SAMPLE_GENERIC>;
+    }
+    return RecordSampleVariant<0, 1>::select(_sample_flags);
 }
 
 jboolean JNICALL Profiler::NativeLibraryLoadTrap(JNIEnv* env, jobject self, jstring name, jboolean builtin) {
@@ -570,7 +1016,7 @@ jboolean JNICALL Profiler::NativeLibraryLoadTrap(JNIEnv* env, jobject self, jstr
 
 void JNICALL Profiler::ThreadSetNativeNameTrap(JNIEnv* env, jobject self, jstring name) {
     _instance._original_Thread_setNativeName(env, self, name);
-    _instance.updateThreadName(VM::jvmti(), env, self);
+    _instance.updateThreadName(VM::jvmti(), env, self, true);
 }
 
 void Profiler::bindNativeLibraryLoad(JNIEnv* env, NativeLoadLibraryFunc entry) {
@@ -631,29 +1077,47 @@ void Profiler::switchNativeMethodTraps(bool enable) {
 
     if (enable) {
         bindNativeLibraryLoad(env, NativeLibraryLoadTrap);
-        // bindThreadSetNativeName(env, ThreadSetNativeNameTrap);
+        if (_thread_filter.hasNamePatterns()) {
+            // Thread selection by name must follow Thread.setName()
+            bindThreadSetNativeName(env, ThreadSetNativeNameTrap);
+        }
     } else {
         bindNativeLibraryLoad(env, _original_NativeLibrary_load);
-        // bindThreadSetNativeName(env, _original_Thread_setNativeName);
+        if (_thread_filter.hasNamePatterns()) {
+            bindThreadSetNativeName(env, _original_Thread_setNativeName);
+        }
     }
 
     env->ExceptionClear();
 }
 
-void Profiler::setThreadInfo(int tid, const char* name, jlong java_thread_id) {
-    MutexLocker ml(_thread_names_lock);
-    _thread_names[tid] = name;
-    _thread_ids[java_thread_id] = tid;
-}
-
-void Profiler::updateThreadName(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread) {
-    if (_update_thread_names) {
+void Profiler::updateThreadName(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread, bool renamed) {
+    bool select_by_name = _thread_filter.hasNamePatterns();
+    if (_update_thread_names || select_by_name) {
         VMThread* vm_thread = VMThread::fromJavaThread(jni, thread);
         jvmtiThreadInfo thread_info;
         if (vm_thread != NULL && jvmti->GetThreadInfo(thread, &thread_info) == 0) {
-            jlong java_thread_id = VMThread::javaThreadId(jni, thread);
-            setThreadInfo(vm_thread->osThreadId(), thread_info.name, java_thread_id);
+            int tid = vm_thread->osThreadId();
+            if (select_by_name && _thread_filter.updateName(tid, thread_info.name) && renamed) {
+                // The engine skipped this thread when it started, since the old name did not match
+                _engine->onThreadStart(tid);
+            }
+
+            if (_update_thread_names) {
+                jlong java_thread_id = VMThread::javaThreadId(jni, thread);
+                jvmtiThreadGroupInfo group_info;
+                if (thread_info.thread_group != NULL && jvmti->GetThreadGroupInfo(thread_info.thread_group, &group_info) == 0) {
+                    _thread_registry.update(tid, thread_info.name, java_thread_id, group_info.name);
+                    jvmti->Deallocate((unsigned char*)group_info.name);
+                    jni->DeleteLocalRef(group_info.parent);
+                } else {
+                    _thread_registry.update(tid, thread_info.name, java_thread_id, NULL);
+                }
+            }
+
             jvmti->Deallocate((unsigned char*)thread_info.name);
+            jni->DeleteLocalRef(thread_info.thread_group);
+            jni->DeleteLocalRef(thread_info.context_class_loader);
         }
     }
 }
@@ -682,12 +1146,8 @@ void Profiler::updateNativeThreadNames() {
         char name_buf[64];
 
         for (int tid; (tid = thread_list->next()) != -1; ) {
-            MutexLocker ml(_thread_names_lock);
-            std::map<int, std::string>::iterator it = _thread_names.lower_bound(tid);
-            if (it == _thread_names.end() || it->first != tid) {
-                if (OS::threadName(tid, name_buf, sizeof(name_buf))) {
-                    _thread_names.insert(it, std::map<int, std::string>::value_type(tid, name_buf));
-                }
+            if (!_thread_registry.contains(tid) && OS::threadName(tid, name_buf, sizeof(name_buf))) {
+                _thread_registry.update(tid, name_buf, 0, NULL);
             }
         }
 
@@ -695,6 +1155,53 @@ void Profiler::updateNativeThreadNames() {
     }
 }
 
+// Resolves threads=PATTERN selection for threads that already exist;
+// new threads are matched on ThreadStart and when renamed
+void Profiler::selectThreadsByName() {
+    if (!_thread_filter.hasNamePatterns()) {
+        return;
+    }
+
+    // OS thread names are truncated, so Java threads are matched once again below by their full names
+    ThreadList* thread_list = OS::listThreads();
+    char name_buf[64];
+    for (int tid; (tid = thread_list->next()) != -1; ) {
+        if (OS::threadName(tid, name_buf, sizeof(name_buf))) {
+            _thread_filter.updateName(tid, name_buf);
+        }
+    }
+    delete thread_list;
+
+    jvmtiEnv* jvmti = VM::jvmti();
+    jint thread_count;
+    jthread* thread_objects;
+    if (jvmti->GetAllThreads(&thread_count, &thread_objects) == 0) {
+        JNIEnv* jni = VM::jni();
+        for (int i = 0; i < thread_count; i++) {
+            updateThreadName(jvmti, jni, thread_objects[i]);
+        }
+        jvmti->Deallocate((unsigned char*)thread_objects);
+    }
+}
+
+// Per-thread CPU time is measured by the thread CPU clock: for live threads at start and stop,
+// for threads started or terminated while profiling - in ThreadStart / ThreadEnd callbacks
+void Profiler::startThreadCpuAccounting() {
+    ThreadList* thread_list = OS::listThreads();
+    for (int tid; (tid = thread_list->next()) != -1; ) {
+        _thread_registry.cpuStart(tid, OS::threadCpuTime(tid));
+    }
+    delete thread_list;
+}
+
+void Profiler::stopThreadCpuAccounting() {
+    ThreadList* thread_list = OS::listThreads();
+    for (int tid; (tid = thread_list->next()) != -1; ) {
+        _thread_registry.cpuStop(tid, OS::threadCpuTime(tid));
+    }
+    delete thread_list;
+}
+
 bool Profiler::excludeTrace(FrameName* fn, CallTraceSample* trace) {
     bool checkInclude = fn->hasIncludeList();
     bool checkExclude = fn->hasExcludeList();
@@ -703,7 +1210,7 @@ bool Profiler::excludeTrace(FrameName* fn, CallTraceSample* trace) {
     }
 
     for (int i = 0; i < trace->_num_frames; i++) {
-        const char* frame_name = fn->name(_frame_buffer[trace->_start_frame + i], true);
+        const char* frame_name = fn->name(frameAt(trace->_start_frame + i), true);
         if (checkExclude && fn->exclude(frame_name)) {
             return true;
         }
@@ -727,6 +1234,8 @@ Engine* Profiler::selectEngine(const char* event_name) {
         return &wall_clock;
     } else if (strcmp(event_name, EVENT_ITIMER) == 0) {
         return &itimer;
+    } else if (strcmp(event_name, EVENT_EXCEPTIONS) == 0) {
+        return &exception_tracer;
     } else if (strchr(event_name, '.') != NULL) {
         return &instrument;
     } else {
@@ -750,6 +1259,98 @@ Error Profiler::checkJvmCapabilities() {
     return Error::OK;
 }
 
+// Buffers written by signal handlers share one arena, which is reserved again
+// only when their sizes or memory options change
+Error Profiler::allocateBuffers(Arguments& args) {
+    // The concurrency log is kept while it holds samples of an earlier session
+    bool concurrency_log = args._concurrency || _concurrency.size() > 0;
+    if (_arena.reserved() && _frame_buffer_size == args._framebuf && _max_stack_depth == args._jstackdepth &&
+        _arena.hugePagesRequested() == args._huge_pages && _arena.prefaulted() == args._prefault &&
+        (_stack_cache_buffer != NULL) == args._stack_cache && (_concurrency_buffer != NULL) == concurrency_log) {
+        return Error::OK;
+    }
+
+    if (_frame_buffer_index > args._framebuf) {
+        return Error("framebuf is smaller than the part already in use; restart profiling with reset");
+    }
+
+    size_t frame_buffer_size = (size_t)args._framebuf * sizeof(u64);
+    size_t calltrace_buffer_size = (args._jstackdepth + MAX_NATIVE_FRAMES + RESERVED_FRAMES) * sizeof(CallTraceBuffer);
+    size_t frame_words_size = (args._jstackdepth + MAX_NATIVE_FRAMES + RESERVED_FRAMES) * sizeof(u64);
+    size_t jfr_buffer_size = FlightRecorder::bufferSize();
+    size_t stack_cache_size = args._stack_cache ? StackCache::size() : 0;
+    size_t concurrency_log_size = concurrency_log ? ConcurrencyLog::bufferSize() : 0;
+    size_t capacity = Arena::align(frame_buffer_size) + CONCURRENCY_LEVEL * Arena::align(calltrace_buffer_size) +
+                      CONCURRENCY_LEVEL * Arena::align(frame_words_size) +
+                      Arena::align(jfr_buffer_size) + Arena::align(stack_cache_size) + Arena::align(concurrency_log_size);
+
+    // Frames collected before the profiler was stopped survive resume with other options
+    u64* saved_frames = NULL;
+    if (_frame_buffer_index > 0 && _frame_buffer != NULL) {
+        saved_frames = (u64*)malloc(_frame_buffer_index * sizeof(u64));
+        if (saved_frames == NULL) {
+            return Error("Not enough memory to preserve frame buffer");
+        }
+        memcpy(saved_frames, _frame_buffer, _frame_buffer_index * sizeof(u64));
+    }
+
+    u64* saved_concurrency = NULL;
+    if (_concurrency.size() > 0) {
+        saved_concurrency = (u64*)malloc(_concurrency.size() * sizeof(u64));
+        if (saved_concurrency == NULL) {
+            free(saved_frames);
+            return Error("Not enough memory to preserve concurrency log");
+        }
+        memcpy(saved_concurrency, _concurrency_buffer, _concurrency.size() * sizeof(u64));
+    }
+
+    _frame_buffer = NULL;
+    _frame_buffer_size = 0;
+    _max_stack_depth = 0;
+    _jfr_buffers = NULL;
+    _stack_cache_buffer = NULL;
+    _concurrency_buffer = NULL;
+    _concurrency.init(NULL, false);
+    for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+        _calltrace_buffer[i] = NULL;
+        _frame_words[i] = NULL;
+    }
+
+    Error error = _arena.reserve(capacity, args._huge_pages, args._prefault);
+    if (error) {
+        free(saved_frames);
+        free(saved_concurrency);
+        _concurrency.clear();
+        return Error("Not enough memory to allocate profiler buffers (try smaller framebuf or jstackdepth)");
+    }
+
+    _frame_buffer = (u64*)_arena.alloc(REGION_FRAME_BUFFER, frame_buffer_size);
+    _frame_buffer_size = args._framebuf;
+    if (saved_frames != NULL) {
+        memcpy(_frame_buffer, saved_frames, _frame_buffer_index * sizeof(u64));
+        free(saved_frames);
+    }
+
+    for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+        _calltrace_buffer[i] = (CallTraceBuffer*)_arena.alloc(REGION_CALLTRACE_BUFFERS, calltrace_buffer_size);
+        _frame_words[i] = (u64*)_arena.alloc(REGION_CALLTRACE_BUFFERS, frame_words_size);
+    }
+    _max_stack_depth = args._jstackdepth;
+
+    _jfr_buffers = _arena.alloc(REGION_JFR_BUFFERS, jfr_buffer_size);
+    if (args._stack_cache) {
+        _stack_cache_buffer = _arena.alloc(REGION_STACK_CACHE, stack_cache_size);
+    }
+    if (concurrency_log) {
+        _concurrency_buffer = (u64*)_arena.alloc(REGION_CONCURRENCY_LOG, concurrency_log_size);
+        if (saved_concurrency != NULL) {
+            memcpy(_concurrency_buffer, saved_concurrency, _concurrency.size() * sizeof(u64));
+            free(saved_concurrency);
+        }
+    }
+    return Error::OK;
+}
+
 Error Profiler::start(Arguments& args, bool reset) {
     MutexLocker ml(_state_lock);
     if (_state != IDLE) {
@@ -761,54 +1362,56 @@ Error Profiler::start(Arguments& args, bool reset) {
         return error;
     }
 
+    // Options are validated before any state changes, so that a rejected start leaves nothing behind
+    Engine* engine = selectEngine(args._event);
+    CStack cstack = args._cstack == CSTACK_DEFAULT ? engine->cstack() : args._cstack;
+    if (args._thread_pattern != NULL && !VMThread::hasNativeId()) {
+        return Error("threads=PATTERN is not supported on this JVM");
+    }
+    if (cstack == CSTACK_LBR && engine != &perf_events) {
+        return Error("Branch stack is supported only with PMU events");
+    }
+    if (args._concurrency && engine != &wall_clock) {
+        return Error("Concurrency profiling requires wall clock sampling");
+    }
+    // Delays are proportional to the sampling interval, so it must measure CPU time of every thread
+    if (args._causal > 0 && engine != &itimer && !(engine == &perf_events && strcmp(args._event, EVENT_CPU) == 0)) {
+        return Error("Causal profiling requires cpu or itimer sampling");
+    }
+
     if (reset || _start_time == 0) {
         // Reset counters
         _total_samples = 0;
         _total_counter = 0;
         memset(_failures, 0, sizeof(_failures));
+        _hash_collisions = 0;
+        _leaked_frames = 0;
         memset(_hashes, 0, sizeof(_hashes));
         memset(_traces, 0, sizeof(_traces));
-        memset(_methods, 0, sizeof(_methods));
+        _frame_dictionary.clear();
 
-        // Index 0 denotes special call trace with no frames
-        _hashes[0] = (u64)-1;
+        reserveOverflowTraces();
 
         // Reset frame buffer
         _frame_buffer_index = 0;
         _frame_buffer_overflow = false;
+        _frame_dictionary_overflow = false;
 
         // Reset thread filter bitmaps
         _thread_filter.clear();
 
         // Reset thread names and IDs
-        MutexLocker ml(_thread_names_lock);
-        _thread_names.clear();
-        _thread_ids.clear();
-    }
+        _thread_registry.clear();
 
-    // (Re-)allocate frames
-    if (_frame_buffer_size != args._framebuf) {
-        _frame_buffer_size = args._framebuf;
-        _frame_buffer = (ASGCT_CallFrame*)realloc(_frame_buffer, _frame_buffer_size * sizeof(ASGCT_CallFrame));
-        if (_frame_buffer == NULL) {
-            _frame_buffer_size = 0;
-            return Error("Not enough memory to allocate frame buffer (try smaller framebuf)");
-        }
+        _self_profile.reset();
+        _concurrency.clear();
+        _causal.clear();
+        _jit_activity.clear();
     }
 
-    // (Re-)allocate calltrace buffers
-    if (_max_stack_depth != args._jstackdepth) {
-        _max_stack_depth = args._jstackdepth;
-        size_t buffer_size = (_max_stack_depth + MAX_NATIVE_FRAMES + RESERVED_FRAMES) * sizeof(CallTraceBuffer);
-
-        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
-            free(_calltrace_buffer[i]);
-            _calltrace_buffer[i] = (CallTraceBuffer*)malloc(buffer_size);
-            if (_calltrace_buffer[i] == NULL) {
-                _max_stack_depth = 0;
-                return Error("Not enough memory to allocate stack trace buffers (try smaller jstackdepth)");
-            }
-        }
+    error = allocateBuffers(args);
+    if (error) {
+        return error;
     }
 
     updateSymbols(args._ring != RING_USER);
@@ -816,32 +1419,67 @@ Error Profiler::start(Arguments& args, bool reset) {
     _safe_mode = args._safe_mode | (VM::hotspot_version() ? 0 : HOTSPOT_ONLY);
 
     _add_thread_frame = args._threads && args._output != OUTPUT_JFR;
-    _update_thread_names = (args._threads || args._output == OUTPUT_JFR) && VMThread::hasNativeId();
-    _thread_filter.init(args._filter);
-
-    _engine = selectEngine(args._event);
-    _cstack = args._cstack == CSTACK_DEFAULT ? _engine->cstack() : args._cstack;
-    if (_cstack == CSTACK_LBR && _engine != &perf_events) {
-        return Error("Branch stack is supported only with PMU events");
-    }
+    // JFR keeps the context in every event instead
+    _add_context_frame = args._context && args._output != OUTPUT_JFR;
+    // Frame types split otherwise identical stacks, so they are recorded only on request
+    _add_frame_types = (args._style & STYLE_TIERS) != 0;
+    _add_line_numbers = (args._style & STYLE_LINES) != 0;
+    if (args._vm_walk && !_vm_walk) {
+        // Methods compiled before this session have no frame layout yet: replay their load events
+        _vm_walk = true;
+        VM::jvmti()->GenerateEvents(JVMTI_EVENT_COMPILED_METHOD_LOAD);
+    }
+    _vm_walk = args._vm_walk;
+    _stack_cache.init(_stack_cache_buffer, bciMask());
+    _recovery_cache.clear();
+    // Names and groups of Java threads are needed for thread frames, JFR, snapshots and per-thread summary.
+    // Otherwise ThreadStart and ThreadEnd are spared the JVM TI calls
+    _update_thread_names = (args._threads || args._output == OUTPUT_JFR || args._output == OUTPUT_TEXT
+                            || args._output == OUTPUT_SNAPSHOT) && VMThread::hasNativeId();
+    _thread_filter.init(args._filter, args._thread_pattern);
+    selectThreadsByName();
+
+    _engine = engine;
+    _cstack = cstack;
+    _concurrency.init(_concurrency_buffer, args._concurrency);
+    _causal_active = args._causal > 0;
 
     if (args._output == OUTPUT_JFR) {
-        error = _jfr.start(args._file);
+        error = _jfr.start(args._file, _jfr_buffers);
         if (error) {
+            abortStart();
             return error;
         }
     }
 
+    _record_sample = selectRecordSample(args);
+
     error = _engine->start(args);
     if (error) {
-        _jfr.stop();
+        abortStart();
         return error;
     }
 
+    if (_causal_active) {
+        error = startCausal(args);
+        if (error) {
+            _engine->stop();
+            abortStart();
+            return error;
+        }
+    }
+
+    if (args._jit) {
+        startJitActivity();
+    }
+
     // Thread events might be already enabled by PerfEvents::start
     switchThreadEvents(JVMTI_ENABLE);
+    startThreadCpuAccounting();
     switchNativeMethodTraps(true);
 
+    _self_profile.start(args._self_profile, _engine->name());
+
     _state = RUNNING;
     _start_time = time(NULL);
     return Error::OK;
@@ -853,10 +1491,18 @@ Error Profiler::stop() {
         return Error("Profiler is not active");
     }
 
+    if (_causal_active) {
+        stopCausal();
+    }
+    _jit_activity.stop();
     _engine->stop();
+    _self_profile.stop();
+
+    disableVmWalk();
 
     switchNativeMethodTraps(false);
     switchThreadEvents(JVMTI_DISABLE);
+    stopThreadCpuAccounting();
     updateJavaThreadNames();
     updateNativeThreadNames();
 
@@ -865,10 +1511,75 @@ Error Profiler::stop() {
     _jfr.stop();
     for (int i = 0; i < CONCURRENCY_LEVEL; i++) _locks[i].unlock();
 
+    if (_frame_dictionary_overflow) {
+        fprintf(stderr, "WARNING: Frame dictionary overflowed, %lld samples are shown as [frame_dictionary_overflow]\n",
+                _traces[FRAME_DICTIONARY_OVERFLOW_TRACE]._samples);
+    }
+
     _state = IDLE;
     return Error::OK;
 }
 
+// Undoes the session setup done by start() after its checks passed
+void Profiler::abortStart() {
+    _jfr.stop();
+    disableVmWalk();
+    _thread_filter.init(NULL, NULL);
+    _concurrency.init(_concurrency_buffer, false);
+    _causal_active = false;
+}
+
+// Frame layouts are kept only while the VM stack walker is in use
+void Profiler::disableVmWalk() {
+    if (_vm_walk) {
+        _vm_walk = false;
+        _jit_lock.lock();
+        _compiled_methods.clear();
+        _method_ids.clear();
+        _jit_lock.unlock();
+    }
+}
+
+// Progress points are instrumented only while experiments run
+Error Profiler::startCausal(Arguments& args) {
+    _progress_points = args._progress != NULL;
+    if (_progress_points) {
+        Error error = instrument.startProgress(args);
+        if (error) {
+            _progress_points = false;
+            return error;
+        }
+    }
+
+    Error error = _causal.start(args, args._interval ? args._interval : DEFAULT_INTERVAL);
+    if (error && _progress_points) {
+        instrument.stop();
+        _progress_points = false;
+    }
+    return error;
+}
+
+void Profiler::stopCausal() {
+    _causal.stop();
+    if (_progress_points) {
+        instrument.stop();
+        _progress_points = false;
+    }
+}
+
+// Occupancy is counted from the code blobs the profiler already knows about
+void Profiler::startJitActivity() {
+    _jit_lock.lock();
+    u64 code_used = _java_methods.usedSize();
+    _jit_lock.unlock();
+
+    _stubs_lock.lock();
+    code_used += _runtime_stubs.usedSize();
+    _stubs_lock.unlock();
+
+    _jit_activity.start(code_used);
+}
+
 Error Profiler::check(Arguments& args) {
     MutexLocker ml(_state_lock);
     if (_state != IDLE) {
@@ -917,6 +1628,133 @@ void Profiler::dumpSummary(std::ostream& out) {
         double usage = 100.0 * _frame_buffer_index / _frame_buffer_size;
         out << "Frame buffer usage  : " << usage << "%" << std::endl;
     }
+    if (_frame_dictionary_overflow) {
+        out << "Frame dictionary overflowed! " << _traces[FRAME_DICTIONARY_OVERFLOW_TRACE]._samples
+            << " samples have no frames." << std::endl;
+    }
+    if (_hash_collisions > 0) {
+        out << "Hash collisions     : " << _hash_collisions << std::endl;
+    }
+    if (_leaked_frames > 0) {
+        out << "Leaked frames       : " << _leaked_frames << std::endl;
+    }
+    out << std::endl;
+
+    dumpMemoryUsage(out);
+    _self_profile.dump(out);
+    dumpThreadSummary(out);
+}
+
+// Lazily committed tables are counted by their touched parts, the rest by reserved size
+void Profiler::dumpMemoryUsage(std::ostream& out) {
+    char buf[256];
+    out << "--- Memory usage ---" << std::endl;
+
+    for (int i = 0; i < ARENA_REGIONS; i++) {
+        ArenaRegion region = (ArenaRegion)i;
+        snprintf(buf, sizeof(buf), "%-20s: %lld KB\n", Arena::regionName(region), (u64)_arena.regionUsed(region) / 1024);
+        out << buf;
+    }
+
+    // Fixed-size tables are committed lazily, so only the pages touched so far are counted
+    struct {
+        const char* name;
+        size_t size;
+    } tables[] = {
+        {"Call trace tables", Arena::residentSize(_hashes, sizeof(_hashes)) + Arena::residentSize(_traces, sizeof(_traces))},
+        {"Frame dictionary", Arena::residentSize(&_frame_dictionary, sizeof(_frame_dictionary))},
+        {"Compiled scopes", _compiled_methods.memoryUsage()},
+        {"Method IDs", Arena::residentSize(&_method_ids, sizeof(_method_ids))},
+        {"Thread registry", _thread_registry.memoryUsage()},
+        {"Thread filter", _thread_filter.memoryUsage()},
+        {"Contexts", _contexts.memoryUsage()},
+        {"Perf events", PerfEvents::memoryUsage()},
+        {"Causal experiments", _causal.memoryUsage()},
+        {"JIT activity", _jit_activity.memoryUsage()},
+    };
+
+    for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+        snprintf(buf, sizeof(buf), "%-20s: %lld KB\n", tables[i].name, (u64)tables[i].size / 1024);
+        out << buf;
+    }
+
+    snprintf(buf, sizeof(buf), "%-20s: %lld KB%s%s\n", "Arena reserved", (u64)_arena.capacity() / 1024,
+             _arena.hugePages() ? ", huge pages" : "", _arena.prefaulted() ? ", prefaulted" : "");
+    out << buf << std::endl;
+}
+
+// CPU time and sample counts per thread and per thread group.
+// Disproportion between CPU share and sample share of a thread points at sampling bias.
+void Profiler::dumpThreadSummary(std::ostream& out) {
+    std::vector<ThreadRecord> threads;
+    ThreadRecord record;
+    u64 total_cpu = 0;
+    u64 total_samples = 0;
+
+    for (int i = 0; i < _thread_registry.capacity(); i++) {
+        if (_thread_registry.getAt(i, &record) && (record._cpu_time != 0 || record._samples != 0)) {
+            threads.push_back(record);
+            total_cpu += record._cpu_time;
+            total_samples += record._samples;
+        }
+    }
+
+    if (threads.empty()) {
+        return;
+    }
+
+    qsort(&threads[0], threads.size(), sizeof(ThreadRecord), ThreadRecord::comparator);
+
+    double cpu_percent = total_cpu != 0 ? 100.0 / total_cpu : 0;
+    double samples_percent = total_samples != 0 ? 100.0 / total_samples : 0;
+    char buf[256];
+
+    out << "--- Threads by CPU time ---" << std::endl;
+    snprintf(buf, sizeof(buf), "%12s %8s %10s %8s %8s  %s\n", "cpu_ms", "cpu%", "samples", "samples%", "tid", "name");
+    out << buf;
+
+    std::map<std::string, ThreadRecord> groups;
+    for (size_t i = 0; i < threads.size(); i++) {
+        ThreadRecord& t = threads[i];
+        if (i < MAX_SUMMARY_THREADS) {
+            char tid_name[32];
+            if (t._name[0] == 0) sprintf(tid_name, "[tid=%d]", t._tid);
+            snprintf(buf, sizeof(buf), "%12.1f %7.2f%% %10lld %7.2f%% %8d  %s\n",
+                     t._cpu_time / 1e6, t._cpu_time * cpu_percent, t._samples, t._samples * samples_percent,
+                     t._tid, t._name[0] != 0 ? t._name : tid_name);
+            out << buf;
+        }
+
+        // Reuse ThreadRecord as a group accumulator: _tid counts threads
+        const char* group_name = t._group[0] != 0 ? t._group : t._java_thread_id != 0 ? "[unknown]" : "[native]";
+        ThreadRecord& group = groups[group_name];
+        group._tid++;
+        group._cpu_time += t._cpu_time;
+        group._samples += t._samples;
+    }
+    if (threads.size() > MAX_SUMMARY_THREADS) {
+        out << "... " << (threads.size() - MAX_SUMMARY_THREADS) << " more threads" << std::endl;
+    }
+    out << std::endl;
+
+    std::vector<ThreadRecord> group_list;
+    for (std::map<std::string, ThreadRecord>::iterator it = groups.begin(); it != groups.end(); ++it) {
+        ThreadRecord& group = it->second;
+        strncpy(group._name, it->first.c_str(), sizeof(group._name) - 1);
+        group_list.push_back(group);
+    }
+    qsort(&group_list[0], group_list.size(), sizeof(ThreadRecord), ThreadRecord::comparator);
+
+    out << "--- Thread groups by CPU time ---" << std::endl;
+    snprintf(buf, sizeof(buf), "%12s %8s %10s %8s %8s  %s\n", "cpu_ms", "cpu%", "samples", "samples%", "threads", "group");
+    out << buf;
+    for (size_t i = 0; i < group_list.size(); i++) {
+        ThreadRecord& g = group_list[i];
+        snprintf(buf, sizeof(buf), "%12.1f %7.2f%% %10lld %7.2f%% %8d  %s\n",
+                 g._cpu_time / 1e6, g._cpu_time * cpu_percent, g._samples, g._samples * samples_percent,
+                 g._tid, g._name);
+        out << buf;
+    }
     out << std::endl;
 }
 
@@ -929,28 +1767,44 @@ void Profiler::dumpCollapsed(std::ostream& out, Arguments& args) {
     MutexLocker ml(_state_lock);
     if (_state != IDLE || _engine == NULL) return;
 
-    FrameName fn(args, args._style, _thread_names_lock, _thread_names);
-    u64 unknown = 0;
+    FrameName fn(args, args._style, _thread_registry);
 
     for (int i = 0; i < MAX_CALLTRACES; i++) {
         CallTraceSample& trace = _traces[i];
         if (trace._samples == 0 || excludeTrace(&fn, &trace)) continue;
 
         if (trace._num_frames == 0) {
-            unknown += (args._counter == COUNTER_SAMPLES ? trace._samples : trace._counter);
+            out << overflowFrame(&trace) << ' ' << (args._counter == COUNTER_SAMPLES ? trace._samples : trace._counter) << "\n";
             continue;
         }
 
         for (int j = trace._num_frames - 1; j >= 0; j--) {
-            const char* frame_name = fn.name(_frame_buffer[trace._start_frame + j]);
+            const char* frame_name = fn.name(frameAt(trace._start_frame + j));
             out << frame_name << (j == 0 ? ' ' : ';');
         }
         out << (args._counter == COUNTER_SAMPLES ? trace._samples : trace._counter) << "\n";
     }
+}
+
+// The average number of threads goes before the frame type suffix, which FlameGraph expects last
+std::string Profiler::flameGraphFrame(FrameName& fn, FrameName& plain_fn,
+                                      std::map<std::string, ConcurrencyStats>& concurrency, int index) {
+    ASGCT_CallFrame frame = frameAt(index);
+    std::string name = fn.name(frame);
+    if (concurrency.empty()) {
+        return name;
+    }
 
-    if (unknown != 0) {
-        out << "[frame_buffer_overflow] " << unknown << "\n";
+    if (!_add_line_numbers && frame.bci >= 0) frame.bci = 0;
+    std::map<std::string, ConcurrencyStats>::iterator it = concurrency.find(plain_fn.name(frame));
+    if (it == concurrency.end()) {
+        return name;
     }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), " [%.1f threads]", it->second.average());
+    size_t pos = name.length() >= 4 && name.compare(name.length() - 4, 2, "_[") == 0 ? name.length() - 4 : name.length();
+    return name.insert(pos, buf);
 }
 
 void Profiler::dumpFlameGraph(std::ostream& out, Arguments& args, bool tree) {
@@ -958,7 +1812,15 @@ void Profiler::dumpFlameGraph(std::ostream& out, Arguments& args, bool tree) {
     if (_state != IDLE || _engine == NULL) return;
 
     FlameGraph flamegraph(args._title, args._counter, args._width, args._height, args._minwidth, args._reverse);
-    FrameName fn(args, args._style, _thread_names_lock, _thread_names);
+    // Annotations are always on: FlameGraph strips them off and uses for coloring frames by type
+    FrameName fn(args, args._style | STYLE_ANNOTATE, _thread_registry);
+
+    // After a concurrency profile, frames also show how many threads were running them on average
+    FrameName plain_fn(args, args._style & ~STYLE_ANNOTATE, _thread_registry);
+    std::map<std::string, ConcurrencyStats> concurrency;
+    if (_concurrency.size() > 0) {
+        buildConcurrencyStats(plain_fn, concurrency);
+    }
 
     for (int i = 0; i < MAX_CALLTRACES; i++) {
         CallTraceSample& trace = _traces[i];
@@ -969,22 +1831,22 @@ void Profiler::dumpFlameGraph(std::ostream& out, Arguments& args, bool tree) {
 
         Trie* f = flamegraph.root();
         if (num_frames == 0) {
-            f = f->addChild("[frame_buffer_overflow]", samples);
+            f = f->addChild(overflowFrame(&trace), samples);
         } else if (args._reverse) {
-            if (_add_thread_frame) {
-                // Thread frames always come first
+            // Context and thread frames always come first
+            while (num_frames > 0 && isRootFrame(frameAt(trace._start_frame + num_frames - 1))) {
                 num_frames--;
-                const char* frame_name = fn.name(_frame_buffer[trace._start_frame + num_frames]);
+                std::string frame_name = flameGraphFrame(fn, plain_fn, concurrency, trace._start_frame + num_frames);
                 f = f->addChild(frame_name, samples);
             }
 
             for (int j = 0; j < num_frames; j++) {
-                const char* frame_name = fn.name(_frame_buffer[trace._start_frame + j]);
+                std::string frame_name = flameGraphFrame(fn, plain_fn, concurrency, trace._start_frame + j);
                 f = f->addChild(frame_name, samples);
             }
         } else {
             for (int j = num_frames - 1; j >= 0; j--) {
-                const char* frame_name = fn.name(_frame_buffer[trace._start_frame + j]);
+                std::string frame_name = flameGraphFrame(fn, plain_fn, concurrency, trace._start_frame + j);
                 f = f->addChild(frame_name, samples);
             }
         }
@@ -998,7 +1860,7 @@ void Profiler::dumpTraces(std::ostream& out, Arguments& args) {
     MutexLocker ml(_state_lock);
     if (_state != IDLE || _engine == NULL) return;
 
-    FrameName fn(args, args._style | STYLE_DOTTED, _thread_names_lock, _thread_names);
+    FrameName fn(args, args._style | STYLE_DOTTED, _thread_registry);
     double percent = 100.0 / _total_counter;
     char buf[1024] = {0};
 
@@ -1020,11 +1882,11 @@ void Profiler::dumpTraces(std::ostream& out, Arguments& args) {
         out << buf;
 
         if (trace->_num_frames == 0) {
-            out << "  [ 0] [frame_buffer_overflow]\n";
+            out << "  [ 0] " << overflowFrame(trace) << "\n";
         }
 
         for (int j = 0; j < trace->_num_frames; j++) {
-            const char* frame_name = fn.name(_frame_buffer[trace->_start_frame + j]);
+            const char* frame_name = fn.name(frameAt(trace->_start_frame + j));
             snprintf(buf, sizeof(buf) - 1, "  [%2d] %s\n", j, frame_name);
             out << buf;
         }
@@ -1034,36 +1896,237 @@ void Profiler::dumpTraces(std::ostream& out, Arguments& args) {
     delete[] traces;
 }
 
+// Flat profile rows are looked up by frame name, since with line numbers
+// several bytecodes of the same source line are merged into a single row
+static int flatRow(std::vector<FlatRow>& rows, std::map<std::string, int>& row_index, const char* name) {
+    std::map<std::string, int>::iterator it = row_index.find(name);
+    if (it != row_index.end()) {
+        return it->second;
+    }
+
+    FlatRow row;
+    row._name = name;
+    row._self_samples = row._self_counter = row._total_samples = row._total_counter = 0;
+    row._last_trace = -1;
+    rows.push_back(row);
+    return row_index[name] = (int)rows.size() - 1;
+}
+
+// Self time is attributed to the top frame of every trace; total time to every method
+// found in the trace, but only once, so that recursive calls are not counted repeatedly
 void Profiler::dumpFlat(std::ostream& out, Arguments& args) {
     MutexLocker ml(_state_lock);
     if (_state != IDLE || _engine == NULL) return;
 
-    FrameName fn(args, args._style | STYLE_DOTTED, _thread_names_lock, _thread_names);
+    FrameName fn(args, args._style | STYLE_DOTTED, _thread_registry);
     double percent = 100.0 / _total_counter;
     char buf[1024] = {0};
 
-    MethodSample** methods = new MethodSample*[MAX_CALLTRACES];
+    std::vector<FlatRow> rows;
+    std::map<std::string, int> row_index;
+    std::map<u64, int> frame_rows;
+
     for (int i = 0; i < MAX_CALLTRACES; i++) {
-        methods[i] = &_methods[i];
+        CallTraceSample& trace = _traces[i];
+        if (trace._samples == 0) continue;
+
+        if (trace._num_frames == 0) {
+            FlatRow& row = rows[flatRow(rows, row_index, overflowFrame(&trace))];
+            row._self_samples += trace._samples;
+            row._self_counter += trace._counter;
+            row._total_samples += trace._samples;
+            row._total_counter += trace._counter;
+            continue;
+        }
+
+        for (int j = 0; j < trace._num_frames; j++) {
+            u64 word = _frame_buffer[trace._start_frame + j];
+            ASGCT_CallFrame frame = _frame_dictionary.decode(word);
+            if (isRootFrame(frame)) continue;
+
+            // Without line numbers, the flat profile is per method regardless of bci and frame type.
+            // Negative bci of special frames tells how to interpret method_id and must be kept.
+            if (!_add_line_numbers && frame.bci >= 0) {
+                frame.bci = 0;
+                word = (u32)word;
+            }
+
+            int index;
+            std::map<u64, int>::iterator it = frame_rows.find(word);
+            if (it != frame_rows.end()) {
+                index = it->second;
+            } else {
+                index = frame_rows[word] = flatRow(rows, row_index, fn.name(frame));
+            }
+
+            FlatRow& row = rows[index];
+            if (j == 0) {
+                row._self_samples += trace._samples;
+                row._self_counter += trace._counter;
+            }
+            if (row._last_trace != i) {
+                row._last_trace = i;
+                row._total_samples += trace._samples;
+                row._total_counter += trace._counter;
+            }
+        }
     }
-    qsort(methods, MAX_CALLTRACES, sizeof(MethodSample*), MethodSample::comparator);
 
-    snprintf(buf, sizeof(buf) - 1, "%12s  percent  samples  top\n"
-                                   "  ----------  -------  -------  ---\n", _engine->units());
+    std::vector<FlatRow*> sorted;
+    for (size_t i = 0; i < rows.size(); i++) {
+        sorted.push_back(&rows[i]);
+    }
+    if (!sorted.empty()) {
+        qsort(&sorted[0], sorted.size(), sizeof(FlatRow*), FlatRow::comparator);
+    }
+
+    snprintf(buf, sizeof(buf) - 1, "%12s  percent  samples  %12s  percent  top\n"
+                                   "  ----------  -------  -------    ----------  -------  ---\n",
+             _engine->units(), "total");
     out << buf;
 
-    int max_methods = args._dump_flat < MAX_CALLTRACES ? args._dump_flat : MAX_CALLTRACES;
-    for (int i = 0; i < max_methods; i++) {
-        MethodSample* method = methods[i];
-        if (method->_samples == 0) break;
+    size_t max_methods = args._dump_flat < (int)sorted.size() ? args._dump_flat : sorted.size();
+    for (size_t i = 0; i < max_methods; i++) {
+        FlatRow* row = sorted[i];
+        snprintf(buf, sizeof(buf) - 1, "%12lld  %6.2f%%  %7lld  %12lld  %6.2f%%  %s\n",
+                 row->_self_counter, row->_self_counter * percent, row->_self_samples,
+                 row->_total_counter, row->_total_counter * percent, row->_name.c_str());
+        out << buf;
+    }
+}
 
-        const char* frame_name = fn.name(method->_method);
-        snprintf(buf, sizeof(buf) - 1, "%12lld  %6.2f%%  %7lld  %s\n",
-                 method->_counter, method->_counter * percent, method->_samples, frame_name);
+// Groups logged samples by tick and counts, for every frame, how many threads had it
+// on their stacks at the same tick. A recursive frame counts once per thread
+void Profiler::buildConcurrencyStats(FrameName& fn, std::map<std::string, ConcurrencyStats>& stats) {
+    int count = _concurrency.size();
+    u64* samples = new u64[count];
+    _concurrency.sorted(samples);
+
+    // Per trace: distinct frame names, resolved on first use
+    std::map<int, std::vector<ConcurrencyStats*> > trace_stats;
+    std::map<ConcurrencyStats*, int> tick_threads;
+
+    for (int i = 0; i <= count; i++) {
+        if (i == count || (i > 0 && samples[i] >> 32 != samples[i - 1] >> 32)) {
+            // End of tick
+            for (std::map<ConcurrencyStats*, int>::iterator it = tick_threads.begin(); it != tick_threads.end(); ++it) {
+                it->first->add(it->second);
+            }
+            tick_threads.clear();
+            if (i == count) break;
+        }
+
+        int call_trace_id = (int)(u32)samples[i];
+        std::map<int, std::vector<ConcurrencyStats*> >::iterator it = trace_stats.find(call_trace_id);
+        if (it == trace_stats.end()) {
+            it = trace_stats.insert(std::make_pair(call_trace_id, std::vector<ConcurrencyStats*>())).first;
+            CallTraceSample& trace = _traces[call_trace_id];
+            for (int j = 0; j < trace._num_frames; j++) {
+                ASGCT_CallFrame frame = frameAt(trace._start_frame + j);
+                if (isRootFrame(frame)) continue;
+                if (!_add_line_numbers && frame.bci >= 0) frame.bci = 0;
+
+                std::string name = fn.name(frame);
+                std::map<std::string, ConcurrencyStats>::iterator s = stats.find(name);
+                if (s == stats.end()) {
+                    ConcurrencyStats empty;
+                    memset(&empty, 0, sizeof(empty));
+                    s = stats.insert(std::make_pair(name, empty)).first;
+                }
+
+                std::vector<ConcurrencyStats*>& frames = it->second;
+                if (std::find(frames.begin(), frames.end(), &s->second) == frames.end()) {
+                    frames.push_back(&s->second);
+                }
+            }
+        }
+
+        for (size_t j = 0; j < it->second.size(); j++) {
+            tick_threads[it->second[j]]++;
+        }
+    }
+
+    delete[] samples;
+}
+
+static void printConcurrencyTable(std::ostream& out, const char* title, std::vector<ConcurrencyStats*>& sorted,
+                                  std::map<const ConcurrencyStats*, const char*>& names, size_t max_frames) {
+    char buf[1024] = {0};
+    out << title << std::endl;
+    snprintf(buf, sizeof(buf) - 1, "%10s  %8s  %6s  %4s  %7s %7s %7s %7s %7s %7s  frame\n",
+             "samples", "ticks", "avg", "max", "1", "2", "3-4", "5-8", "9-16", "17+");
+    out << buf;
+
+    if (max_frames > sorted.size()) max_frames = sorted.size();
+    for (size_t i = 0; i < max_frames; i++) {
+        ConcurrencyStats* s = sorted[i];
+        snprintf(buf, sizeof(buf) - 1, "%10lld  %8lld  %6.2f  %4d  %7lld %7lld %7lld %7lld %7lld %7lld  %s\n",
+                 s->_samples, s->_ticks, s->average(), s->_max,
+                 s->_histogram[0], s->_histogram[1], s->_histogram[2],
+                 s->_histogram[3], s->_histogram[4], s->_histogram[5], names[s]);
         out << buf;
     }
+    out << std::endl;
+}
 
-    delete[] methods;
+// Frames ordered by the total number of samples, together with how many threads
+// were running each frame at the same time. A second table ranks frames by ticks
+// divided by average parallelism, which brings up long frames that few threads share:
+// these are effectively serialized
+void Profiler::dumpConcurrency(std::ostream& out, Arguments& args) {
+    MutexLocker ml(_state_lock);
+    if (_state != IDLE || _engine == NULL) return;
+
+    FrameName fn(args, args._style | STYLE_DOTTED, _thread_registry);
+
+    std::map<std::string, ConcurrencyStats> stats;
+    buildConcurrencyStats(fn, stats);
+
+    std::vector<ConcurrencyStats*> sorted;
+    std::map<const ConcurrencyStats*, const char*> names;
+    for (std::map<std::string, ConcurrencyStats>::iterator it = stats.begin(); it != stats.end(); ++it) {
+        sorted.push_back(&it->second);
+        names[&it->second] = it->first.c_str();
+    }
+
+    if (_concurrency.overflow()) {
+        out << "Concurrency log overflowed! Later ticks are missing." << std::endl;
+    }
+
+    if (!sorted.empty()) {
+        qsort(&sorted[0], sorted.size(), sizeof(ConcurrencyStats*), ConcurrencyStats::comparator);
+    }
+    printConcurrencyTable(out, "--- Concurrency ---", sorted, names, args._dump_flat);
+
+    if (!sorted.empty()) {
+        qsort(&sorted[0], sorted.size(), sizeof(ConcurrencyStats*), ConcurrencyStats::serialComparator);
+    }
+    printConcurrencyTable(out, "--- Serialized frames ---", sorted, names, args._dump_flat);
+}
+
+// Predicted effect of optimizing methods measured by causal profiling experiments
+void Profiler::dumpCausal(std::ostream& out, Arguments& args) {
+    MutexLocker ml(_state_lock);
+    if (_state != IDLE || _engine == NULL) return;
+
+    FrameName fn(args, args._style | STYLE_DOTTED, _thread_registry);
+    _causal.dump(out, fn, args._dump_flat > 0 ? args._dump_flat : INT_MAX);
+}
+
+// Compilations, deoptimization loops and code cache usage seen while profiling
+void Profiler::dumpJitActivity(std::ostream& out, Arguments& args) {
+    MutexLocker ml(_state_lock);
+    if (_state != IDLE || _engine == NULL) return;
+
+    FrameName fn(args, args._style | STYLE_DOTTED, _thread_registry);
+    _jit_activity.dump(out, fn, args._dump_flat > 0 ? args._dump_flat : DEFAULT_JIT_METHODS);
+}
+
+void Profiler::dumpSnapshot(std::ostream& out) {
+    MutexLocker ml(_state_lock);
+    if (_state != IDLE || _engine == NULL) return;
+
+    Snapshot::write(out);
 }
 
 void Profiler::runInternal(Arguments& args, std::ostream& out) {
@@ -1112,6 +2175,7 @@ void Profiler::runInternal(Arguments& args, std::ostream& out) {
             out << "  " << EVENT_LOCK << std::endl;
             out << "  " << EVENT_WALL << std::endl;
             out << "  " << EVENT_ITIMER << std::endl;
+            out << "  " << EVENT_EXCEPTIONS << std::endl;
 
             out << "Java method calls:" << std::endl;
             out << "  ClassName.methodName" << std::endl;
@@ -1150,6 +2214,12 @@ void Profiler::runInternal(Arguments& args, std::ostream& out) {
                     dumpSummary(out);
                     if (args._dump_traces > 0) dumpTraces(out, args);
                     if (args._dump_flat > 0) dumpFlat(out, args);
+                    if (args._dump_flat > 0 && _concurrency.size() > 0) dumpConcurrency(out, args);
+                    if (_causal.experiments() > 0) dumpCausal(out, args);
+                    if (_jit_activity.hasData()) dumpJitActivity(out, args);
+                    break;
+                case OUTPUT_SNAPSHOT:
+                    dumpSnapshot(out);
                     break;
                 default:
                     break;
@@ -1160,6 +2230,38 @@ void Profiler::runInternal(Arguments& args, std::ostream& out) {
     }
 }
 
+// Unlike runInternal, dumps all output formats to the given stream regardless of the 'file' option.
+// JFR recording is written to the file while profiling, so its complete contents are copied after the dump.
+Error Profiler::runToStream(Arguments& args, std::ostream& out) {
+    bool copy_jfr = args._output == OUTPUT_JFR && args._action == ACTION_DUMP;
+    if (copy_jfr && args._file == NULL) {
+        return Error("JFR dump requires the file specified at start");
+    }
+
+    runInternal(args, out);
+
+    if (copy_jfr) {
+        int fd = open(args._file, O_RDONLY);
+        if (fd == -1) {
+            return Error(strerror(errno));
+        }
+
+        char buf[16384];
+        ssize_t bytes;
+        while ((bytes = read(fd, buf, sizeof(buf))) > 0 && out.good()) {
+            out.write(buf, bytes);
+        }
+        close(fd);
+
+        if (bytes < 0) {
+            return Error(strerror(errno));
+        }
+    }
+
+    out.flush();
+    return Error::OK;
+}
+
 void Profiler::run(Arguments& args) {
     if (args._file == NULL || args._output == OUTPUT_JFR) {
         runInternal(args, std::cout);
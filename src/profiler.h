@@ -19,15 +19,27 @@
 
 #include <iostream>
 #include <map>
+#include <string>
 #include <time.h>
 #include "arch.h"
+#include "arena.h"
 #include "arguments.h"
+#include "causal.h"
+#include "jitActivity.h"
 #include "codeCache.h"
+#include "compiledMethods.h"
+#include "concurrency.h"
+#include "context.h"
 #include "engine.h"
+#include "frameDictionary.h"
 #include "flightRecorder.h"
 #include "mutex.h"
+#include "recoveryCache.h"
+#include "selfProfile.h"
 #include "spinLock.h"
+#include "stackCache.h"
 #include "threadFilter.h"
+#include "threadRegistry.h"
 #include "vmEntry.h"
 
 
@@ -40,6 +52,13 @@ const int MAX_NATIVE_FRAMES = 128;
 const int RESERVED_FRAMES   = 4;
 const int MAX_NATIVE_LIBS   = 2048;
 const int CONCURRENCY_LEVEL = 16;
+const int MAX_SUMMARY_THREADS = 20;
+const int MAX_PUBLISH_SPINS = 1000;
+
+// Reserved call trace slots with no frames, for samples whose frames could not be stored
+const int FRAME_BUFFER_OVERFLOW_TRACE     = 0;
+const int FRAME_DICTIONARY_OVERFLOW_TRACE = 1;
+const int RESERVED_TRACES                 = 2;
 
 
 static inline int cmp64(u64 a, u64 b) {
@@ -75,20 +94,26 @@ class CallTraceSample {
 
     friend class Profiler;
     friend class Recording;
+    friend class Snapshot;
 };
 
-class MethodSample {
-  private:
-    u64 _samples;
-    u64 _counter;
-    ASGCT_CallFrame _method;
-
+// Row of the flat profile, built at dump time from the call trace table
+class FlatRow {
   public:
+    std::string _name;
+    u64 _self_samples;
+    u64 _self_counter;
+    u64 _total_samples;
+    u64 _total_counter;
+    int _last_trace;
+
+    // By self time, then by total time for methods that are never on top
     static int comparator(const void* s1, const void* s2) {
-        return cmp64((*(MethodSample**)s2)->_counter, (*(MethodSample**)s1)->_counter);
+        const FlatRow* r1 = *(const FlatRow**)s1;
+        const FlatRow* r2 = *(const FlatRow**)s2;
+        int result = cmp64(r2->_self_counter, r1->_self_counter);
+        return result != 0 ? result : cmp64(r2->_total_counter, r1->_total_counter);
     }
-
-    friend class Profiler;
 };
 
 
@@ -103,14 +128,40 @@ enum State {
     TERMINATED
 };
 
+// Configuration of the sampling path that stays the same during a profiling session.
+// Signal-driven sessions that use only the flags in SAMPLE_SPECIALIZED get a variant
+// compiled for their flags; other sessions share the generic variant, which checks them at run time
+enum SampleFlags {
+    SAMPLE_CSTACK        = 1,
+    SAMPLE_VM_WALK       = 2,
+    SAMPLE_THREAD_FILTER = 4,
+    SAMPLE_STACK_CACHE   = 8,
+    SAMPLE_THREAD_FRAME  = 16,
+    SAMPLE_CONTEXT_FRAME = 32,
+    SAMPLE_JFR           = 64,
+    SAMPLE_SPECIALIZED   = 127,
+    SAMPLE_SELF_PROFILE  = 128,
+    SAMPLE_CONCURRENCY   = 256,
+    SAMPLE_CAUSAL        = 512,
+    SAMPLE_JVM_EVENTS    = 1024,  // samples of JVM events (allocations, locks, exceptions, instrumented methods)
+    SAMPLE_GENERIC       = 2048   // marks the generic variant
+};
+
+template <int FLAGS, int BIT>
+struct RecordSampleVariant;
+template <int FLAGS, bool USABLE>
+struct RecordSampleLeaf;
+
 class Profiler {
   private:
+    typedef void (*RecordSampleFunc)(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state, u32 tick);
+
     Mutex _state_lock;
     State _state;
-    Mutex _thread_names_lock;
-    std::map<int, std::string> _thread_names;
-    std::map<jlong, int> _thread_ids;
+    ThreadRegistry _thread_registry;
     ThreadFilter _thread_filter;
+    ContextStorage _contexts;
+    SelfProfile _self_profile;
     FlightRecorder _jfr;
     Engine* _engine;
     time_t _start_time;
@@ -118,27 +169,52 @@ class Profiler {
     u64 _total_samples;
     u64 _total_counter;
     u64 _failures[ASGCT_FAILURE_TYPES];
+    u64 _hash_collisions;
+    u64 _leaked_frames;
     u64 _hashes[MAX_CALLTRACES];
     CallTraceSample _traces[MAX_CALLTRACES];
-    MethodSample _methods[MAX_CALLTRACES];
+    FrameDictionary _frame_dictionary;
 
     SpinLock _locks[CONCURRENCY_LEVEL];
+    Arena _arena;
+    void* _jfr_buffers;
+    void* _stack_cache_buffer;
+    u64* _concurrency_buffer;
+    StackCache _stack_cache;
+    RecoveryCache _recovery_cache;
+    ConcurrencyLog _concurrency;
+    CausalProfiler _causal;
+    JitActivity _jit_activity;
     CallTraceBuffer* _calltrace_buffer[CONCURRENCY_LEVEL];
-    ASGCT_CallFrame* _frame_buffer;
+    u64* _frame_words[CONCURRENCY_LEVEL];
+    u64* _frame_buffer;
     int _frame_buffer_size;
     int _max_stack_depth;
     int _safe_mode;
     CStack _cstack;
     volatile int _frame_buffer_index;
     bool _frame_buffer_overflow;
+    bool _frame_dictionary_overflow;
     bool _add_thread_frame;
+    bool _add_context_frame;
+    bool _add_line_numbers;
+    bool _add_frame_types;
     bool _update_thread_names;
     volatile bool _thread_events_state;
 
     SpinLock _jit_lock;
     SpinLock _stubs_lock;
-    CodeCache _java_methods;
+    JavaCodeCache _java_methods;
+    CompiledMethodMap _compiled_methods;
+    MethodIdMap _method_ids;
     NativeCodeCache _runtime_stubs;
+    const void* _interpreter_start;
+    const void* _interpreter_end;
+    bool _vm_walk;
+    bool _causal_active;
+    bool _progress_points;
+    int _sample_flags;
+    RecordSampleFunc _record_sample;
     NativeCodeCache* _native_libs[MAX_NATIVE_LIBS];
     volatile int _native_lib_count;
 
@@ -155,7 +231,7 @@ class Profiler {
 
     void switchNativeMethodTraps(bool enable);
 
-    void addJavaMethod(const void* address, int length, jmethodID method);
+    void addJavaMethod(const void* address, int length, jmethodID method, const void* compile_info);
     void removeJavaMethod(const void* address, jmethodID method);
     void addRuntimeStub(const void* address, int length, const char* name);
 
@@ -165,31 +241,92 @@ class Profiler {
     const char* asgctError(int code);
     int getNativeTrace(void* ucontext, ASGCT_CallFrame* frames, int tid);
     int getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max_depth);
+    int getJavaTraceVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth);
+    void addMethodIds(ASGCT_CallFrame* frames, int num_frames);
     int getJavaTraceJvmti(jvmtiFrameInfo* jvmti_frames, ASGCT_CallFrame* frames, int max_depth);
     int makeEventFrame(ASGCT_CallFrame* frames, jint event_type, jmethodID event);
+
+    // Specialized variants know the flags at compile time, the generic one checks them at run time
+    template <int FLAGS>
+    bool sampleFlag(int flag) {
+        return FLAGS == SAMPLE_GENERIC ? (_sample_flags & flag) != 0 : (FLAGS & flag) != 0;
+    }
+
+    template <int FLAGS>
+    void recordSampleImpl(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state, u32 tick);
+    template <int FLAGS>
+    static void recordSampleEntry(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state, u32 tick);
+    static void dropSample(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state, u32 tick);
+    RecordSampleFunc selectRecordSample(Arguments& args);
+
+    // Synthetic frames appended below the bottom Java frame
+    static bool isRootFrame(const ASGCT_CallFrame& frame) {
+        return frame.bci == BCI_THREAD_ID || frame.bci == BCI_CONTEXT_TAG;
+    }
     bool fillTopFrame(const void* pc, ASGCT_CallFrame* frame);
+    void fillFrameTypes(const void* pc, ASGCT_CallFrame* frames, int num_frames);
     AddressType getAddressType(instruction_t* pc);
+    u32 bciMask();
     u64 hashCallTrace(int num_frames, ASGCT_CallFrame* frames);
-    int storeCallTrace(int num_frames, ASGCT_CallFrame* frames, u64 counter);
-    void copyToFrameBuffer(int num_frames, ASGCT_CallFrame* frames, CallTraceSample* trace);
-    u64 hashMethod(jmethodID method);
-    void storeMethod(jmethodID method, jint bci, u64 counter);
-    void setThreadInfo(int tid, const char* name, jlong java_thread_id);
-    void updateThreadName(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread);
+    int storeCallTrace(int num_frames, ASGCT_CallFrame* frames, u64* words, u64 counter, u64 hash);
+    int storeCallTrace(int num_frames, ASGCT_CallFrame* frames, u64* words, u64 counter) {
+        return storeCallTrace(num_frames, frames, words, counter, hashCallTrace(num_frames, frames));
+    }
+    int findCallTrace(int num_frames, const u64* words, u64 hash);
+    bool matchCallTrace(CallTraceSample* trace, int num_frames, const u64* words, u64 word_mask);
+    int reserveFrames(int num_frames);
+    void releaseFrames(int start_frame, int num_frames);
+    void copyToFrameBuffer(int num_frames, const u64* words, int start_frame, CallTraceSample* trace);
+    bool encodeFrames(int num_frames, ASGCT_CallFrame* frames, u64* words);
+    bool encodeFrame(const ASGCT_CallFrame& frame, u64* word);
+    ASGCT_CallFrame frameAt(int index) { return _frame_dictionary.decode(_frame_buffer[index]); }
+    void reserveOverflowTraces() {
+        for (int i = 0; i < RESERVED_TRACES; i++) _hashes[i] = (u64)-1;
+    }
+    const char* overflowFrame(const CallTraceSample* trace) {
+        return trace == &_traces[FRAME_DICTIONARY_OVERFLOW_TRACE] ? "[frame_dictionary_overflow]" : "[frame_buffer_overflow]";
+    }
+    void updateThreadName(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread, bool renamed = false);
     void updateJavaThreadNames();
     void updateNativeThreadNames();
+    void selectThreadsByName();
+    void startThreadCpuAccounting();
+    void stopThreadCpuAccounting();
+    void dumpMemoryUsage(std::ostream& out);
+    void dumpThreadSummary(std::ostream& out);
+    void abortStart();
+    void disableVmWalk();
+    Error startCausal(Arguments& args);
+    void stopCausal();
+    void startJitActivity();
     bool excludeTrace(FrameName* fn, CallTraceSample* trace);
+    void buildConcurrencyStats(FrameName& fn, std::map<std::string, ConcurrencyStats>& stats);
+    std::string flameGraphFrame(FrameName& fn, FrameName& plain_fn,
+                                std::map<std::string, ConcurrencyStats>& concurrency, int index);
     Engine* selectEngine(const char* event_name);
     Error checkJvmCapabilities();
+    Error allocateBuffers(Arguments& args);
 
   public:
     static Profiler _instance;
 
     Profiler() :
         _state(IDLE),
+        _thread_registry(),
         _thread_filter(),
+        _contexts(),
+        _self_profile(CONCURRENCY_LEVEL),
         _jfr(),
         _start_time(0),
+        _arena(),
+        _jfr_buffers(NULL),
+        _stack_cache_buffer(NULL),
+        _concurrency_buffer(NULL),
+        _stack_cache(),
+        _recovery_cache(),
+        _concurrency(),
+        _causal(),
+        _jit_activity(),
         _frame_buffer(NULL),
         _frame_buffer_size(0),
         _max_stack_depth(0),
@@ -198,12 +335,21 @@ class Profiler {
         _jit_lock(),
         _stubs_lock(),
         _java_methods(),
+        _compiled_methods(),
         _runtime_stubs("[stubs]"),
+        _interpreter_start(NULL),
+        _interpreter_end(NULL),
+        _vm_walk(false),
+        _causal_active(false),
+        _progress_points(false),
+        _sample_flags(0),
+        _record_sample(dropSample),
         _native_lib_count(0),
         _original_NativeLibrary_load(NULL) {
 
         for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
             _calltrace_buffer[i] = NULL;
+            _frame_words[i] = NULL;
         }
     }
 
@@ -212,9 +358,14 @@ class Profiler {
     time_t uptime()     { return time(NULL) - _start_time; }
 
     ThreadFilter* threadFilter() { return &_thread_filter; }
+    ContextStorage* contexts() { return &_contexts; }
+    SelfProfile* selfProfile() { return &_self_profile; }
+    ConcurrencyLog* concurrency() { return &_concurrency; }
+    CausalProfiler* causal() { return &_causal; }
 
     void run(Arguments& args);
     void runInternal(Arguments& args, std::ostream& out);
+    Error runToStream(Arguments& args, std::ostream& out);
     void shutdown(Arguments& args);
     Error check(Arguments& args);
     Error start(Arguments& args, bool reset);
@@ -225,7 +376,17 @@ class Profiler {
     void dumpFlameGraph(std::ostream& out, Arguments& args, bool tree);
     void dumpTraces(std::ostream& out, Arguments& args);
     void dumpFlat(std::ostream& out, Arguments& args);
-    void recordSample(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state = THREAD_RUNNING);
+    void dumpConcurrency(std::ostream& out, Arguments& args);
+    void dumpCausal(std::ostream& out, Arguments& args);
+    void dumpJitActivity(std::ostream& out, Arguments& args);
+    void dumpSnapshot(std::ostream& out);
+
+    // Dispatches to the variant of the sampling path chosen when profiling started.
+    // The tick is that of the wall clock burst the sample belongs to, in concurrency mode
+    void recordSample(void* ucontext, u64 counter, jint event_type, jmethodID event,
+                      ThreadState thread_state = THREAD_RUNNING, u32 tick = 0) {
+        _record_sample(ucontext, counter, event_type, event, thread_state, tick);
+    }
 
     void updateSymbols(bool kernel_symbols);
     const void* findSymbol(const char* name);
@@ -238,7 +399,7 @@ class Profiler {
                                            jint code_size, const void* code_addr,
                                            jint map_length, const jvmtiAddrLocationMap* map,
                                            const void* compile_info) {
-        _instance.addJavaMethod(code_addr, code_size, method);
+        _instance.addJavaMethod(code_addr, code_size, method, compile_info);
     }
 
     static void JNICALL CompiledMethodUnload(jvmtiEnv* jvmti, jmethodID method,
@@ -260,6 +421,10 @@ class Profiler {
     }
 
     friend class Recording;
+    friend class Snapshot;
+    friend class MicroBenchmark;
+    template <int FLAGS, int BIT> friend struct RecordSampleVariant;
+    template <int FLAGS, bool USABLE> friend struct RecordSampleLeaf;
 };
 
 #endif // _PROFILER_H
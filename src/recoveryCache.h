@@ -0,0 +1,96 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RECOVERYCACHE_H
+#define _RECOVERYCACHE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "arch.h"
+
+
+const int RECOVERY_CACHE_SIZE = 4096;
+
+// Technique value of an outcome meaning that no recovery technique helps;
+// its slot counts down the samples to skip before the techniques are tried again
+const int RECOVERY_NONE = 0xff;
+const int RECOVERY_RETRY_SAMPLES = 100;
+
+
+// Remembers, for the top PC of a stack AsyncGetCallTrace failed to walk, which recovery
+// technique succeeded last time and with which stack slot, or that none did recently.
+// Direct-mapped; every entry is a single 64-bit word holding both PC and outcome,
+// so lookups from signal handlers need no locks. Collisions simply evict older entries.
+// Entries are read and written with atomic builtins, since a plain 64-bit access
+// may be split in two on 32-bit targets and pair the PC of one entry with the outcome of another
+class RecoveryCache {
+  private:
+    volatile u64 _entries[RECOVERY_CACHE_SIZE];
+
+    u64 load(u32 i) {
+        return __atomic_load_n(&_entries[i], __ATOMIC_RELAXED);
+    }
+
+    static u32 index(uintptr_t pc) {
+        u64 h = (u64)pc * 0xc6a4a7935bd1e995ULL;
+        return (u32)(h >> 32) & (RECOVERY_CACHE_SIZE - 1);
+    }
+
+    // PC takes the upper 48 bits of an entry, which covers user space addresses
+    static bool cacheable(uintptr_t pc) {
+        return pc != 0 && (u64)pc >> 48 == 0;
+    }
+
+  public:
+    void clear() {
+        memset((void*)_entries, 0, sizeof(_entries));
+    }
+
+    static u32 outcome(int technique, int slot) {
+        return (u32)technique << 8 | (slot & 0xff);
+    }
+
+    static int technique(u32 outcome) {
+        return outcome >> 8;
+    }
+
+    static int slot(u32 outcome) {
+        return outcome & 0xff;
+    }
+
+    // Returns 0 if nothing is known about the PC
+    u32 lookup(uintptr_t pc) {
+        u64 entry = load(index(pc));
+        return cacheable(pc) && entry >> 16 == (u64)pc ? (u32)entry & 0xffff : 0;
+    }
+
+    void store(uintptr_t pc, u32 outcome) {
+        if (cacheable(pc)) {
+            __atomic_store_n(&_entries[index(pc)], (u64)pc << 16 | outcome, __ATOMIC_RELAXED);
+        }
+    }
+
+    void remove(uintptr_t pc) {
+        u32 i = index(pc);
+        u64 entry = load(i);
+        if (entry >> 16 == (u64)pc) {
+            // Leave the entry alone if another PC has taken it meanwhile
+            __sync_bool_compare_and_swap(&_entries[i], entry, 0);
+        }
+    }
+};
+
+#endif // _RECOVERYCACHE_H
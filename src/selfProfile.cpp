@@ -0,0 +1,163 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "selfProfile.h"
+#include "os.h"
+
+
+static const char* const PHASE_NAMES[PHASE_COUNT] = {
+    "lock",
+    "native_trace",
+    "java_trace",
+    "store",
+    "jfr",
+    "total"
+};
+
+static const char* const RECOVERY_NAMES[RECOVERY_TYPES] = {
+    "move_sp",
+    "pop_frame",
+    "scan_stack",
+    "last_java_pc",
+    "gc_traces"
+};
+
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    _count += other._count;
+    _sum += other._sum;
+    if (other._max > _max) _max = other._max;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        _buckets[i] += other._buckets[i];
+    }
+}
+
+// Upper bound of the bucket containing the given percentile
+u64 LatencyHistogram::percentile(double p) {
+    u64 threshold = (u64)(_count * p / 100);
+    u64 sum = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        sum += _buckets[i];
+        if (sum > threshold) {
+            u64 bound = 2ULL << i;
+            return bound < _max ? bound : _max;
+        }
+    }
+    return _max;
+}
+
+
+SelfProfile::SelfProfile(int stripes) : _enabled(false), _running(false), _stripes(stripes), _engine(NULL) {
+    _histograms = (LatencyHistogram (*)[PHASE_COUNT])calloc(stripes, sizeof(LatencyHistogram[PHASE_COUNT]));
+    reset();
+}
+
+SelfProfile::~SelfProfile() {
+    free(_histograms);
+}
+
+void SelfProfile::reset() {
+    memset(_histograms, 0, _stripes * sizeof(LatencyHistogram[PHASE_COUNT]));
+    memset((void*)_recovery_attempts, 0, sizeof(_recovery_attempts));
+    memset((void*)_recovery_successes, 0, sizeof(_recovery_successes));
+    _recovery_cache_hits = 0;
+    _recovery_cache_misses = 0;
+    _cpu_time = 0;
+    _cpu_start = 0;
+}
+
+void SelfProfile::start(bool enabled, const char* engine) {
+    _enabled = enabled;
+    _running = true;
+    _engine = engine;
+    _cpu_start = OS::processCpuTime();
+}
+
+void SelfProfile::stop() {
+    _cpu_time += OS::processCpuTime() - _cpu_start;
+    _enabled = false;
+    _running = false;
+}
+
+double SelfProfile::overhead() {
+    LatencyHistogram total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < _stripes; i++) {
+        total.merge(_histograms[i][PHASE_TOTAL]);
+    }
+    u64 cpu_time = _running ? _cpu_time + OS::processCpuTime() - _cpu_start : _cpu_time;
+    return cpu_time == 0 ? 0 : 100.0 * total._sum / cpu_time;
+}
+
+void SelfProfile::dump(std::ostream& out) {
+    char buf[256];
+
+    bool has_recovery = false;
+    for (int i = 0; i < RECOVERY_TYPES; i++) {
+        has_recovery |= _recovery_attempts[i] != 0;
+    }
+    has_recovery |= _recovery_cache_hits + _recovery_cache_misses != 0;
+    if (has_recovery) {
+        out << "--- Stack recovery ---" << std::endl;
+        for (int i = 0; i < RECOVERY_TYPES; i++) {
+            if (_recovery_attempts[i] != 0) {
+                snprintf(buf, sizeof(buf), "%-20s: %lld attempts, %lld recovered\n",
+                         RECOVERY_NAMES[i], _recovery_attempts[i], _recovery_successes[i]);
+                out << buf;
+            }
+        }
+        u64 lookups = _recovery_cache_hits + _recovery_cache_misses;
+        if (lookups != 0) {
+            snprintf(buf, sizeof(buf), "%-20s: %lld hits, %lld misses (%.2f%% hit rate)\n", "recovery_cache",
+                     _recovery_cache_hits, _recovery_cache_misses, 100.0 * _recovery_cache_hits / lookups);
+            out << buf;
+        }
+        out << std::endl;
+    }
+
+    if (_engine == NULL) {
+        return;
+    }
+
+    LatencyHistogram phases[PHASE_COUNT];
+    memset(phases, 0, sizeof(phases));
+    for (int i = 0; i < _stripes; i++) {
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            phases[phase].merge(_histograms[i][phase]);
+        }
+    }
+    if (phases[PHASE_TOTAL]._count == 0) {
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "--- Sampling cost [%s], ns ---\n", _engine);
+    out << buf;
+    snprintf(buf, sizeof(buf), "%-20s %12s %10s %10s %10s %10s\n", "phase", "count", "avg", "p50", "p99", "max");
+    out << buf;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        LatencyHistogram& h = phases[phase];
+        if (h._count == 0) continue;
+        snprintf(buf, sizeof(buf), "%-20s %12lld %10lld %10lld %10lld %10lld\n", PHASE_NAMES[phase],
+                 h._count, h._sum / h._count, h.percentile(50), h.percentile(99), h._max);
+        out << buf;
+    }
+    snprintf(buf, sizeof(buf), "Profiler overhead   : %.3f%% of process CPU\n", overhead());
+    out << buf << std::endl;
+}
+
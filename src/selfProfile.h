@@ -0,0 +1,147 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SELFPROFILE_H
+#define _SELFPROFILE_H
+
+#include <iostream>
+#include "arch.h"
+#include "os.h"
+
+
+// Phases of Profiler::recordSample
+enum SamplePhase {
+    PHASE_LOCK,         // thread filter and spinlock acquisition
+    PHASE_NATIVE_TRACE,
+    PHASE_JAVA_TRACE,   // including stack recovery attempts
+    PHASE_STORE,        // method and call trace tables
+    PHASE_JFR,
+    PHASE_TOTAL,
+    PHASE_COUNT
+};
+
+// Bucket N counts durations in [2^N, 2^(N+1)) ns
+const int LATENCY_BUCKETS = 32;
+// Stack recovery techniques, in the order of StackRecovery bits
+const int RECOVERY_TYPES = 5;
+
+
+class LatencyHistogram {
+  public:
+    u64 _count;
+    u64 _sum;
+    u64 _max;
+    u64 _buckets[LATENCY_BUCKETS];
+
+    void add(u64 ns) {
+        int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+        _buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+        _count++;
+        _sum += ns;
+        if (ns > _max) _max = ns;
+    }
+
+    void merge(const LatencyHistogram& other);
+    u64 percentile(double p);
+};
+
+
+// Optional timing of sample collection. Histograms are striped by the recordSample lock index,
+// so that they are updated under the lock without atomic operations.
+class SelfProfile {
+  private:
+    bool _enabled;
+    bool _running;
+    int _stripes;
+    LatencyHistogram (*_histograms)[PHASE_COUNT];
+    volatile u64 _recovery_attempts[RECOVERY_TYPES];
+    volatile u64 _recovery_successes[RECOVERY_TYPES];
+    volatile u64 _recovery_cache_hits;
+    volatile u64 _recovery_cache_misses;
+    const char* _engine;
+    u64 _cpu_time;
+    u64 _cpu_start;
+
+  public:
+    SelfProfile(int stripes);
+    ~SelfProfile();
+
+    bool enabled() {
+        return _enabled;
+    }
+
+    void reset();
+    void start(bool enabled, const char* engine);
+    void stop();
+
+    void record(int stripe, SamplePhase phase, u64 ns) {
+        _histograms[stripe][phase].add(ns);
+    }
+
+    // Recovery counters are shared by all threads, so they are not touched unless self-profiling
+    void countRecovery(int technique, bool success) {
+        if (_enabled) {
+            int index = __builtin_ctz(technique);
+            atomicInc(_recovery_attempts[index]);
+            if (success) {
+                atomicInc(_recovery_successes[index]);
+            }
+        }
+    }
+
+    void countRecoveryCache(bool hit) {
+        if (_enabled) {
+            atomicInc(hit ? _recovery_cache_hits : _recovery_cache_misses);
+        }
+    }
+
+    // Time spent in recordSample as a percentage of the process CPU time while profiling
+    double overhead();
+
+    void dump(std::ostream& out);
+};
+
+
+// Measures consecutive phases of one recordSample call. Variants of the sampling path
+// that are never self-profiled use PhaseTimer<false>, which does nothing at all
+template <bool ENABLED>
+class PhaseTimer {
+  private:
+    SelfProfile* _profile;
+    u64 _start;
+    u64 _last;
+
+  public:
+    PhaseTimer(SelfProfile* profile) : _profile(ENABLED && profile->enabled() ? profile : NULL) {
+        _start = _last = ENABLED && _profile != NULL ? OS::nanotime() : 0;
+    }
+
+    void lap(int stripe, SamplePhase phase) {
+        if (ENABLED && _profile != NULL) {
+            u64 now = OS::nanotime();
+            _profile->record(stripe, phase, now - _last);
+            _last = now;
+        }
+    }
+
+    void finish(int stripe) {
+        if (ENABLED && _profile != NULL) {
+            _profile->record(stripe, PHASE_TOTAL, OS::nanotime() - _start);
+        }
+    }
+};
+
+#endif // _SELFPROFILE_H
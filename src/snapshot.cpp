@@ -0,0 +1,566 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+#include "engine.h"
+#include "profiler.h"
+#include "vmStructs.h"
+
+
+// The format is native-endian: snapshots are replayed on the same kind of machine
+const u32 SNAPSHOT_MAGIC = 0x50414e53;  // "SNAP"
+const u32 SNAPSHOT_VERSION = 1;
+
+// Reference to a missing native name or symbol
+const u64 NO_REF = (u64)-1;
+
+enum SnapshotStringKind {
+    STRING_NAME   = 0,
+    STRING_SYMBOL = 1
+};
+
+
+SnapshotMethodMap* Snapshot::_methods = NULL;
+
+
+// Native names and VM symbols live in a string table, and frames refer to them by index.
+// Other non-Java frames carry a plain value (thread ID, context tag), and Java frames
+// keep the original jmethodID as a key into the method table.
+static bool isStringFrame(jint bci) {
+    return bci == BCI_NATIVE_FRAME || bci == BCI_ERROR || bci == BCI_SYMBOL || bci == BCI_SYMBOL_OUTSIDE_TLAB;
+}
+
+static bool isJavaFrame(jint bci) {
+    return bci > BCI_NATIVE_FRAME;
+}
+
+
+// Engine stand-in that supplies the name and units of the recorded profile
+class ReplayEngine : public Engine {
+  private:
+    std::string _name;
+    std::string _units;
+
+  public:
+    void init(const std::string& name, const std::string& units) {
+        _name = name;
+        _units = units;
+    }
+
+    const char* name() {
+        return _name.c_str();
+    }
+
+    const char* units() {
+        return _units.c_str();
+    }
+
+    Error start(Arguments& args) {
+        return Error("Cannot profile a snapshot");
+    }
+
+    void stop() {
+    }
+};
+
+static ReplayEngine replay_engine;
+
+
+class SnapshotWriter {
+  private:
+    std::ostream& _out;
+    std::map<const void*, u32> _string_index;
+    std::vector<std::pair<std::string, u8> > _strings;
+    SnapshotMethodMap _methods;
+
+    void resolveMethod(jmethodID method, SnapshotMethod& m) {
+        if (Snapshot::loaded()) {
+            // Writing a snapshot of a snapshot
+            SnapshotMethod* loaded = Snapshot::findMethod(method);
+            if (loaded != NULL) {
+                m = *loaded;
+            } else {
+                m._error = JVMTI_ERROR_INVALID_METHODID;
+            }
+            return;
+        }
+
+        jvmtiEnv* jvmti = VM::jvmti();
+        jclass method_class;
+        char* class_name = NULL;
+        char* method_name = NULL;
+        char* method_sig = NULL;
+        jint modifiers = 0;
+        jvmtiError err;
+
+        if ((err = jvmti->GetMethodName(method, &method_name, &method_sig, NULL)) == 0 &&
+            (err = jvmti->GetMethodDeclaringClass(method, &method_class)) == 0 &&
+            (err = jvmti->GetClassSignature(method_class, &class_name, NULL)) == 0) {
+            jvmti->GetMethodModifiers(method, &modifiers);
+            m._class = class_name;
+            m._name = method_name;
+            m._sig = method_sig;
+            m._modifiers = modifiers;
+
+            jint entry_count;
+            jvmtiLineNumberEntry* table;
+            if (jvmti->GetLineNumberTable(method, &entry_count, &table) == 0) {
+                m._lines.assign(table, table + entry_count);
+                jvmti->Deallocate((unsigned char*)table);
+            }
+        }
+        m._error = err;
+
+        jvmti->Deallocate((unsigned char*)class_name);
+        jvmti->Deallocate((unsigned char*)method_sig);
+        jvmti->Deallocate((unsigned char*)method_name);
+    }
+
+    void addString(const void* key, jint bci) {
+        if (_string_index.find(key) != _string_index.end()) {
+            return;
+        }
+
+        _string_index[key] = _strings.size();
+        if (bci == BCI_SYMBOL || bci == BCI_SYMBOL_OUTSIDE_TLAB) {
+            VMSymbol* symbol = (VMSymbol*)key;
+            _strings.push_back(std::make_pair(std::string(symbol->body(), symbol->length()), (u8)STRING_SYMBOL));
+        } else {
+            _strings.push_back(std::make_pair(std::string((const char*)key), (u8)STRING_NAME));
+        }
+    }
+
+    static const void* stringKey(const ASGCT_CallFrame& frame) {
+        return frame.bci == BCI_SYMBOL_OUTSIDE_TLAB ? (const void*)((uintptr_t)frame.method_id ^ 1) : frame.method_id;
+    }
+
+  public:
+    SnapshotWriter(std::ostream& out) : _out(out), _string_index(), _strings(), _methods() {
+    }
+
+    void collect(const ASGCT_CallFrame& frame) {
+        if (frame.method_id == NULL) {
+            return;
+        } else if (isStringFrame(frame.bci)) {
+            addString(stringKey(frame), frame.bci);
+        } else if (isJavaFrame(frame.bci)) {
+            SnapshotMethodMap::iterator it = _methods.lower_bound(frame.method_id);
+            if (it == _methods.end() || it->first != frame.method_id) {
+                it = _methods.insert(it, SnapshotMethodMap::value_type(frame.method_id, SnapshotMethod()));
+                resolveMethod(frame.method_id, it->second);
+            }
+        }
+    }
+
+    void put8(u8 v) {
+        _out.put((char)v);
+    }
+
+    void put32(u32 v) {
+        _out.write((const char*)&v, sizeof(v));
+    }
+
+    void put64(u64 v) {
+        _out.write((const char*)&v, sizeof(v));
+    }
+
+    void putString(const std::string& s) {
+        put32(s.length());
+        _out.write(s.data(), s.length());
+    }
+
+    void putFrame(const ASGCT_CallFrame& frame) {
+        put32(frame.bci);
+        if (!isStringFrame(frame.bci)) {
+            put64((u64)(uintptr_t)frame.method_id);
+        } else if (frame.method_id == NULL) {
+            put64(NO_REF);
+        } else {
+            put64(_string_index[stringKey(frame)]);
+        }
+    }
+
+    void putStrings() {
+        put32(_strings.size());
+        for (size_t i = 0; i < _strings.size(); i++) {
+            put8(_strings[i].second);
+            putString(_strings[i].first);
+        }
+    }
+
+    void putMethods() {
+        put32(_methods.size());
+        for (SnapshotMethodMap::const_iterator it = _methods.begin(); it != _methods.end(); ++it) {
+            const SnapshotMethod& m = it->second;
+            put64((u64)(uintptr_t)it->first);
+            put32(m._error);
+            putString(m._class);
+            putString(m._name);
+            putString(m._sig);
+            put32(m._modifiers);
+            put32(m._lines.size());
+            for (size_t i = 0; i < m._lines.size(); i++) {
+                put64(m._lines[i].start_location);
+                put32(m._lines[i].line_number);
+            }
+        }
+    }
+};
+
+
+class SnapshotReader {
+  private:
+    const char* _data;
+    size_t _size;
+    size_t _pos;
+    bool _overflow;
+
+    const char* advance(size_t len) {
+        if (_overflow || len > _size - _pos) {
+            _overflow = true;
+            return NULL;
+        }
+        const char* p = _data + _pos;
+        _pos += len;
+        return p;
+    }
+
+  public:
+    SnapshotReader(const char* data, size_t size) : _data(data), _size(size), _pos(0), _overflow(false) {
+    }
+
+    bool overflow() {
+        return _overflow;
+    }
+
+    u8 get8() {
+        const char* p = advance(1);
+        return p != NULL ? *(u8*)p : 0;
+    }
+
+    u32 get32() {
+        u32 v = 0;
+        const char* p = advance(sizeof(v));
+        if (p != NULL) memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    u64 get64() {
+        u64 v = 0;
+        const char* p = advance(sizeof(v));
+        if (p != NULL) memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    std::string getString() {
+        u32 len = get32();
+        const char* p = advance(len);
+        return p != NULL ? std::string(p, len) : std::string();
+    }
+
+    bool getFrame(ASGCT_CallFrame& frame, std::vector<jmethodID>& strings) {
+        frame.bci = (jint)get32();
+        u64 ref = get64();
+        if (!isStringFrame(frame.bci)) {
+            frame.method_id = (jmethodID)(uintptr_t)ref;
+        } else if (ref == NO_REF) {
+            frame.method_id = NULL;
+        } else if (ref < strings.size()) {
+            frame.method_id = strings[ref];
+            if (frame.bci == BCI_SYMBOL_OUTSIDE_TLAB) {
+                frame.method_id = (jmethodID)((uintptr_t)frame.method_id ^ 1);
+            }
+        } else {
+            return false;
+        }
+        return !_overflow;
+    }
+};
+
+
+void Snapshot::write(std::ostream& out) {
+    Profiler* p = &Profiler::_instance;
+    SnapshotWriter writer(out);
+
+    int trace_count = 0;
+    u32 used_frames = 0;
+    for (int i = 0; i < MAX_CALLTRACES; i++) {
+        CallTraceSample& trace = p->_traces[i];
+        if (trace._samples != 0) {
+            trace_count++;
+            used_frames += trace._num_frames;
+            for (int j = 0; j < trace._num_frames; j++) {
+                writer.collect(p->frameAt(trace._start_frame + j));
+            }
+        }
+    }
+
+    writer.put32(SNAPSHOT_MAGIC);
+    writer.put32(SNAPSHOT_VERSION);
+    writer.putString(p->_engine->name());
+    writer.putString(p->_engine->units());
+    writer.put8(p->_add_line_numbers ? 1 : 0);
+    writer.put64(p->_total_samples);
+    writer.put64(p->_total_counter);
+    writer.put32(ASGCT_FAILURE_TYPES);
+    for (int i = 0; i < ASGCT_FAILURE_TYPES; i++) {
+        writer.put64(p->_failures[i]);
+    }
+    writer.put32(p->_frame_buffer_size);
+    writer.put32(used_frames);
+    writer.put8(p->_frame_buffer_overflow ? 1 : 0);
+
+    writer.putStrings();
+    writer.putMethods();
+
+    writer.put32(trace_count);
+    for (int i = 0; i < MAX_CALLTRACES; i++) {
+        CallTraceSample& trace = p->_traces[i];
+        if (trace._samples != 0) {
+            writer.put32(i);
+            writer.put64(p->_hashes[i]);
+            writer.put64(trace._samples);
+            writer.put64(trace._counter);
+            writer.put32(trace._num_frames);
+            for (int j = 0; j < trace._num_frames; j++) {
+                writer.putFrame(p->frameAt(trace._start_frame + j));
+            }
+        }
+    }
+
+    std::vector<ThreadRecord> threads;
+    ThreadRecord record;
+    for (int i = 0; i < p->_thread_registry.capacity(); i++) {
+        if (p->_thread_registry.getAt(i, &record)) {
+            threads.push_back(record);
+        }
+    }
+
+    writer.put32(threads.size());
+    for (size_t i = 0; i < threads.size(); i++) {
+        ThreadRecord& t = threads[i];
+        writer.put32(t._tid);
+        writer.put64(t._java_thread_id);
+        writer.put64(t._start_time);
+        writer.put64(t._end_time);
+        writer.put64(t._cpu_time);
+        writer.put64(t._samples);
+        writer.putString(t._name);
+        writer.putString(t._group);
+    }
+}
+
+Error Snapshot::read(const char* file) {
+    if (VM::jvmti() != NULL) {
+        return Error("Snapshot can be loaded only by an offline tool");
+    } else if (loaded()) {
+        return Error("Snapshot is already loaded");
+    }
+
+    FILE* f = fopen(file, "rb");
+    if (f == NULL) {
+        return Error(strerror(errno));
+    }
+
+    std::vector<char> data;
+    char buf[65536];
+    size_t bytes;
+    while ((bytes = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + bytes);
+    }
+    fclose(f);
+
+    if (data.empty()) {
+        return Error("Snapshot file is empty");
+    }
+
+    SnapshotReader reader(&data[0], data.size());
+    if (reader.get32() != SNAPSHOT_MAGIC) {
+        return Error("Not a profiler snapshot");
+    } else if (reader.get32() != SNAPSHOT_VERSION) {
+        return Error("Unsupported snapshot version");
+    }
+
+    Profiler* p = &Profiler::_instance;
+    MutexLocker ml(p->_state_lock);
+    if (p->_state != IDLE) {
+        return Error("Profiler is active");
+    }
+
+    std::string engine_name = reader.getString();
+    std::string engine_units = reader.getString();
+    replay_engine.init(engine_name, engine_units);
+    p->_engine = &replay_engine;
+
+    p->_add_line_numbers = reader.get8() != 0;
+    p->_total_samples = reader.get64();
+    p->_total_counter = reader.get64();
+
+    memset(p->_failures, 0, sizeof(p->_failures));
+    u32 failure_types = reader.get32();
+    for (u32 i = 0; i < failure_types; i++) {
+        u64 failures = reader.get64();
+        if (i < ASGCT_FAILURE_TYPES) p->_failures[i] = failures;
+    }
+
+    u32 frame_buffer_size = reader.get32();
+    u32 used_frames = reader.get32();
+    p->_frame_buffer_overflow = reader.get8() != 0;
+    if (reader.overflow() || used_frames > frame_buffer_size || frame_buffer_size > 0x10000000) {
+        return Error("Invalid snapshot header");
+    }
+
+    Arguments args;
+    args._framebuf = frame_buffer_size;
+    p->_frame_buffer_index = 0;
+    Error error = p->allocateBuffers(args);
+    if (error) {
+        return error;
+    }
+
+    // VM symbols are recreated in memory with a fixed layout: u16 length followed by the body
+    VMStructs::_symbol_length_offset = 0;
+    VMStructs::_symbol_body_offset = sizeof(unsigned short);
+
+    std::vector<jmethodID> strings;
+    u32 string_count = reader.get32();
+    for (u32 i = 0; i < string_count && !reader.overflow(); i++) {
+        u8 kind = reader.get8();
+        std::string s = reader.getString();
+        if (kind == STRING_SYMBOL) {
+            char* symbol = (char*)malloc(sizeof(unsigned short) + s.length());
+            *(unsigned short*)symbol = (unsigned short)s.length();
+            memcpy(symbol + sizeof(unsigned short), s.data(), s.length());
+            strings.push_back((jmethodID)symbol);
+        } else {
+            strings.push_back((jmethodID)strdup(s.c_str()));
+        }
+    }
+
+    SnapshotMethodMap* methods = new SnapshotMethodMap();
+    u32 method_count = reader.get32();
+    for (u32 i = 0; i < method_count && !reader.overflow(); i++) {
+        SnapshotMethod& m = (*methods)[(jmethodID)(uintptr_t)reader.get64()];
+        m._error = reader.get32();
+        m._class = reader.getString();
+        m._name = reader.getString();
+        m._sig = reader.getString();
+        m._modifiers = reader.get32();
+
+        u32 line_count = reader.get32();
+        for (u32 j = 0; j < line_count && !reader.overflow(); j++) {
+            jvmtiLineNumberEntry entry;
+            entry.start_location = reader.get64();
+            entry.line_number = reader.get32();
+            m._lines.push_back(entry);
+        }
+    }
+    _methods = methods;
+
+    memset(p->_hashes, 0, sizeof(p->_hashes));
+    memset(p->_traces, 0, sizeof(p->_traces));
+    p->_frame_dictionary.clear();
+    p->reserveOverflowTraces();
+
+    u32 trace_count = reader.get32();
+    for (u32 i = 0; i < trace_count; i++) {
+        u32 slot = reader.get32();
+        u64 hash = reader.get64();
+        u64 samples = reader.get64();
+        u64 counter = reader.get64();
+        u32 num_frames = reader.get32();
+        if (reader.overflow() || slot >= MAX_CALLTRACES || num_frames > used_frames - p->_frame_buffer_index) {
+            return Error("Invalid call trace in snapshot");
+        }
+
+        CallTraceSample& trace = p->_traces[slot];
+        trace._samples = samples;
+        trace._counter = counter;
+        trace._start_frame = p->_frame_buffer_index;
+        trace._num_frames = num_frames;
+        p->_hashes[slot] = hash;
+
+        for (u32 j = 0; j < num_frames; j++) {
+            ASGCT_CallFrame frame;
+            if (!reader.getFrame(frame, strings)) {
+                return Error("Invalid frame in snapshot");
+            }
+            if (!p->encodeFrame(frame, &p->_frame_buffer[p->_frame_buffer_index++])) {
+                return Error("Too many distinct frames in snapshot");
+            }
+        }
+    }
+    p->_frame_dictionary_overflow = p->_traces[FRAME_DICTIONARY_OVERFLOW_TRACE]._samples != 0;
+
+    p->_thread_registry.clear();
+    u32 thread_count = reader.get32();
+    for (u32 i = 0; i < thread_count && !reader.overflow(); i++) {
+        ThreadRecord record;
+        memset(&record, 0, sizeof(record));
+        record._tid = reader.get32();
+        record._java_thread_id = reader.get64();
+        record._start_time = reader.get64();
+        record._end_time = reader.get64();
+        record._cpu_time = reader.get64();
+        record._samples = reader.get64();
+        strncpy(record._name, reader.getString().c_str(), sizeof(record._name) - 1);
+        strncpy(record._group, reader.getString().c_str(), sizeof(record._group) - 1);
+        p->_thread_registry.restore(&record);
+    }
+
+    if (reader.overflow()) {
+        return Error("Snapshot is truncated");
+    }
+    return Error::OK;
+}
+
+// Emits one execution sample per recorded sample of each call trace, so that
+// the JFR writer sees the same amount of data as during live profiling
+Error Snapshot::replayRecording(const char* file) {
+    Profiler* p = &Profiler::_instance;
+
+    Error error = p->_jfr.start(file, p->_jfr_buffers);
+    if (error) {
+        return error;
+    }
+
+    for (int i = 0; i < MAX_CALLTRACES; i++) {
+        CallTraceSample& trace = p->_traces[i];
+        if (trace._samples == 0) continue;
+
+        int tid = 0;
+        Context context = {0, 0};
+        for (int j = 0; j < trace._num_frames; j++) {
+            ASGCT_CallFrame frame = p->frameAt(trace._start_frame + j);
+            if (frame.bci == BCI_THREAD_ID) {
+                tid = (int)(uintptr_t)frame.method_id;
+            } else if (frame.bci == BCI_CONTEXT_TAG) {
+                context.tag = (u64)(uintptr_t)frame.method_id;
+            }
+        }
+
+        for (u64 n = trace._samples; n > 0; n--) {
+            p->_jfr.recordExecutionSample(i % CONCURRENCY_LEVEL, tid, i, THREAD_RUNNING, context);
+        }
+    }
+
+    p->_jfr.stop();
+    return Error::OK;
+}
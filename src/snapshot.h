@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <jvmti.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "arguments.h"
+
+
+// Java method as resolved by JVM TI at the time the snapshot was taken
+class SnapshotMethod {
+  public:
+    int _error;           // JVM TI error code, 0 if the method was resolved
+    std::string _class;   // class signature, e.g. Ljava/lang/String;
+    std::string _name;
+    std::string _sig;
+    int _modifiers;
+    std::vector<jvmtiLineNumberEntry> _lines;
+
+    SnapshotMethod() : _error(0), _modifiers(0) {
+    }
+};
+
+typedef std::map<jmethodID, SnapshotMethod> SnapshotMethodMap;
+
+
+// Raw profile data: call trace table, frame buffer, thread records
+// and names of all referenced methods and symbols.
+// A snapshot is written from a live JVM and loaded back into the profiler
+// by a standalone tool, so that all output generators can run offline.
+class Snapshot {
+  private:
+    static SnapshotMethodMap* _methods;
+
+  public:
+    static void write(std::ostream& out);
+    static Error read(const char* file);
+    static Error replayRecording(const char* file);
+
+    static bool loaded() {
+        return _methods != NULL;
+    }
+
+    // Replaces JVM TI method lookups when the profile comes from a snapshot
+    static SnapshotMethod* findMethod(jmethodID method) {
+        SnapshotMethodMap::iterator it = _methods->find(method);
+        return it != _methods->end() ? &it->second : NULL;
+    }
+};
+
+#endif // _SNAPSHOT_H
@@ -58,6 +58,16 @@ class SpinLock {
         }
     }
 
+    bool tryLockShared() {
+        int value;
+        while ((value = _lock) != 1) {
+            if (__sync_bool_compare_and_swap(&_lock, value, value - 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     void unlockShared() {
         __sync_fetch_and_add(&_lock, 1);
     }
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "stackCache.h"
+
+
+void StackCache::init(void* memory, u32 bci_mask) {
+    // Partial hashes depend on the mask, so they never survive a restart
+    if (memory != NULL) {
+        memset(memory, 0, size());
+    }
+    _slots = (StackCacheSlot*)memory;
+    _bci_mask = bci_mask;
+}
+
+u64 StackCache::hash(int tid, int num_frames, ASGCT_CallFrame* frames) {
+    StackCacheSlot* slot = &_slots[(u32)tid % STACK_CACHE_SLOTS];
+    if (!slot->_lock.tryLock()) {
+        return hashTrace(num_frames, frames, _bci_mask);
+    }
+
+    int cached_depth = slot->_tid == tid ? slot->_depth : 0;
+    int max_depth = num_frames < STACK_CACHE_DEPTH ? num_frames : STACK_CACHE_DEPTH;
+    if (cached_depth > max_depth) {
+        cached_depth = max_depth;
+    }
+
+    int depth = 0;
+    ASGCT_CallFrame* bottom = frames + num_frames - 1;
+    while (depth < cached_depth && bottom[-depth].method_id == slot->_frames[depth].method_id &&
+           bottom[-depth].bci == slot->_frames[depth].bci) {
+        depth++;
+    }
+
+    u64 h = depth > 0 ? slot->_hashes[depth - 1] : 0;
+
+    for (; depth < num_frames; depth++) {
+        h = hashFrame(h, bottom[-depth], _bci_mask);
+        if (depth < STACK_CACHE_DEPTH) {
+            slot->_frames[depth] = bottom[-depth];
+            slot->_hashes[depth] = h;
+        }
+    }
+
+    slot->_tid = tid;
+    slot->_depth = max_depth;
+    slot->_lock.unlock();
+
+    return finish(h, num_frames);
+}
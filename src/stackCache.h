@@ -0,0 +1,97 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _STACKCACHE_H
+#define _STACKCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arch.h"
+#include "spinLock.h"
+#include "vmEntry.h"
+
+
+const int STACK_CACHE_SLOTS = 256;
+const int STACK_CACHE_DEPTH = 512;
+
+struct StackCacheSlot {
+    SpinLock _lock;
+    int _tid;
+    int _depth;
+    ASGCT_CallFrame _frames[STACK_CACHE_DEPTH];  // counted from the bottom of the stack
+    u64 _hashes[STACK_CACHE_DEPTH];              // partial hash of frames up to this depth
+};
+
+
+// Remembers the bottom part of the previous stack trace of a thread together with
+// partial hashes. Call traces are hashed from the bottom up, so a sample of a deep
+// stable stack is hashed only from the first frame that differs from the cached one.
+// Slots are shared by threads with the same tid % STACK_CACHE_SLOTS;
+// a busy slot is bypassed rather than waited for.
+class StackCache {
+  private:
+    static const u64 M = 0xc6a4a7935bd1e995ULL;
+    static const int R = 47;
+
+    StackCacheSlot* _slots;
+    u32 _bci_mask;
+
+  public:
+    StackCache() : _slots(NULL), _bci_mask(0) {
+    }
+
+    static size_t size() {
+        return STACK_CACHE_SLOTS * sizeof(StackCacheSlot);
+    }
+
+    static u64 hashFrame(u64 h, const ASGCT_CallFrame& frame, u32 bci_mask) {
+        u64 k = (u64)frame.method_id ^ (u64)((u32)frame.bci & bci_mask) << 32;
+        k *= M;
+        k ^= k >> R;
+        k *= M;
+        h ^= k;
+        h *= M;
+        return h;
+    }
+
+    static u64 finish(u64 h, int num_frames) {
+        h ^= num_frames * M;
+        h *= M;
+        h ^= h >> R;
+        h *= M;
+        h ^= h >> R;
+        return h;
+    }
+
+    static u64 hashTrace(int num_frames, ASGCT_CallFrame* frames, u32 bci_mask) {
+        u64 h = 0;
+        for (int i = num_frames - 1; i >= 0; i--) {
+            h = hashFrame(h, frames[i], bci_mask);
+        }
+        return finish(h, num_frames);
+    }
+
+    bool enabled() {
+        return _slots != NULL;
+    }
+
+    // Passing NULL memory disables the cache
+    void init(void* memory, u32 bci_mask);
+
+    u64 hash(int tid, int num_frames, ASGCT_CallFrame* frames);
+};
+
+#endif // _STACKCACHE_H
@@ -71,12 +71,21 @@ class StackFrame {
     // 0 = do not use stack snooping heuristics.
     static int callerLookupSlots();
 
+    // Slot of Method* in a HotSpot interpreted frame relative to FP.
+    // 0 = frames cannot be walked without AsyncGetCallTrace on this architecture.
+    static int interpreterMethodSlot();
+
     // Check if PC looks like a valid return address (i.e. the previous instruction is a CALL).
     // It's safe to return false to skip return address heuristics.
     static bool isReturnAddress(instruction_t* pc);
 
     // Check if PC points to a syscall instruction
     static bool isSyscall(instruction_t* pc);
+
+    // Check if PC is in the epilogue of a HotSpot compiled method past the point where SP
+    // has been moved back, so the frame size no longer locates the caller.
+    // Looks at most at the code between start and PC. Used only where interpreterMethodSlot() != 0.
+    static bool isCompiledEpilogue(instruction_t* pc, instruction_t* start);
 };
 
 #endif // _STACKFRAME_H
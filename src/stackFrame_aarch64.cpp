@@ -85,6 +85,10 @@ int StackFrame::callerLookupSlots() {
     return 0;
 }
 
+int StackFrame::interpreterMethodSlot() {
+    return -3;
+}
+
 bool StackFrame::isReturnAddress(instruction_t* pc) {
     return false;
 }
@@ -94,4 +98,26 @@ bool StackFrame::isSyscall(instruction_t* pc) {
     return *pc == 0xd4000001;
 }
 
+bool StackFrame::isCompiledEpilogue(instruction_t* pc, instruction_t* start) {
+    // ldp x29, x30, [sp, #const]
+    // add sp, sp, #const
+    //   or, for large frames,
+    // add sp, sp, xN
+    // ldp x29, x30, [sp], #16
+    // [return safepoint poll]
+    // ret
+    instruction_t* min = pc - 6 > start ? pc - 6 : start;
+    for (instruction_t* p = pc - 1; p >= min; p--) {
+        if ((*p & 0xff8003ff) == 0x910003ff && p > start && (p[-1] & 0xffc07fff) == 0xa9407bfd) {
+            return true;
+        } else if (*p == 0xa8c17bfd) {
+            return true;
+        } else if ((*p & 0xffe0ffff) == 0x8b2063ff) {
+            // add sp, sp, xN (extended register form)
+            return true;
+        }
+    }
+    return false;
+}
+
 #endif // defined(__aarch64__)
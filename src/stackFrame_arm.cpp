@@ -68,6 +68,10 @@ int StackFrame::callerLookupSlots() {
     return 0;
 }
 
+int StackFrame::interpreterMethodSlot() {
+    return 0;
+}
+
 bool StackFrame::isReturnAddress(instruction_t* pc) {
     return false;
 }
@@ -77,4 +81,8 @@ bool StackFrame::isSyscall(instruction_t* pc) {
     return *pc == 0xef000000;
 }
 
+bool StackFrame::isCompiledEpilogue(instruction_t* pc, instruction_t* start) {
+    return false;
+}
+
 #endif // defined(__arm__) || defined(__thumb__)
@@ -80,6 +80,10 @@ int StackFrame::callerLookupSlots() {
     return 7;
 }
 
+int StackFrame::interpreterMethodSlot() {
+    return 0;
+}
+
 bool StackFrame::isReturnAddress(instruction_t* pc) {
     if (pc[-5] == 0xe8) {
         // call rel32
@@ -96,4 +100,8 @@ bool StackFrame::isSyscall(instruction_t* pc) {
     return pc[0] == 0xcd && pc[1] == 0x80;
 }
 
+bool StackFrame::isCompiledEpilogue(instruction_t* pc, instruction_t* start) {
+    return false;
+}
+
 #endif // __i386__
@@ -138,6 +138,10 @@ int StackFrame::callerLookupSlots() {
     return 7;
 }
 
+int StackFrame::interpreterMethodSlot() {
+    return -3;
+}
+
 bool StackFrame::isReturnAddress(instruction_t* pc) {
     if (pc[-5] == 0xe8) {
         // call rel32
@@ -153,4 +157,21 @@ bool StackFrame::isSyscall(instruction_t* pc) {
     return pc[0] == 0x0f && pc[1] == 0x05;
 }
 
+bool StackFrame::isCompiledEpilogue(instruction_t* pc, instruction_t* start) {
+    // add rsp, $const
+    // pop rbp
+    // [return safepoint poll]
+    // ret
+    // The poll takes at most 13 bytes, so an executed 'add rsp' is within 24 bytes before PC
+    instruction_t* min = pc - 24 > start ? pc - 24 : start;
+    for (instruction_t* p = pc - 4; p >= min; p--) {
+        if (p[0] == 0x48 && p[1] == 0x83 && p[2] == 0xc4 && p[4] == 0x5d) {
+            return true;
+        } else if (p[0] == 0x48 && p[1] == 0x81 && p[2] == 0xc4 && p + 7 <= pc && p[7] == 0x5d) {
+            return true;
+        }
+    }
+    return false;
+}
+
 #endif // __x86_64__
@@ -17,15 +17,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include "arena.h"
 #include "threadFilter.h"
 
     
 ThreadFilter::ThreadFilter() {
     memset(_bitmap, 0, sizeof(_bitmap));
+    memset(_named, 0, sizeof(_named));
     _bitmap[0] = (u32*)mmap(NULL, BITMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
     _enabled = false;
+    _explicit = false;
     _size = 0;
+    _name_patterns = NULL;
 }
 
 ThreadFilter::~ThreadFilter() {
@@ -33,12 +37,51 @@ ThreadFilter::~ThreadFilter() {
         if (_bitmap[i] != NULL) {
             munmap(_bitmap[i], BITMAP_SIZE);
         }
+        if (_named[i] != NULL) {
+            munmap(_named[i], BITMAP_SIZE);
+        }
     }
+    free(_name_patterns);
 }
 
-void ThreadFilter::init(const char* filter) {
+// Matches a string against a glob pattern with '*' and '?' wildcards
+static bool globMatch(const char* pattern, const char* pattern_end, const char* s) {
+    const char* star = NULL;
+    const char* star_s = NULL;
+
+    while (*s) {
+        if (pattern < pattern_end && (*pattern == '?' || *pattern == *s)) {
+            pattern++;
+            s++;
+        } else if (pattern < pattern_end && *pattern == '*') {
+            star = pattern++;
+            star_s = s;
+        } else if (star != NULL) {
+            pattern = star + 1;
+            s = ++star_s;
+        } else {
+            return false;
+        }
+    }
+
+    while (pattern < pattern_end && *pattern == '*') {
+        pattern++;
+    }
+    return pattern == pattern_end;
+}
+
+void ThreadFilter::init(const char* filter, const char* name_patterns) {
+    // ThreadStart and thread rename callbacks may still be matching names against the old patterns,
+    // so they are never freed. Sessions mostly repeat the same patterns, which are then kept as they are
+    if (name_patterns == NULL) {
+        _name_patterns = NULL;
+    } else if (_name_patterns == NULL || strcmp(_name_patterns, name_patterns) != 0) {
+        _name_patterns = strdup(name_patterns);
+    }
+
+    _explicit = filter != NULL;
     if (filter == NULL) {
-        _enabled = false;
+        _enabled = _name_patterns != NULL;
         return;
     }
 
@@ -69,21 +112,78 @@ void ThreadFilter::clear() {
         if (_bitmap[i] != NULL) {
             memset(_bitmap[i], 0, BITMAP_SIZE);
         }
+        if (_named[i] != NULL) {
+            memset(_named[i], 0, BITMAP_SIZE);
+        }
     }
     _size = 0;
 }
 
+bool ThreadFilter::matchName(const char* name) {
+    for (const char* p = _name_patterns; p != NULL; ) {
+        const char* end = strchr(p, ';');
+        if (globMatch(p, end != NULL ? end : p + strlen(p), name)) {
+            return true;
+        }
+        p = end != NULL ? end + 1 : NULL;
+    }
+    return false;
+}
+
+// Called when a thread starts or gets renamed. Only the name-selected set changes here:
+// a thread added explicitly stays profiled whatever its name is.
+// Returns true if the thread has just become profiled
+bool ThreadFilter::updateName(int thread_id, const char* name) {
+    if (!matchName(name)) {
+        if (reset(_named, thread_id) && !test(_bitmap, thread_id)) {
+            atomicInc(_size, -1);
+        }
+        return false;
+    }
+
+    if (set(_named, thread_id) && !test(_bitmap, thread_id)) {
+        atomicInc(_size);
+        return true;
+    }
+    return false;
+}
+
 bool ThreadFilter::accept(int thread_id) {
-    u32* b = bitmap(thread_id);
-    return b != NULL && (word(b, thread_id) & (1 << (thread_id & 0x1f)));
+    return test(_bitmap, thread_id) || test(_named, thread_id);
 }
 
 void ThreadFilter::add(int thread_id) {
-    u32* b = bitmap(thread_id);
+    if (set(_bitmap, thread_id) && !test(_named, thread_id)) {
+        atomicInc(_size);
+    }
+}
+
+void ThreadFilter::remove(int thread_id) {
+    if (reset(_bitmap, thread_id) && !test(_named, thread_id)) {
+        atomicInc(_size, -1);
+    }
+}
+
+// Drops the thread from both sets, since its ID may be reused by a new thread
+void ThreadFilter::forget(int thread_id) {
+    bool removed = reset(_bitmap, thread_id);
+    if (reset(_named, thread_id) || removed) {
+        atomicInc(_size, -1);
+    }
+}
+
+bool ThreadFilter::test(u32** bitmaps, int thread_id) {
+    u32* b = bitmaps[(u32)thread_id / BITMAP_CAPACITY];
+    return b != NULL && (word(b, thread_id) & (1 << (thread_id & 0x1f)));
+}
+
+// Returns true if the bit was not set before
+bool ThreadFilter::set(u32** bitmaps, int thread_id) {
+    u32* b = bitmaps[(u32)thread_id / BITMAP_CAPACITY];
     if (b == NULL) {
         // Use mmap() rather than malloc() to allow calling from signal handler
         b = (u32*)mmap(NULL, BITMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        u32* oldb = __sync_val_compare_and_swap(&_bitmap[(u32)thread_id / BITMAP_CAPACITY], NULL, b);
+        u32* oldb = __sync_val_compare_and_swap(&bitmaps[(u32)thread_id / BITMAP_CAPACITY], NULL, b);
         if (oldb != NULL) {
             munmap(b, BITMAP_SIZE);
             b = oldb;
@@ -91,21 +191,31 @@ void ThreadFilter::add(int thread_id) {
     }
 
     u32 bit = 1 << (thread_id & 0x1f);
-    if (!(__sync_fetch_and_or(&word(b, thread_id), bit) & bit)) {
-        atomicInc(_size);
-    }
+    return !(__sync_fetch_and_or(&word(b, thread_id), bit) & bit);
 }
 
-void ThreadFilter::remove(int thread_id) {
-    u32* b = bitmap(thread_id);
+// Returns true if the bit was set before
+bool ThreadFilter::reset(u32** bitmaps, int thread_id) {
+    u32* b = bitmaps[(u32)thread_id / BITMAP_CAPACITY];
     if (b == NULL) {
-        return;
+        return false;
     }
 
     u32 bit = 1 << (thread_id & 0x1f);
-    if (__sync_fetch_and_and(&word(b, thread_id), ~bit) & bit) {
-        atomicInc(_size, -1);
+    return (__sync_fetch_and_and(&word(b, thread_id), ~bit) & bit) != 0;
+}
+
+size_t ThreadFilter::memoryUsage() {
+    size_t usage = 0;
+    for (int i = 0; i < MAX_BITMAPS; i++) {
+        if (_bitmap[i] != NULL) {
+            usage += Arena::residentSize(_bitmap[i], BITMAP_SIZE);
+        }
+        if (_named[i] != NULL) {
+            usage += Arena::residentSize(_named[i], BITMAP_SIZE);
+        }
     }
+    return usage;
 }
 
 int ThreadFilter::collect(int* array, int max_count) {
@@ -113,10 +223,11 @@ int ThreadFilter::collect(int* array, int max_count) {
 
     for (int i = 0; i < MAX_BITMAPS; i++) {
         u32* b = _bitmap[i];
-        if (b != NULL) {
+        u32* n = _named[i];
+        if (b != NULL || n != NULL) {
             int start_id = i * BITMAP_CAPACITY;
             for (int j = 0; j < BITMAP_SIZE / sizeof(u32); j++) {
-                u32 word = b[j];
+                u32 word = (b != NULL ? b[j] : 0) | (n != NULL ? n[j] : 0);
                 if (word) {
                     for (int bit = 0; bit < 32; bit++) {
                         if (word & (1 << bit)) {
@@ -17,6 +17,7 @@
 #ifndef _THREADFILTER_H
 #define _THREADFILTER_H
 
+#include <stddef.h>
 #include "arch.h"
 
 
@@ -29,21 +30,26 @@ const u32 MAX_BITMAPS = (1 << 31) / BITMAP_CAPACITY;
 
 
 // ThreadFilter query operations must be lock-free and signal-safe;
-// update operations are mostly lock-free, except rare bitmap allocations
+// update operations are mostly lock-free, except rare bitmap allocations.
+// Threads added explicitly and threads selected by name are kept in separate sets,
+// so that renaming a thread never drops it from the explicit set
 class ThreadFilter {
   private:
     u32* _bitmap[MAX_BITMAPS];
+    u32* _named[MAX_BITMAPS];
     bool _enabled;
+    bool _explicit;
     volatile int _size;
+    char* _name_patterns;  // ';'-separated glob patterns of thread names
 
-    u32* bitmap(int thread_id) {
-        return _bitmap[(u32)thread_id / BITMAP_CAPACITY];
-    }
-
-    u32& word(u32* bitmap, int thread_id) {
+    static u32& word(u32* bitmap, int thread_id) {
         return bitmap[((u32)thread_id % BITMAP_CAPACITY) >> 5];
     }
 
+    static bool test(u32** bitmaps, int thread_id);
+    static bool set(u32** bitmaps, int thread_id);
+    static bool reset(u32** bitmaps, int thread_id);
+
   public:
     ThreadFilter();
     ~ThreadFilter();
@@ -56,14 +62,29 @@ class ThreadFilter {
         return _size;
     }
 
-    void init(const char* filter);
+    bool hasNamePatterns() {
+        return _name_patterns != NULL;
+    }
+
+    // Tells if only the name decides whether a thread is profiled: nothing can be added by ID
+    bool selectsOnlyByName() {
+        return _name_patterns != NULL && !_explicit;
+    }
+
+    void init(const char* filter, const char* name_patterns);
     void clear();
 
+    bool matchName(const char* name);
+    bool updateName(int thread_id, const char* name);
+
     bool accept(int thread_id);
     void add(int thread_id);
     void remove(int thread_id);
+    void forget(int thread_id);
 
     int collect(int* array, int max_count);
+
+    size_t memoryUsage();
 };
 
 #endif // _THREADFILTER_H
@@ -0,0 +1,287 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "threadRegistry.h"
+
+
+static const size_t RECORDS_SIZE = MAX_THREAD_RECORDS * sizeof(ThreadRecord);
+
+static inline void copyString(char* dst, const char* src, size_t size) {
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = 0;
+}
+
+
+ThreadRegistry::ThreadRegistry() {
+    // Pages are committed lazily, so memory is proportional to the number of touched records
+    _records = (ThreadRecord*)mmap(NULL, RECORDS_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    _max_probe = 0;
+}
+
+ThreadRegistry::~ThreadRegistry() {
+    munmap(_records, RECORDS_SIZE);
+}
+
+// Called between profiling sessions, when no samples are being counted.
+// Mapping fresh zero pages over the table returns touched pages to the OS
+// instead of committing the whole table, as writing zeros would
+void ThreadRegistry::clear() {
+    if (mmap(_records, RECORDS_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        // Old records must not survive into the next session either way
+        memset(_records, 0, RECORDS_SIZE);
+    }
+    _max_probe = 0;
+}
+
+size_t ThreadRegistry::memoryUsage() {
+    return Arena::residentSize(_records, RECORDS_SIZE);
+}
+
+// A slot never becomes free again except by clear(): records of exited threads are taken over
+// by new threads in place. So a thread's record is always within _max_probe slots
+// from its home position, and a free slot ends the search
+ThreadRecord* ThreadRegistry::lookup(int tid) {
+    int max_probe = _max_probe;
+    for (int probe = 0; probe <= max_probe; probe++) {
+        ThreadRecord* r = &_records[(u32)(tid + probe) % MAX_THREAD_RECORDS];
+        int current = r->_tid;
+        if (current == tid) {
+            return r;
+        } else if (current == 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Finds or creates a record for the given thread and locks it for update.
+// A free slot close to the home position is preferred; otherwise
+// the first record of an exited thread is reused.
+ThreadRecord* ThreadRegistry::acquire(int tid) {
+    while (true) {
+        ThreadRecord* free_slot = NULL;
+        ThreadRecord* recyclable = NULL;
+        int free_probe = 0;
+        int recyclable_probe = 0;
+        int recyclable_tid = 0;
+        bool raced = false;
+
+        int max_probe = _max_probe;
+        for (int probe = 0; probe < MAX_THREAD_RECORDS; probe++) {
+            ThreadRecord* r = &_records[(u32)(tid + probe) % MAX_THREAD_RECORDS];
+            int current = r->_tid;
+            if (current == tid) {
+                lock(r);
+                if (r->_tid == tid) {
+                    return r;
+                }
+                release(r);
+                raced = true;
+                break;
+            } else if (current == 0) {
+                free_slot = r;
+                free_probe = probe;
+                break;
+            } else if (recyclable == NULL && r->_end_time != 0) {
+                recyclable = r;
+                recyclable_probe = probe;
+                recyclable_tid = current;
+            }
+
+            if (recyclable != NULL && probe >= max_probe && probe >= MAX_THREAD_PROBE - 1) {
+                break;
+            }
+        }
+
+        if (raced) {
+            continue;
+        } else if (free_slot != NULL && (free_probe < MAX_THREAD_PROBE || recyclable == NULL)) {
+            if (__sync_bool_compare_and_swap(&free_slot->_tid, 0, tid)) {
+                lock(free_slot);
+                updateMaxProbe(free_probe);
+                return free_slot;
+            }
+        } else if (recyclable != NULL) {
+            lock(recyclable);
+            if (recyclable->_tid == recyclable_tid && recyclable->_end_time != 0) {
+                recyclable->_tid = tid;
+                reset(recyclable);
+                updateMaxProbe(recyclable_probe);
+                return recyclable;
+            }
+            release(recyclable);
+        } else if (free_slot == NULL) {
+            // All records belong to live threads
+            return NULL;
+        }
+        // Lost a race with another thread; retry
+    }
+}
+
+void ThreadRegistry::lock(ThreadRecord* record) {
+    u32 version;
+    while (((version = record->_version) & 1) || !__sync_bool_compare_and_swap(&record->_version, version, version + 1)) {
+        spinPause();
+    }
+}
+
+void ThreadRegistry::release(ThreadRecord* record) {
+    __sync_fetch_and_add(&record->_version, 1);
+}
+
+void ThreadRegistry::updateMaxProbe(int probe) {
+    int max_probe;
+    while (probe > (max_probe = _max_probe) && !__sync_bool_compare_and_swap(&_max_probe, max_probe, probe)) {
+        spinPause();
+    }
+}
+
+void ThreadRegistry::reset(ThreadRecord* record) {
+    record->_java_thread_id = 0;
+    record->_start_time = 0;
+    record->_end_time = 0;
+    record->_cpu_time = 0;
+    record->_cpu_start = 0;
+    record->_cpu_active = false;
+    record->_samples = 0;
+    record->_name[0] = 0;
+    record->_group[0] = 0;
+}
+
+bool ThreadRegistry::snapshot(ThreadRecord* record, ThreadRecord* copy) {
+    while (true) {
+        u32 version = record->_version;
+        if (version & 1) {
+            spinPause();
+            continue;
+        }
+
+        __sync_synchronize();
+        memcpy(copy, (const void*)record, sizeof(ThreadRecord));
+        __sync_synchronize();
+
+        if (record->_version == version) {
+            return copy->_tid != 0;
+        }
+    }
+}
+
+void ThreadRegistry::stopCpuAccounting(ThreadRecord* record, u64 cpu_time) {
+    if (record->_cpu_active && cpu_time >= record->_cpu_start) {
+        record->_cpu_time += cpu_time - record->_cpu_start;
+    }
+    record->_cpu_active = false;
+}
+
+void ThreadRegistry::threadStart(int tid, u64 time, u64 cpu_time) {
+    ThreadRecord* r = acquire(tid);
+    if (r != NULL) {
+        if (r->_end_time != 0) {
+            // OS has reused the ID of an exited thread
+            reset(r);
+        }
+        r->_start_time = time;
+        r->_cpu_start = cpu_time;
+        r->_cpu_active = true;
+        release(r);
+    }
+}
+
+void ThreadRegistry::threadEnd(int tid, u64 time, u64 cpu_time) {
+    ThreadRecord* r = lookup(tid);
+    if (r != NULL) {
+        lock(r);
+        if (r->_tid == tid) {
+            r->_end_time = time;
+            stopCpuAccounting(r, cpu_time);
+        }
+        release(r);
+    }
+}
+
+void ThreadRegistry::update(int tid, const char* name, jlong java_thread_id, const char* group) {
+    ThreadRecord* r = acquire(tid);
+    if (r != NULL) {
+        copyString(r->_name, name, sizeof(r->_name));
+        if (java_thread_id != 0) r->_java_thread_id = java_thread_id;
+        if (group != NULL) copyString(r->_group, group, sizeof(r->_group));
+        release(r);
+    }
+}
+
+// Recreates a record saved earlier, e.g. in a snapshot
+void ThreadRegistry::restore(const ThreadRecord* record) {
+    ThreadRecord* r = acquire(record->_tid);
+    if (r != NULL) {
+        r->_java_thread_id = record->_java_thread_id;
+        r->_start_time = record->_start_time;
+        r->_end_time = record->_end_time;
+        r->_cpu_time = record->_cpu_time;
+        r->_cpu_start = 0;
+        r->_cpu_active = false;
+        r->_samples = record->_samples;
+        copyString(r->_name, record->_name, sizeof(r->_name));
+        copyString(r->_group, record->_group, sizeof(r->_group));
+        release(r);
+    }
+}
+
+void ThreadRegistry::cpuStart(int tid, u64 cpu_time) {
+    ThreadRecord* r = acquire(tid);
+    if (r != NULL) {
+        r->_cpu_start = cpu_time;
+        r->_cpu_active = true;
+        release(r);
+    }
+}
+
+void ThreadRegistry::cpuStop(int tid, u64 cpu_time) {
+    ThreadRecord* r = lookup(tid);
+    if (r != NULL) {
+        lock(r);
+        if (r->_tid == tid) {
+            stopCpuAccounting(r, cpu_time);
+        }
+        release(r);
+    }
+}
+
+// Called from a signal handler: no record locking here,
+// since the interrupted thread may be updating its own record
+bool ThreadRegistry::countSample(int tid) {
+    ThreadRecord* r = lookup(tid);
+    if (r != NULL) {
+        atomicInc(r->_samples);
+        return true;
+    }
+    return false;
+}
+
+bool ThreadRegistry::contains(int tid) {
+    return lookup(tid) != NULL;
+}
+
+bool ThreadRegistry::get(int tid, ThreadRecord* copy) {
+    ThreadRecord* r = lookup(tid);
+    return r != NULL && snapshot(r, copy) && copy->_tid == tid;
+}
+
+bool ThreadRegistry::getAt(int index, ThreadRecord* copy) {
+    return snapshot(&_records[index], copy);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _THREADREGISTRY_H
+#define _THREADREGISTRY_H
+
+#include <jni.h>
+#include "arch.h"
+
+
+// Maximum number of thread records; records of exited threads are recycled
+// when a new thread does not find a free slot nearby
+const int MAX_THREAD_RECORDS = 16384;
+// How far a new thread looks for a free slot before reusing an exited thread's record
+const int MAX_THREAD_PROBE = 16;
+
+const int MAX_THREAD_NAME = 96;
+const int MAX_THREAD_GROUP_NAME = 32;
+
+
+class ThreadRecord {
+  public:
+    volatile int _tid;
+    volatile u32 _version;   // odd while the record is being updated
+    jlong _java_thread_id;
+    u64 _start_time;
+    u64 _end_time;           // 0 while the thread is alive
+    u64 _cpu_time;           // CPU time consumed while profiling, ns
+    u64 _cpu_start;          // thread CPU clock when profiling started
+    bool _cpu_active;
+    volatile u64 _samples;
+    char _name[MAX_THREAD_NAME];
+    char _group[MAX_THREAD_GROUP_NAME];
+
+    static int comparator(const void* r1, const void* r2) {
+        const ThreadRecord* t1 = (const ThreadRecord*)r1;
+        const ThreadRecord* t2 = (const ThreadRecord*)r2;
+        if (t1->_cpu_time != t2->_cpu_time) {
+            return t1->_cpu_time < t2->_cpu_time ? 1 : -1;
+        }
+        return t1->_samples < t2->_samples ? 1 : t1->_samples > t2->_samples ? -1 : 0;
+    }
+};
+
+
+// Thread metadata indexed by OS thread ID.
+// Readers are lock-free and get a consistent snapshot of a record;
+// concurrent updates of the same record are serialized by its version counter.
+class ThreadRegistry {
+  private:
+    ThreadRecord* _records;
+    volatile int _max_probe;
+
+    ThreadRecord* lookup(int tid);
+    ThreadRecord* acquire(int tid);
+    void lock(ThreadRecord* record);
+    void release(ThreadRecord* record);
+    void updateMaxProbe(int probe);
+    void reset(ThreadRecord* record);
+    void stopCpuAccounting(ThreadRecord* record, u64 cpu_time);
+    bool snapshot(ThreadRecord* record, ThreadRecord* copy);
+
+  public:
+    ThreadRegistry();
+    ~ThreadRegistry();
+
+    int capacity() {
+        return MAX_THREAD_RECORDS;
+    }
+
+    void clear();
+    size_t memoryUsage();
+
+    void threadStart(int tid, u64 time, u64 cpu_time);
+    void threadEnd(int tid, u64 time, u64 cpu_time);
+    void update(int tid, const char* name, jlong java_thread_id, const char* group);
+    void restore(const ThreadRecord* record);
+    bool contains(int tid);
+
+    void cpuStart(int tid, u64 cpu_time);
+    void cpuStop(int tid, u64 cpu_time);
+    bool countSample(int tid);
+
+    bool get(int tid, ThreadRecord* copy);
+    bool getAt(int index, ThreadRecord* copy);
+};
+
+#endif // _THREADREGISTRY_H
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "trigger.h"
+#include "os.h"
+#include "profiler.h"
+#include "vmEntry.h"
+
+
+char* Trigger::_options = NULL;
+TriggerType Trigger::_type = TRIGGER_NONE;
+u64 Trigger::_threshold;
+u64 Trigger::_duration;
+volatile bool Trigger::_running = false;
+bool Trigger::_thread_started = false;
+pthread_t Trigger::_thread;
+WaitableMutex Trigger::_lock;
+volatile u64 Trigger::_gc_start = 0;
+volatile u64 Trigger::_max_gc_pause = 0;
+
+
+// Remembers the original options, since the file pattern is expanded anew for every session
+Error Trigger::arm(const char* options, Arguments& args) {
+    if (_options != NULL) {
+        return Error("Trigger is already set");
+    } else if (args._action == ACTION_START || args._action == ACTION_RESUME) {
+        return Error("trigger cannot be combined with start");
+    } else if (args._file == NULL) {
+        return Error("trigger requires file");
+    }
+
+    if (args._trigger == TRIGGER_GC) {
+        jvmtiEnv* jvmti = VM::jvmti();
+        jvmtiCapabilities capabilities = {0};
+        capabilities.can_generate_garbage_collection_events = 1;
+        if (jvmti->AddCapabilities(&capabilities) != 0) {
+            return Error("GC events are not available");
+        }
+        jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_START, NULL);
+        jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH, NULL);
+    }
+
+    _options = strdup(options);
+    _type = args._trigger;
+    _threshold = args._trigger_threshold;
+    _duration = args._trigger_duration;
+    return Error::OK;
+}
+
+// Profiling sessions require a live VM, so the watcher starts after VM initialization
+Error Trigger::start() {
+    if (_options == NULL || _thread_started) {
+        return Error::OK;
+    }
+
+    _running = true;
+    if (pthread_create(&_thread, NULL, threadEntry, NULL) != 0) {
+        _running = false;
+        return Error("Unable to create trigger thread");
+    }
+
+    _thread_started = true;
+    return Error::OK;
+}
+
+// Interrupts the current session, if any, and waits until it is dumped
+void Trigger::stop() {
+    if (_thread_started) {
+        _lock.lock();
+        _running = false;
+        _lock.notify();
+        _lock.unlock();
+
+        pthread_join(_thread, NULL);
+        _thread_started = false;
+    }
+}
+
+void* Trigger::threadEntry(void* unused) {
+    if (VM::attachThread("Async-profiler Trigger") != NULL) {
+        watchLoop();
+        VM::detachThread();
+    }
+    return NULL;
+}
+
+void Trigger::watchLoop() {
+    MutexLocker ml(_lock);
+
+    u64 last_cpu_time = OS::processCpuTime();
+    u64 last_time = OS::nanotime();
+
+    while (_running) {
+        _lock.waitUntil(OS::millis() + TRIGGER_CHECK_INTERVAL);
+        if (!_running) {
+            break;
+        }
+
+        u64 cpu_time = OS::processCpuTime();
+        u64 time = OS::nanotime();
+        u64 max_gc_pause = __sync_lock_test_and_set(&_max_gc_pause, 0);
+
+        bool fired = _type == TRIGGER_CPU
+            ? (cpu_time - last_cpu_time) * 100 > _threshold * (time - last_time)
+            : max_gc_pause > _threshold;
+
+        if (fired) {
+            runSession();
+            // Do not count the session itself, including profiling overhead
+            cpu_time = OS::processCpuTime();
+            time = OS::nanotime();
+            __sync_lock_test_and_set(&_max_gc_pause, 0);
+        }
+
+        last_cpu_time = cpu_time;
+        last_time = time;
+    }
+}
+
+// Called with _lock held; the lock is released while the profiler is starting or dumping,
+// and while the session runs, so that stop() is never blocked for the whole session
+void Trigger::runSession() {
+    Arguments args;
+    if (args.parse(_options)) {
+        return;
+    }
+
+    args._action = ACTION_START;
+    _lock.unlock();
+    Error error = Profiler::_instance.start(args, true);
+    _lock.lock();
+    if (error) {
+        // Profiler is busy, e.g. it has been started manually
+        return;
+    }
+
+    u64 deadline = OS::millis() + _duration / 1000000;
+    while (_running && OS::millis() < deadline) {
+        _lock.waitUntil(deadline);
+    }
+
+    args._action = ACTION_DUMP;
+    _lock.unlock();
+    Profiler::_instance.run(args);
+    _lock.lock();
+}
+
+void JNICALL Trigger::GarbageCollectionStart(jvmtiEnv* jvmti) {
+    _gc_start = OS::nanotime();
+}
+
+void JNICALL Trigger::GarbageCollectionFinish(jvmtiEnv* jvmti) {
+    u64 pause = OS::nanotime() - _gc_start;
+    u64 max_pause;
+    while (pause > (max_pause = _max_gc_pause) && !__sync_bool_compare_and_swap(&_max_gc_pause, max_pause, pause)) {
+        // retry
+    }
+}
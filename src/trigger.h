@@ -0,0 +1,57 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TRIGGER_H
+#define _TRIGGER_H
+
+#include <jvmti.h>
+#include <pthread.h>
+#include "arguments.h"
+#include "mutex.h"
+
+
+const u64 TRIGGER_CHECK_INTERVAL = 1000;  // ms
+
+// Watches a cheap signal (process CPU usage or GC pauses) once a second and,
+// when it crosses the threshold, runs a profiling session of the given duration
+// with the agent arguments. Each session dumps to a freshly expanded 'file' pattern.
+class Trigger {
+  private:
+    static char* _options;
+    static TriggerType _type;
+    static u64 _threshold;
+    static u64 _duration;
+    static volatile bool _running;
+    static bool _thread_started;
+    static pthread_t _thread;
+    static WaitableMutex _lock;
+    static volatile u64 _gc_start;
+    static volatile u64 _max_gc_pause;
+
+    static void* threadEntry(void* unused);
+    static void watchLoop();
+    static void runSession();
+
+  public:
+    static Error arm(const char* options, Arguments& args);
+    static Error start();
+    static void stop();
+
+    static void JNICALL GarbageCollectionStart(jvmtiEnv* jvmti);
+    static void JNICALL GarbageCollectionFinish(jvmtiEnv* jvmti);
+};
+
+#endif // _TRIGGER_H
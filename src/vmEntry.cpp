@@ -19,11 +19,14 @@
 #include <string.h>
 #include "vmEntry.h"
 #include "arguments.h"
+#include "controlServer.h"
 #include "javaApi.h"
 #include "os.h"
 #include "profiler.h"
 #include "instrument.h"
+#include "exceptionTracer.h"
 #include "lockTracer.h"
+#include "trigger.h"
 #include "vmStructs.h"
 
 
@@ -91,6 +94,9 @@ void VM::init(JavaVM* vm, bool attach) {
     callbacks.ThreadEnd = Profiler::ThreadEnd;
     callbacks.MonitorContendedEnter = LockTracer::MonitorContendedEnter;
     callbacks.MonitorContendedEntered = LockTracer::MonitorContendedEntered;
+    callbacks.Exception = ExceptionTracer::ExceptionThrown;
+    callbacks.GarbageCollectionStart = Trigger::GarbageCollectionStart;
+    callbacks.GarbageCollectionFinish = Trigger::GarbageCollectionFinish;
     _jvmti->SetEventCallbacks(&callbacks, sizeof(callbacks));
 
     _jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_VM_INIT, NULL);
@@ -119,6 +125,22 @@ void VM::ready() {
     _libjava = getLibraryHandle("libjava.so");
 }
 
+JNIEnv* VM::attachThread(const char* name) {
+    JNIEnv* jni;
+    JavaVMAttachArgs args = {JNI_VERSION_1_6, (char*)name, NULL};
+    return _vm->AttachCurrentThreadAsDaemon((void**)&jni, &args) == 0 ? jni : NULL;
+}
+
+void VM::detachThread() {
+    _vm->DetachCurrentThread();
+}
+
+void VM::saveArgs(Arguments& args) {
+    if (args._action == ACTION_START || args._action == ACTION_RESUME) {
+        _agent_args.save(args);
+    }
+}
+
 void* VM::getLibraryHandle(const char* name) {
     if (!OS::isJavaLibraryVisible()) {
         void* handle = dlopen(name, RTLD_LAZY);
@@ -164,15 +186,40 @@ void VM::loadAllMethodIDs(jvmtiEnv* jvmti, JNIEnv* jni) {
     }
 }
 
+static void startServer(Arguments& args) {
+    if (args._server != NULL) {
+        Error error = ControlServer::start(args._server);
+        if (error) {
+            std::cerr << error.message() << std::endl;
+        }
+    }
+}
+
+static void startTrigger() {
+    Error error = Trigger::start();
+    if (error) {
+        std::cerr << error.message() << std::endl;
+    }
+}
+
 void JNICALL VM::VMInit(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread) {
     ready();
     loadAllMethodIDs(jvmti, jni);
 
-    // Delayed start of profiler if agent has been loaded at VM bootstrap
-    Profiler::_instance.run(_agent_args);
+    // Delayed start of profiler if agent has been loaded at VM bootstrap.
+    // With a trigger, profiling starts only when the trigger fires
+    if (_agent_args._trigger == TRIGGER_NONE) {
+        Profiler::_instance.run(_agent_args);
+    }
+
+    // Server and trigger threads need a live VM to attach to
+    startServer(_agent_args);
+    startTrigger();
 }
 
 void JNICALL VM::VMDeath(jvmtiEnv* jvmti, JNIEnv* jni) {
+    ControlServer::stop();
+    Trigger::stop();
     Profiler::_instance.shutdown(_agent_args);
 }
 
@@ -182,6 +229,12 @@ Agent_OnLoad(JavaVM* vm, char* options, void* reserved) {
     VM::init(vm, false);
 
     Error error = _agent_args.parse(options);
+    if (!error && _agent_args._trigger != TRIGGER_NONE) {
+        error = Trigger::arm(options, _agent_args);
+    }
+    if (!error && strcmp(_agent_args._event, EVENT_EXCEPTIONS) == 0) {
+        error = ExceptionTracer::addCapability();
+    }
     if (error) {
         std::cerr << error.message() << std::endl;
         return -1;
@@ -201,11 +254,21 @@ Agent_OnAttach(JavaVM* vm, char* options, void* reserved) {
         return -1;
     }
 
-    // Save the arguments in case of shutdown
-    if (args._action == ACTION_START || args._action == ACTION_RESUME) {
+    if (args._trigger != TRIGGER_NONE) {
+        error = Trigger::arm(options, args);
+        if (error) {
+            std::cerr << error.message() << std::endl;
+            return -1;
+        }
+        // Like the agent loaded at startup with a trigger, a session running at shutdown is dumped
         _agent_args.save(args);
+        startTrigger();
+    } else {
+        // Save the arguments in case of shutdown
+        VM::saveArgs(args);
+        Profiler::_instance.run(args);
     }
-    Profiler::_instance.run(args);
+    startServer(args);
 
     return 0;
 }
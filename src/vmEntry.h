@@ -28,8 +28,33 @@ enum ASGCT_CallFrameType {
     BCI_THREAD_ID           = -13,  // method_id designates a thread
     BCI_ERROR               = -14,  // method_id is error string
     BCI_INSTRUMENT          = -15,  // synthetic method_id that should not appear in the call stack
+    BCI_CONTEXT_TAG         = -16,  // method_id is a request context tag
 };
 
+// Execution mode of a Java frame, kept in the upper bits of a non-negative bci
+enum FrameType {
+    FRAME_TYPE_UNKNOWN      = 0,
+    FRAME_TYPE_INTERPRETED  = 1,
+    FRAME_TYPE_JIT_COMPILED = 2,    // C2
+    FRAME_TYPE_C1_COMPILED  = 3,
+    FRAME_TYPE_INLINED      = 4
+};
+
+const int FRAME_TYPE_SHIFT = 24;
+const jint FRAME_BCI_MASK = (1 << FRAME_TYPE_SHIFT) - 1;
+
+static inline jint encodeFrameType(FrameType type, jint bci) {
+    return (jint)type << FRAME_TYPE_SHIFT | (bci & FRAME_BCI_MASK);
+}
+
+static inline FrameType decodeFrameType(jint bci) {
+    return bci >= 0 ? (FrameType)(bci >> FRAME_TYPE_SHIFT) : FRAME_TYPE_UNKNOWN;
+}
+
+static inline jint decodeBci(jint bci) {
+    return bci >= 0 ? bci & FRAME_BCI_MASK : bci;
+}
+
 // See hotspot/src/share/vm/prims/forte.cpp
 enum ASGCT_Failure {
     ticks_no_Java_frame         =  0,
@@ -61,6 +86,8 @@ typedef struct {
 typedef void (*AsyncGetCallTrace)(ASGCT_CallTrace*, jint, void*);
 
 
+class Arguments;
+
 class VM {
   private:
     static JavaVM* _vm;
@@ -88,6 +115,12 @@ class VM {
         return _vm->GetEnv((void**)&jni, JNI_VERSION_1_6) == 0 ? jni : NULL;
     }
 
+    static JNIEnv* attachThread(const char* name);
+    static void detachThread();
+
+    // Keeps the arguments of a started session, so that it is dumped at VM shutdown
+    static void saveArgs(Arguments& args);
+
     static int hotspot_version() {
         return _hotspot_version;
     }
@@ -36,10 +36,13 @@ int VMStructs::_class_loader_data_offset = -1;
 int VMStructs::_methods_offset = -1;
 int VMStructs::_thread_osthread_offset = -1;
 int VMStructs::_thread_anchor_offset = -1;
+int VMStructs::_thread_stack_base_offset = -1;
 int VMStructs::_osthread_id_offset = -1;
 int VMStructs::_anchor_sp_offset = -1;
 int VMStructs::_anchor_pc_offset = -1;
 int VMStructs::_frame_size_offset = -1;
+int VMStructs::_frame_complete_offset = -1;
+int VMStructs::_comp_level_offset = -1;
 
 jfieldID VMStructs::_eetop;
 jfieldID VMStructs::_tid;
@@ -119,6 +122,10 @@ void VMStructs::initOffsets() {
             } else if (strcmp(field, "_anchor") == 0) {
                 _thread_anchor_offset = *(int*)(entry + offset_offset);
             }
+        } else if (strcmp(type, "Thread") == 0) {
+            if (strcmp(field, "_stack_base") == 0) {
+                _thread_stack_base_offset = *(int*)(entry + offset_offset);
+            }
         } else if (strcmp(type, "OSThread") == 0) {
             if (strcmp(field, "_thread_id") == 0) {
                 _osthread_id_offset = *(int*)(entry + offset_offset);
@@ -132,6 +139,12 @@ void VMStructs::initOffsets() {
         } else if (strcmp(type, "CodeBlob") == 0) {
             if (strcmp(field, "_frame_size") == 0) {
                 _frame_size_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_frame_complete_offset") == 0) {
+                _frame_complete_offset = *(int*)(entry + offset_offset);
+            }
+        } else if (strcmp(type, "nmethod") == 0) {
+            if (strcmp(field, "_comp_level") == 0) {
+                _comp_level_offset = *(int*)(entry + offset_offset);
             }
         } else if (strcmp(type, "PermGen") == 0) {
             _has_perm_gen = true;
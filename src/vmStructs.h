@@ -39,10 +39,13 @@ class VMStructs {
     static int _methods_offset;
     static int _thread_osthread_offset;
     static int _thread_anchor_offset;
+    static int _thread_stack_base_offset;
     static int _osthread_id_offset;
     static int _anchor_sp_offset;
     static int _anchor_pc_offset;
     static int _frame_size_offset;
+    static int _frame_complete_offset;
+    static int _comp_level_offset;
 
     static jfieldID _eetop;
     static jfieldID _tid;
@@ -94,6 +97,8 @@ class VMStructs {
 
     typedef void (JNICALL *UnsafeParkFunc)(JNIEnv*, jobject, jboolean, jlong);
     static UnsafeParkFunc _unsafe_park;
+
+    friend class Snapshot;
 };
 
 
@@ -210,6 +215,15 @@ class VMThread : VMStructs {
         return *(int*)(osthread + _osthread_id_offset);
     }
 
+    static bool hasStackBase() {
+        return _has_thread_bridge && _thread_stack_base_offset >= 0;
+    }
+
+    // The highest address of the thread's stack, or 0 while it is not yet known
+    uintptr_t stackBase() {
+        return *(uintptr_t*) at(_thread_stack_base_offset);
+    }
+
     uintptr_t& lastJavaSP() {
         return *(uintptr_t*) (at(_thread_anchor_offset) + _anchor_sp_offset);
     }
@@ -230,4 +244,27 @@ class RuntimeStub : VMStructs {
     }
 };
 
+class NMethod : VMStructs {
+  public:
+    static NMethod* findBlob(const void* pc) {
+        return _find_blob != NULL && _comp_level_offset >= 0 ? (NMethod*)_find_blob(pc) : NULL;
+    }
+
+    // CompLevel is int in JDK 8 and a single byte in recent JDKs;
+    // on little-endian platforms the first byte holds the value in both cases
+    int level() {
+        return *(signed char*) at(_comp_level_offset);
+    }
+
+    // In words, including the return address
+    int frameSize() {
+        return *(int*) at(_frame_size_offset);
+    }
+
+    // Relative to the code begin; -1 if unknown
+    int frameCompleteOffset() {
+        return _frame_complete_offset >= 0 ? *(int*) at(_frame_complete_offset) : -1;
+    }
+};
+
 #endif // _VMSTRUCTS_H
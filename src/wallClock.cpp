@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <limits.h>
 #include <signal.h>
 #include <string.h>
 #include <time.h>
@@ -64,7 +65,9 @@ ThreadState WallClock::getThreadState(void* ucontext) {
 
 void WallClock::signalHandler(int signo, siginfo_t* siginfo, void* ucontext) {
     ThreadState thread_state = _sample_idle_threads ? getThreadState(ucontext) : THREAD_RUNNING;
-    Profiler::_instance.recordSample(ucontext, _interval, 0, NULL, thread_state);
+    // A burst signal carries its tick, so that a late handler is not counted in the next tick
+    u32 tick = siginfo->si_code == SI_QUEUE ? (u32)siginfo->si_value.sival_int : Profiler::_instance.concurrency()->tick();
+    Profiler::_instance.recordSample(ucontext, _interval, 0, NULL, thread_state, tick);
 }
 
 void WallClock::wakeupHandler(int signo) {
@@ -120,17 +123,26 @@ void WallClock::timerLoop() {
     bool thread_filter_enabled = thread_filter->enabled();
     bool sample_idle_threads = _sample_idle_threads;
 
+    // To see which frames run in parallel, every tick samples all threads in one burst
+    ConcurrencyLog* concurrency = Profiler::_instance.concurrency();
+    bool burst = concurrency->enabled();
+    int threads_per_tick = burst ? INT_MAX : THREADS_PER_TICK;
+
     ThreadList* thread_list = OS::listThreads();
     long long next_cycle_time = OS::nanotime();
 
     while (_running) {
-        if (sample_idle_threads) {
+        if (burst) {
+            thread_list->rewind();
+            concurrency->nextTick();
+            next_cycle_time += _interval;
+        } else if (sample_idle_threads) {
             // Try to keep the wall clock interval stable, regardless of the number of profiled threads
             int estimated_thread_count = thread_filter_enabled ? thread_filter->size() : thread_list->size();
             next_cycle_time += adjustInterval(_interval, estimated_thread_count);
         }
 
-        for (int count = 0; count < THREADS_PER_TICK; ) {
+        for (int count = 0; count < threads_per_tick; ) {
             int thread_id = thread_list->next();
             if (thread_id == -1) {
                 thread_list->rewind();
@@ -142,7 +154,9 @@ void WallClock::timerLoop() {
             }
 
             if (sample_idle_threads || OS::threadState(thread_id) == THREAD_RUNNING) {
-                if (OS::sendSignalToThread(thread_id, SIGVTALRM)) {
+                bool sent = burst ? OS::queueSignalToThread(thread_id, SIGVTALRM, (int)concurrency->tick())
+                                  : OS::sendSignalToThread(thread_id, SIGVTALRM);
+                if (sent) {
                     count++;
                 }
             }
@@ -0,0 +1,48 @@
+public class ExceptionsTarget implements Runnable {
+    public static volatile Object sink;
+
+    public static void main(String[] args) {
+        // Threads killed by uncaught exceptions should not flood the console
+        Thread.setDefaultUncaughtExceptionHandler(new Thread.UncaughtExceptionHandler() {
+            @Override
+            public void uncaughtException(Thread t, Throwable e) {
+            }
+        });
+
+        new Thread(new ExceptionsTarget(), "CaughtThread").start();
+
+        while (true) {
+            Thread thread = new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    throwUncaught();
+                }
+            }, "UncaughtThread");
+            thread.start();
+            try {
+                thread.join();
+            } catch (InterruptedException e) {
+                return;
+            }
+        }
+    }
+
+    @Override
+    public void run() {
+        while (true) {
+            try {
+                throwCaught();
+            } catch (IllegalStateException e) {
+                sink = e;
+            }
+        }
+    }
+
+    private static void throwCaught() {
+        throw new IllegalStateException();
+    }
+
+    private static void throwUncaught() {
+        throw new UnsupportedOperationException();
+    }
+}
@@ -0,0 +1,205 @@
+import java.io.BufferedReader;
+import java.io.FileReader;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.atomic.AtomicLongArray;
+
+/**
+ * Workloads for the profiling overhead benchmark.
+ * Usage: java OverheadTarget WORKLOAD THREADS WARMUP_SEC DURATION_SEC
+ * Prints a single line: ops=N ops_per_sec=N p50_us=N p99_us=N rss_kb=N
+ */
+public class OverheadTarget {
+    // The idle workload models a large, mostly sleeping pool: THREADS busy workers among IDLE_THREADS sleepers
+    private static final int IDLE_THREADS = 2000;
+    private static final int RECURSION_DEPTH = 1000;
+    private static final int LOCKS = 4;
+
+    // Latency histogram: 8 linear sub-buckets per power of two nanoseconds
+    private static final int SUB_BUCKETS = 8;
+    private static final int BUCKETS = 64 * SUB_BUCKETS;
+
+    private static final Object[] locks = new Object[LOCKS];
+    private static volatile boolean measuring;
+    private static volatile boolean stopped;
+    private static final CountDownLatch stopLatch = new CountDownLatch(1);
+    private static volatile Object sink;
+    private static long sharedCounter;
+
+    static {
+        for (int i = 0; i < LOCKS; i++) {
+            locks[i] = new Object();
+        }
+    }
+
+    private static int bucket(long nanos) {
+        if (nanos < SUB_BUCKETS) {
+            return (int) nanos;
+        }
+        int log = 63 - Long.numberOfLeadingZeros(nanos);
+        int sub = (int) (nanos >>> (log - 3)) & (SUB_BUCKETS - 1);
+        return (log - 2) * SUB_BUCKETS + sub;
+    }
+
+    private static long bucketValue(int bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        int log = bucket / SUB_BUCKETS + 2;
+        int sub = bucket % SUB_BUCKETS;
+        return (long) (SUB_BUCKETS + sub) << (log - 3);
+    }
+
+    private static long percentile(AtomicLongArray histogram, long total, double p) {
+        long threshold = (long) Math.ceil(total * p);
+        long count = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            count += histogram.get(i);
+            if (count >= threshold) {
+                return bucketValue(i);
+            }
+        }
+        return bucketValue(BUCKETS - 1);
+    }
+
+    // Called once per operation; can be used as an instrumentation target
+    static void tick() {
+    }
+
+    static long cpuOp(long seed) {
+        for (int i = 0; i < 20000; i++) {
+            seed = seed * 6364136223846793005L + 1442695040888963407L;
+            seed ^= seed >>> 29;
+        }
+        return seed;
+    }
+
+    static long allocOp(long seed) {
+        Object[] objects = new Object[64];
+        for (int i = 0; i < objects.length; i++) {
+            objects[i] = new long[(int) (seed & 15) + i];
+            seed = seed * 31 + i;
+        }
+        objects[0] = new byte[64 * 1024];
+        sink = objects;
+        return seed;
+    }
+
+    static long lockOp(long seed) {
+        synchronized (locks[(int) (seed & (LOCKS - 1))]) {
+            sharedCounter++;
+            seed = cpuOp(seed) + sharedCounter;
+        }
+        return seed;
+    }
+
+    static long recursionOp(long seed, int depth) {
+        if (depth == 0) {
+            return cpuOp(seed);
+        }
+        return recursionOp(seed + depth, depth - 1) + 1;
+    }
+
+    static long idleOp(long seed) throws InterruptedException {
+        stopLatch.await();
+        return seed * 31 + 1;
+    }
+
+    static long runOp(String workload, long seed) throws InterruptedException {
+        if (workload.equals("cpu")) {
+            return cpuOp(seed);
+        } else if (workload.equals("alloc")) {
+            return allocOp(seed);
+        } else if (workload.equals("lock")) {
+            return lockOp(seed);
+        } else if (workload.equals("recursion")) {
+            return recursionOp(seed, RECURSION_DEPTH);
+        } else if (workload.equals("idle")) {
+            return cpuOp(seed);
+        }
+        throw new IllegalArgumentException("Unknown workload: " + workload);
+    }
+
+    static long rssKb() {
+        try {
+            BufferedReader reader = new BufferedReader(new FileReader("/proc/self/status"));
+            try {
+                for (String line; (line = reader.readLine()) != null; ) {
+                    if (line.startsWith("VmRSS:")) {
+                        return Long.parseLong(line.substring(6).trim().split("\\s+")[0]);
+                    }
+                }
+            } finally {
+                reader.close();
+            }
+        } catch (Exception e) {
+            // Not Linux
+        }
+        return 0;
+    }
+
+    public static void main(String[] args) throws Exception {
+        final String workload = args[0];
+        final int busyThreads = Integer.parseInt(args[1]);
+        int threadCount = workload.equals("idle") ? busyThreads + IDLE_THREADS : busyThreads;
+        long warmup = Long.parseLong(args[2]) * 1000;
+        long duration = Long.parseLong(args[3]) * 1000;
+
+        final AtomicLongArray histogram = new AtomicLongArray(BUCKETS);
+        final long[] ops = new long[threadCount];
+        Thread[] threads = new Thread[threadCount];
+
+        for (int i = 0; i < threadCount; i++) {
+            final int index = i;
+            // Deep recursion needs a larger stack
+            threads[i] = new Thread(null, new Runnable() {
+                @Override
+                public void run() {
+                    long seed = index;
+                    try {
+                        // Sleepers stay parked until the run stops; throughput and latency are those of busy workers
+                        if (index >= busyThreads) {
+                            seed = idleOp(seed);
+                        }
+                        while (!stopped) {
+                            long start = System.nanoTime();
+                            seed = runOp(workload, seed);
+                            tick();
+                            if (measuring) {
+                                histogram.incrementAndGet(bucket(System.nanoTime() - start));
+                                ops[index]++;
+                            }
+                        }
+                    } catch (InterruptedException e) {
+                        // exit
+                    }
+                    sink = seed;
+                }
+            }, "Worker-" + i, 16 * 1024 * 1024);
+            threads[i].start();
+        }
+
+        Thread.sleep(warmup);
+        measuring = true;
+        long start = System.nanoTime();
+        Thread.sleep(duration);
+        measuring = false;
+        long elapsed = System.nanoTime() - start;
+        stopped = true;
+        stopLatch.countDown();
+
+        for (Thread t : threads) {
+            t.join();
+        }
+
+        long total = 0;
+        for (long n : ops) {
+            total += n;
+        }
+
+        System.out.println("ops=" + total +
+                " ops_per_sec=" + (long) (total * 1e9 / elapsed) +
+                " p50_us=" + percentile(histogram, total, 0.50) / 1000.0 +
+                " p99_us=" + percentile(histogram, total, 0.99) / 1000.0 +
+                " rss_kb=" + rssKb());
+    }
+}
@@ -0,0 +1,392 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Standalone microbenchmarks of the profiler's hot-path data structures.
+// No JVM is needed: every benchmark feeds synthetic native frames.
+// Results are printed as CSV, one line per benchmark:
+//   benchmark,threads,ops,ns_per_op,allocs_per_op
+
+#include <new>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "flameGraph.h"
+#include "os.h"
+#include "profiler.h"
+#include "symbols.h"
+
+
+const int TRACE_POOL_SIZE = 8192;
+const int TRACE_DEPTH = 32;
+const int FRAME_NAMES = 1024;
+const int STORE_ITERATIONS = 1000000;
+const int CODE_BLOBS = 10000;
+const int SYMBOLS = 100000;
+const int LOOKUPS = 1000000;
+const int MAX_BENCH_THREADS = 16;
+const int DEEP_TRACE_DEPTH = 500;
+const int CHANGED_FRAMES = 4;
+
+
+static volatile u64 _allocs = 0;
+
+void* operator new(size_t size) {
+    atomicInc(_allocs);
+    void* p = malloc(size);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) throw() {
+    free(p);
+}
+
+
+// Discards output, but lets the writer do all formatting work
+class NullOutput : public std::streambuf {
+  protected:
+    int_type overflow(int_type c) {
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) {
+        return n;
+    }
+};
+
+
+class Measurement {
+  private:
+    const char* _name;
+    int _threads;
+    u64 _start_time;
+    u64 _start_allocs;
+
+  public:
+    Measurement(const char* name, int threads = 1) : _name(name), _threads(threads) {
+        _start_allocs = _allocs;
+        _start_time = OS::nanotime();
+    }
+
+    void report(u64 ops) {
+        u64 elapsed = OS::nanotime() - _start_time;
+        u64 allocs = _allocs - _start_allocs;
+        if (ops == 0) ops = 1;
+        printf("%s,%d,%llu,%.1f,%.3f\n", _name, _threads, ops, (double)elapsed / ops, (double)allocs / ops);
+        fflush(stdout);
+    }
+};
+
+
+class MicroBenchmark {
+  private:
+    static char* _frame_names[FRAME_NAMES];
+    static ASGCT_CallFrame _pool[TRACE_POOL_SIZE][TRACE_DEPTH];
+    static int _call_trace_ids[TRACE_POOL_SIZE];
+
+    static u64 random(u64& seed) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return seed >> 16;
+    }
+
+    // Traces share common roots like real Java stacks do: deeper frames are less diverse
+    static void generateTraces() {
+        char name[32];
+        for (int i = 0; i < FRAME_NAMES; i++) {
+            sprintf(name, "frame_%d", i);
+            _frame_names[i] = strdup(name);
+        }
+
+        u64 seed = 1;
+        for (int i = 0; i < TRACE_POOL_SIZE; i++) {
+            for (int j = 0; j < TRACE_DEPTH; j++) {
+                int diversity = 1 + (FRAME_NAMES - 1) * (TRACE_DEPTH - j) / TRACE_DEPTH;
+                _pool[i][j].bci = BCI_NATIVE_FRAME;
+                _pool[i][j].method_id = (jmethodID)_frame_names[random(seed) % diversity];
+            }
+        }
+    }
+
+    static void resetProfiler(int frame_buffer_size) {
+        Profiler* p = &Profiler::_instance;
+        memset(p->_hashes, 0, sizeof(p->_hashes));
+        memset(p->_traces, 0, sizeof(p->_traces));
+        p->_frame_dictionary.clear();
+        p->reserveOverflowTraces();
+
+        Arguments args;
+        args._framebuf = frame_buffer_size;
+        p->_frame_buffer_index = 0;
+        p->allocateBuffers(args);
+        p->_frame_buffer_overflow = false;
+        p->_add_line_numbers = false;
+    }
+
+    static void benchHashCallTrace() {
+        Profiler* p = &Profiler::_instance;
+        u64 sink = 0;
+
+        Measurement m("hashCallTrace");
+        for (int i = 0; i < STORE_ITERATIONS; i++) {
+            sink += p->hashCallTrace(TRACE_DEPTH, _pool[i % TRACE_POOL_SIZE]);
+        }
+        m.report(STORE_ITERATIONS);
+
+        if (sink == 0) printf("# unlikely hash sum\n");
+    }
+
+    // Deep stack where only a few top frames change between samples of the same thread
+    static void benchStackCache() {
+        Profiler* p = &Profiler::_instance;
+        ASGCT_CallFrame frames[DEEP_TRACE_DEPTH];
+        for (int i = 0; i < DEEP_TRACE_DEPTH; i++) {
+            frames[i].bci = i;
+            frames[i].method_id = (jmethodID)_frame_names[i % FRAME_NAMES];
+        }
+
+        u64 sink = 0;
+        {
+            Measurement m("hashCallTrace(deep)");
+            for (int i = 0; i < STORE_ITERATIONS; i++) {
+                frames[i % CHANGED_FRAMES].bci = i;
+                sink += p->hashCallTrace(DEEP_TRACE_DEPTH, frames);
+            }
+            m.report(STORE_ITERATIONS);
+        }
+
+        void* memory = malloc(StackCache::size());
+        StackCache cache;
+        cache.init(memory, p->bciMask());
+        {
+            Measurement m("StackCache::hash(deep)");
+            for (int i = 0; i < STORE_ITERATIONS; i++) {
+                frames[i % CHANGED_FRAMES].bci = i;
+                sink += cache.hash(1, DEEP_TRACE_DEPTH, frames);
+            }
+            m.report(STORE_ITERATIONS);
+        }
+        free(memory);
+
+        if (sink == 0) printf("# unlikely hash sum\n");
+    }
+
+    static void* storeCallTraceThread(void* arg) {
+        int threads = (int)(uintptr_t)arg;
+        Profiler* p = &Profiler::_instance;
+        u64 seed = (u64)OS::threadId();
+        u64 words[TRACE_DEPTH];
+
+        for (int i = STORE_ITERATIONS / threads; i > 0; i--) {
+            p->storeCallTrace(TRACE_DEPTH, _pool[random(seed) % TRACE_POOL_SIZE], words, 1);
+        }
+        return NULL;
+    }
+
+    static void benchStoreCallTrace(int threads) {
+        pthread_t thread[MAX_BENCH_THREADS];
+        resetProfiler(TRACE_POOL_SIZE * TRACE_DEPTH);
+
+        Measurement m("storeCallTrace", threads);
+        for (int i = 0; i < threads; i++) {
+            pthread_create(&thread[i], NULL, storeCallTraceThread, (void*)(uintptr_t)threads);
+        }
+        for (int i = 0; i < threads; i++) {
+            pthread_join(thread[i], NULL);
+        }
+        m.report(STORE_ITERATIONS / threads * threads);
+    }
+
+    static void benchCodeCache() {
+        CodeCache* cc = new CodeCache();
+        const char* base = (const char*)0x10000000;
+        u64 seed = 1;
+
+        Measurement add("CodeCache::add");
+        for (int i = 0; i < CODE_BLOBS; i++) {
+            cc->add(base + i * 256, 200, (jmethodID)(uintptr_t)(i + 1));
+        }
+        add.report(CODE_BLOBS);
+
+        // find() is a linear scan, so do fewer lookups to keep the run short
+        const int lookups = LOOKUPS / 100;
+        int found = 0;
+        Measurement find("CodeCache::find");
+        for (int i = 0; i < lookups; i++) {
+            if (cc->find(base + random(seed) % (CODE_BLOBS * 256)) != NULL) found++;
+        }
+        find.report(lookups);
+
+        Measurement remove("CodeCache::remove");
+        for (int i = 0; i < CODE_BLOBS; i += 2) {
+            cc->remove(base + i * 256, (jmethodID)(uintptr_t)(i + 1));
+        }
+        remove.report(CODE_BLOBS / 2);
+
+        delete cc;
+        if (found == 0) printf("# no code blobs found\n");
+    }
+
+    static void benchBinarySearch() {
+        NativeCodeCache* cc = new NativeCodeCache("bench");
+        const char* base = (const char*)0x20000000;
+        char name[32];
+        u64 seed = 1;
+
+        Measurement add("NativeCodeCache::add");
+        for (int i = 0; i < SYMBOLS; i++) {
+            sprintf(name, "symbol_%d", i);
+            cc->add(base + (random(seed) % SYMBOLS) * 64, 48, name);
+        }
+        add.report(SYMBOLS);
+
+        Measurement sort("NativeCodeCache::sort");
+        cc->sort();
+        sort.report(1);
+
+        int found = 0;
+        Measurement search("NativeCodeCache::binarySearch");
+        for (int i = 0; i < LOOKUPS; i++) {
+            if (cc->binarySearch(base + random(seed) % (SYMBOLS * 64)) != cc->name()) found++;
+        }
+        search.report(LOOKUPS);
+
+        delete cc;
+        if (found == 0) printf("# no symbols found\n");
+    }
+
+    // Libraries are parsed once per process, so this measures the cold path only
+    static void benchParseLibraries() {
+        NativeCodeCache** libs = new NativeCodeCache*[MAX_NATIVE_LIBS];
+        volatile int count = 0;
+
+        Measurement m("Symbols::parseLibraries");
+        Symbols::parseLibraries(libs, count, MAX_NATIVE_LIBS, false);
+        m.report(1);
+
+        for (int i = 0; i < count; i++) {
+            delete libs[i];
+        }
+        delete[] libs;
+    }
+
+    static void benchFlameGraph() {
+        FlameGraph flamegraph("Benchmark", COUNTER_SAMPLES, 1200, 16, 0.25, false);
+        NullOutput null_output;
+        std::ostream out(&null_output);
+
+        Measurement build("FlameGraph::build");
+        for (int i = 0; i < TRACE_POOL_SIZE; i++) {
+            Trie* f = flamegraph.root();
+            for (int j = TRACE_DEPTH - 1; j >= 0; j--) {
+                f = f->addChild((const char*)_pool[i][j].method_id, 1);
+            }
+            f->addLeaf(1);
+        }
+        build.report(TRACE_POOL_SIZE);
+
+        Measurement html("FlameGraph::dump(svg)");
+        flamegraph.dump(out, false);
+        html.report(1);
+
+        Measurement tree("FlameGraph::dump(tree)");
+        flamegraph.dump(out, true);
+        tree.report(1);
+    }
+
+    static void* recordSampleThread(void* arg) {
+        int lock_index = (int)(uintptr_t)arg;
+        Profiler* p = &Profiler::_instance;
+        int tid = OS::threadId();
+        Context context = {0, 0};
+        u64 seed = (u64)tid;
+
+        for (int i = STORE_ITERATIONS / CONCURRENCY_LEVEL; i > 0; i--) {
+            int call_trace_id = _call_trace_ids[random(seed) % TRACE_POOL_SIZE];
+            p->_jfr.recordExecutionSample(lock_index, tid, call_trace_id, THREAD_RUNNING, context);
+        }
+        return NULL;
+    }
+
+    static void benchFlightRecorder(const char* file) {
+        Profiler* p = &Profiler::_instance;
+        pthread_t thread[CONCURRENCY_LEVEL];
+
+        resetProfiler(TRACE_POOL_SIZE * TRACE_DEPTH);
+        for (int i = 0; i < TRACE_POOL_SIZE; i++) {
+            _call_trace_ids[i] = p->storeCallTrace(TRACE_DEPTH, _pool[i], p->_frame_words[0], 1);
+        }
+
+        Error error = p->_jfr.start(file, p->_jfr_buffers);
+        if (error) {
+            fprintf(stderr, "%s\n", error.message());
+            return;
+        }
+
+        // Each thread owns its buffer, as samples are serialized by the stripe lock in recordSample
+        Measurement record("Recording::recordExecutionSample", CONCURRENCY_LEVEL);
+        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+            pthread_create(&thread[i], NULL, recordSampleThread, (void*)(uintptr_t)i);
+        }
+        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+            pthread_join(thread[i], NULL);
+        }
+        record.report(STORE_ITERATIONS / CONCURRENCY_LEVEL * CONCURRENCY_LEVEL);
+
+        Measurement finish("Recording::finish");
+        p->_jfr.stop();
+        finish.report(1);
+
+        unlink(file);
+    }
+
+  public:
+    static void run(int max_threads) {
+        generateTraces();
+
+        printf("benchmark,threads,ops,ns_per_op,allocs_per_op\n");
+        benchHashCallTrace();
+        benchStackCache();
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            benchStoreCallTrace(threads);
+        }
+        benchCodeCache();
+        benchBinarySearch();
+        benchParseLibraries();
+        benchFlameGraph();
+
+        char file[64];
+        sprintf(file, "/tmp/async-profiler-bench.%d.jfr", getpid());
+        benchFlightRecorder(file);
+    }
+};
+
+char* MicroBenchmark::_frame_names[FRAME_NAMES];
+ASGCT_CallFrame MicroBenchmark::_pool[TRACE_POOL_SIZE][TRACE_DEPTH];
+int MicroBenchmark::_call_trace_ids[TRACE_POOL_SIZE];
+
+
+int main(int argc, char** argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    if (max_threads < 1 || max_threads > MAX_BENCH_THREADS) {
+        fprintf(stderr, "Usage: %s [max_threads <= %d]\n", argv[0], MAX_BENCH_THREADS);
+        return 1;
+    }
+
+    MicroBenchmark::run(max_threads);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#!/bin/bash
+
+# Measures profiling overhead on representative workloads.
+# Every workload runs once without the profiler and once per profiling configuration.
+# Results are printed as CSV:
+#   workload,event,interval,ops_per_sec,throughput_change%,p99_us,p99_change%,samples,samples_per_sec,failed%,skipped%,rss_delta_kb
+#
+# Environment variables:
+#   WORKLOADS - subset of workloads to run (default: cpu alloc lock idle recursion)
+#   CONFIGS   - subset of event:interval pairs to run (default: see below)
+#   THREADS   - worker threads per workload (default: number of CPUs)
+#   WARMUP    - warmup seconds before measuring (default: 5)
+#   DURATION  - measured seconds (default: 20)
+
+set -e  # exit on any failure, except profiled runs that are reported below
+
+if [ -z "${JAVA_HOME}" ]; then
+  echo "JAVA_HOME is not set"
+  exit 1
+fi
+
+WORKLOADS=${WORKLOADS:-"cpu alloc lock idle recursion"}
+CONFIGS=${CONFIGS:-"cpu:1ms cpu:10ms itimer:1ms itimer:10ms wall:5ms wall:50ms alloc:128k alloc:2m lock:0 lock:1ms OverheadTarget.tick:1 OverheadTarget.tick:1000"}
+THREADS=${THREADS:-$(getconf _NPROCESSORS_ONLN)}
+WARMUP=${WARMUP:-5}
+DURATION=${DURATION:-20}
+
+(
+  cd $(dirname $0)
+
+  if [ "OverheadTarget.class" -ot "OverheadTarget.java" ]; then
+     ${JAVA_HOME}/bin/javac OverheadTarget.java
+  fi
+
+  PROFILER=$(cd ../../build && pwd)/libasyncProfiler.so
+  SUMMARY=/tmp/async-profiler-overhead.$$.txt
+
+  # Prints the value of KEY=VALUE from the line produced by OverheadTarget
+  function result() {
+    echo "$1" | tr ' ' '\n' | grep "^$2=" | cut -d= -f2
+  }
+
+  # Relative change of NEW against OLD: percent_change NEW OLD
+  function percent_change() {
+    awk -v a="$1" -v b="$2" 'BEGIN { if (b == 0) print "0.00"; else printf "%.2f", (a - b) * 100 / b }'
+  }
+
+  # Sums percentages of failure lines in the profiler summary: "name : count (P%)"
+  function failure_percent() {
+    awk -v skip_only="$2" '
+      /^--- Execution profile ---/ { section = 1; next }
+      section && /^$/ { exit }
+      section && /\(/ && (!skip_only || $1 == "skipped") { gsub(/[(%)]/, "", $4); sum += $4 }
+      END { printf "%.2f", sum }' "$1"
+  }
+
+  echo "workload,event,interval,ops_per_sec,throughput_change%,p99_us,p99_change%,samples,samples_per_sec,failed%,skipped%,rss_delta_kb"
+
+  for workload in $WORKLOADS; do
+    baseline=$(${JAVA_HOME}/bin/java OverheadTarget $workload $THREADS $WARMUP $DURATION)
+    base_ops=$(result "$baseline" ops_per_sec)
+    base_p99=$(result "$baseline" p99_us)
+    base_rss=$(result "$baseline" rss_kb)
+    echo "$workload,none,0,$base_ops,0.00,$base_p99,0.00,0,0,0.00,0.00,0"
+
+    for config in $CONFIGS; do
+      event=${config%:*}
+      interval=${config#*:}
+      rm -f $SUMMARY
+
+      output=$(${JAVA_HOME}/bin/java -agentpath:$PROFILER=start,event=$event,interval=$interval,summary,file=$SUMMARY \
+               OverheadTarget $workload $THREADS $WARMUP $DURATION) || true
+
+      if [ ! -f $SUMMARY ]; then
+        echo "$workload,$event,$interval,failed to profile" >&2
+        continue
+      fi
+
+      ops=$(result "$output" ops_per_sec)
+      p99=$(result "$output" p99_us)
+      rss=$(result "$output" rss_kb)
+      samples=$(grep "^Total samples" $SUMMARY | awk '{ print $4 }')
+      samples=${samples:-0}
+
+      ops_change=$(percent_change $ops $base_ops)
+      p99_change=$(percent_change $p99 $base_p99)
+      samples_per_sec=$((samples / (WARMUP + DURATION)))
+      failed=$(failure_percent $SUMMARY 0)
+      skipped=$(failure_percent $SUMMARY 1)
+
+      echo "$workload,$event,$interval,$ops,$ops_change,$p99,$p99_change,$samples,$samples_per_sec,$failed,$skipped,$((rss - base_rss))"
+    done
+  done
+
+  rm -f $SUMMARY
+)
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Loads a profile snapshot (dumped with the 'snapshot' output option)
+// and runs every output generator on it without a JVM.
+// Timings are printed as CSV: output,ms,bytes
+// When an output directory is given, the generated files are kept there
+// and can be compared between builds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "os.h"
+#include "profiler.h"
+#include "snapshot.h"
+
+
+// Counts bytes and writes them to a file, if any
+class CountingOutput : public std::streambuf {
+  private:
+    FILE* _file;
+    u64 _bytes;
+
+  protected:
+    int_type overflow(int_type c) {
+        if (c != traits_type::eof()) {
+            char ch = (char)c;
+            xsputn(&ch, 1);
+        }
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) {
+        if (_file != NULL) fwrite(s, 1, n, _file);
+        _bytes += n;
+        return n;
+    }
+
+  public:
+    CountingOutput(FILE* file) : _file(file), _bytes(0) {
+    }
+
+    u64 bytes() {
+        return _bytes;
+    }
+};
+
+
+static void replay(Arguments& args, Output output, const char* name, const char* dir) {
+    char path[1024];
+    FILE* file = NULL;
+    if (dir != NULL) {
+        snprintf(path, sizeof(path), "%s/profile.%s", dir, name);
+        file = fopen(path, "w");
+        if (file == NULL) {
+            perror(path);
+            return;
+        }
+    }
+
+    CountingOutput counter(file);
+    std::ostream out(&counter);
+
+    args._action = ACTION_DUMP;
+    args._output = output;
+
+    u64 start = OS::nanotime();
+    Profiler::_instance.runInternal(args, out);
+    out.flush();
+    u64 elapsed = OS::nanotime() - start;
+
+    if (file != NULL) fclose(file);
+    printf("%s,%.3f,%llu\n", name, elapsed / 1e6, counter.bytes());
+}
+
+static void replayRecording(const char* dir) {
+    char path[1024];
+    if (dir != NULL) {
+        snprintf(path, sizeof(path), "%s/profile.jfr", dir);
+    } else {
+        snprintf(path, sizeof(path), "/tmp/async-profiler-replay.%d.jfr", getpid());
+    }
+
+    u64 start = OS::nanotime();
+    Error error = Snapshot::replayRecording(path);
+    u64 elapsed = OS::nanotime() - start;
+
+    if (error) {
+        fprintf(stderr, "jfr: %s\n", error.message());
+        return;
+    }
+
+    struct stat st;
+    u64 bytes = stat(path, &st) == 0 ? st.st_size : 0;
+    if (dir == NULL) unlink(path);
+    printf("jfr,%.3f,%llu\n", elapsed / 1e6, bytes);
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s SNAPSHOT [OPTIONS [OUTPUT_DIR]]\n"
+                        "  OPTIONS are profiler options affecting output, e.g. simple,reverse,include=PATTERN\n",
+                argv[0]);
+        return 1;
+    }
+
+    Arguments args;
+    Error error = args.parse(argc > 2 ? argv[2] : NULL);
+    if (error) {
+        fprintf(stderr, "%s\n", error.message());
+        return 1;
+    }
+    if (args._dump_traces == 0) args._dump_traces = 200;
+    if (args._dump_flat == 0) args._dump_flat = 200;
+
+    u64 start = OS::nanotime();
+    error = Snapshot::read(argv[1]);
+    if (error) {
+        fprintf(stderr, "%s: %s\n", argv[1], error.message());
+        return 1;
+    }
+
+    const char* dir = argc > 3 ? argv[3] : NULL;
+    if (dir != NULL) {
+        mkdir(dir, 0755);
+    }
+
+    printf("output,ms,bytes\n");
+    printf("load,%.3f,0\n", (OS::nanotime() - start) / 1e6);
+    replay(args, OUTPUT_COLLAPSED, "collapsed", dir);
+    replay(args, OUTPUT_FLAMEGRAPH, "svg", dir);
+    replay(args, OUTPUT_TREE, "html", dir);
+    replay(args, OUTPUT_TEXT, "txt", dir);
+    replayRecording(dir);
+    return 0;
+}
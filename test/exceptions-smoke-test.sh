@@ -0,0 +1,48 @@
+#!/bin/bash
+
+set -e  # exit on any failure
+set -x  # print all executed lines
+
+if [ -z "${JAVA_HOME}" ]; then
+  echo "JAVA_HOME is not set"
+  exit 1
+fi
+
+(
+  cd $(dirname $0)
+
+  if [ "ExceptionsTarget.class" -ot "ExceptionsTarget.java" ]; then
+     ${JAVA_HOME}/bin/javac ExceptionsTarget.java
+  fi
+
+  # Exception events are available only when the agent is loaded at startup with event=exceptions
+  ${JAVA_HOME}/bin/java -agentpath:../build/libasyncProfiler.so=event=exceptions ExceptionsTarget &
+
+  FILENAME=/tmp/java.trace
+  JAVAPID=$!
+
+  function assert_string() {
+    if ! grep -q "$1" $FILENAME; then
+      exit 1
+    fi
+  }
+
+  function assert_no_string() {
+    if grep -q "$1" $FILENAME; then
+      exit 1
+    fi
+  }
+
+  sleep 1     # allow the Java runtime to initialize
+  ../profiler.sh -f $FILENAME -o collapsed -d 3 -e exceptions $JAVAPID
+
+  assert_string "ExceptionsTarget.throwCaught;java.lang.IllegalStateException [0-9]\+$"
+  assert_string "ExceptionsTarget.throwUncaught;java.lang.UnsupportedOperationException [0-9]\+$"
+
+  ../profiler.sh -f $FILENAME -o collapsed -d 3 -e exceptions --caught $JAVAPID
+
+  kill $JAVAPID
+
+  assert_string "ExceptionsTarget.throwCaught;java.lang.IllegalStateException [0-9]\+$"
+  assert_no_string "java.lang.UnsupportedOperationException"
+)
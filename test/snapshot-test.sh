@@ -0,0 +1,44 @@
+#!/bin/bash
+
+set -e  # exit on any failure
+set -x  # print all executed lines
+
+if [ -z "${JAVA_HOME}" ]; then
+  echo "JAVA_HOME is not set"
+  exit 1
+fi
+
+(
+  cd $(dirname $0)
+
+  if [ "Target.class" -ot "Target.java" ]; then
+     ${JAVA_HOME}/bin/javac Target.java
+  fi
+
+  ${JAVA_HOME}/bin/java Target &
+
+  COLLAPSED=/tmp/java.collapsed
+  SNAPSHOT=/tmp/java.snapshot
+  REPLAY_DIR=/tmp/java.replay
+  JAVAPID=$!
+
+  sleep 1     # allow the Java runtime to initialize
+  ../profiler.sh start $JAVAPID
+  sleep 5
+
+  # Both dumps come from the same stopped session
+  ../profiler.sh stop -f $COLLAPSED -o collapsed $JAVAPID
+  ../profiler.sh stop -f $SNAPSHOT -o snapshot $JAVAPID
+
+  kill $JAVAPID
+
+  rm -rf $REPLAY_DIR
+  ../build/replay $SNAPSHOT collapsed $REPLAY_DIR
+
+  # Traces are written in table order, which the snapshot need not keep
+  if ! diff <(sort $COLLAPSED) <(sort $REPLAY_DIR/profile.collapsed); then
+    exit 1
+  fi
+
+  grep -q "Target.main;Target.method1 " $COLLAPSED
+)